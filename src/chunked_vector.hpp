@@ -0,0 +1,112 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <memory_resource>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace bedrock
+{
+
+/// A sequence of trivially copyable elements stored in fixed-size chunks, so it can grow without ever relocating or
+/// copying what it already holds. Appending costs the same whether or not a new chunk is needed, rather than every so
+/// often costing a copy of the whole sequence like std::vector does when it runs out of capacity.
+///
+/// Chunks are allocated from a std::pmr::memory_resource, which must outlive the sequence. Chunks that are freed up by
+/// shrinking the sequence are kept for reuse until the sequence is destroyed or shrink_to_fit is called. Like the
+/// std::pmr containers, a copy uses the default memory resource, while assigning keeps the resource of the target.
+///
+/// \tparam T The type of the elements.
+/// \tparam chunk_bytes The size of each chunk. This must be a power of two, and at least the size of an element. The
+/// default of a page keeps small sequences small while making the list of chunks tiny next to what it points to.
+template <typename T, std::size_t chunk_bytes = 0x1000>
+class chunked_vector
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(std::has_single_bit(chunk_bytes) && chunk_bytes >= sizeof(T));
+
+public:
+    using value_type = T;
+
+    /// The number of elements in each chunk.
+    static constexpr std::size_t chunk_size = std::bit_floor(chunk_bytes / sizeof(T));
+
+    /// Makes an empty sequence whose chunks come from the given memory resource.
+    explicit chunked_vector(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept;
+
+    chunked_vector(const chunked_vector& other);
+
+    chunked_vector(chunked_vector&& other) noexcept;
+
+    chunked_vector& operator=(const chunked_vector& other);
+
+    /// Takes the chunks of other if both use the same memory resource, otherwise copies its elements.
+    chunked_vector& operator=(chunked_vector&& other);
+
+    ~chunked_vector();
+
+    /// Gets the memory resource the chunks come from.
+    std::pmr::memory_resource* resource() const noexcept;
+
+    /// Whether or not the sequence holds any elements.
+    bool empty() const noexcept;
+
+    /// The number of elements in the sequence.
+    std::size_t size() const noexcept;
+
+    /// Gets an element. The index must be less than size.
+    T& operator[](std::size_t index) noexcept;
+
+    /// Gets an element. The index must be less than size.
+    const T& operator[](std::size_t index) const noexcept;
+
+    /// Gets the last element. The sequence must not be empty.
+    T& back() noexcept;
+
+    /// Gets the last element. The sequence must not be empty.
+    const T& back() const noexcept;
+
+    /// Gets the elements from an index up to the end of its chunk or of the sequence, whichever comes first. Walking a
+    /// sequence with this visits every element without going through operator[] for each of them.
+    std::span<const T> contiguous(std::size_t index) const noexcept;
+
+    /// Appends an element to the end of the sequence.
+    void push_back(const T& value);
+
+    /// Appends elements to the end of the sequence, a chunk at a time.
+    void append(std::span<const T> values);
+
+    /// Replaces the contents of the sequence with the given elements.
+    void assign(std::span<const T> values);
+
+    /// Changes the number of elements, value-initializing any new elements.
+    void resize(std::size_t size);
+
+    /// Removes every element, keeping the chunks for reuse.
+    void clear() noexcept;
+
+    /// Frees the chunks that no elements are stored in.
+    void shrink_to_fit() noexcept;
+
+private:
+    /// The number of bits of an index that select the element within its chunk.
+    static constexpr std::size_t chunk_shift = std::countr_zero(chunk_size);
+
+    /// Makes sure there are enough chunks to hold the given number of elements.
+    void reserve_chunks(std::size_t size);
+
+    /// Frees every chunk from the given index on.
+    void free_chunks(std::size_t first) noexcept;
+
+    /// The chunks, of which only enough for size elements are in use. Only this list of pointers is ever relocated.
+    std::pmr::vector<T*> _chunks;
+
+    /// The number of elements in the sequence.
+    std::size_t _size;
+};
+
+} // End namespace bedrock.
+
+#include "chunked_vector.ipp"
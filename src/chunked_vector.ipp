@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "chunked_vector.hpp"
+
+namespace bedrock
+{
+
+template <typename T, std::size_t chunk_bytes>
+chunked_vector<T, chunk_bytes>::chunked_vector(std::pmr::memory_resource* resource) noexcept
+        : _chunks(resource)
+        , _size(0)
+{
+}
+
+template <typename T, std::size_t chunk_bytes>
+chunked_vector<T, chunk_bytes>::chunked_vector(const chunked_vector& other)
+        : chunked_vector()
+{
+    *this = other;
+}
+
+template <typename T, std::size_t chunk_bytes>
+chunked_vector<T, chunk_bytes>::chunked_vector(chunked_vector&& other) noexcept
+        : _chunks(std::move(other._chunks))
+        , _size(std::exchange(other._size, 0))
+{
+}
+
+template <typename T, std::size_t chunk_bytes>
+chunked_vector<T, chunk_bytes>& chunked_vector<T, chunk_bytes>::operator=(const chunked_vector& other)
+{
+    if (this == &other)
+        return *this;
+    clear();
+    reserve_chunks(other._size);
+    for (std::size_t index = 0; index < other._size; index += chunk_size)
+    {
+        std::span<const T> chunk = other.contiguous(index);
+        std::memcpy(_chunks[index >> chunk_shift], chunk.data(), chunk.size_bytes());
+    }
+    _size = other._size;
+    return *this;
+}
+
+template <typename T, std::size_t chunk_bytes>
+chunked_vector<T, chunk_bytes>& chunked_vector<T, chunk_bytes>::operator=(chunked_vector&& other)
+{
+    if (resource() != other.resource())
+        return *this = std::as_const(other);
+    free_chunks(0);
+    _chunks = std::move(other._chunks);
+    _size   = std::exchange(other._size, 0);
+    return *this;
+}
+
+template <typename T, std::size_t chunk_bytes>
+chunked_vector<T, chunk_bytes>::~chunked_vector()
+{
+    free_chunks(0);
+}
+
+template <typename T, std::size_t chunk_bytes>
+std::pmr::memory_resource* chunked_vector<T, chunk_bytes>::resource() const noexcept
+{
+    return _chunks.get_allocator().resource();
+}
+
+template <typename T, std::size_t chunk_bytes>
+bool chunked_vector<T, chunk_bytes>::empty() const noexcept
+{
+    return _size == 0;
+}
+
+template <typename T, std::size_t chunk_bytes>
+std::size_t chunked_vector<T, chunk_bytes>::size() const noexcept
+{
+    return _size;
+}
+
+template <typename T, std::size_t chunk_bytes>
+T& chunked_vector<T, chunk_bytes>::operator[](std::size_t index) noexcept
+{
+    return _chunks[index >> chunk_shift][index & (chunk_size - 1)];
+}
+
+template <typename T, std::size_t chunk_bytes>
+const T& chunked_vector<T, chunk_bytes>::operator[](std::size_t index) const noexcept
+{
+    return _chunks[index >> chunk_shift][index & (chunk_size - 1)];
+}
+
+template <typename T, std::size_t chunk_bytes>
+T& chunked_vector<T, chunk_bytes>::back() noexcept
+{
+    return (*this)[_size - 1];
+}
+
+template <typename T, std::size_t chunk_bytes>
+const T& chunked_vector<T, chunk_bytes>::back() const noexcept
+{
+    return (*this)[_size - 1];
+}
+
+template <typename T, std::size_t chunk_bytes>
+std::span<const T> chunked_vector<T, chunk_bytes>::contiguous(std::size_t index) const noexcept
+{
+    if (index >= _size)
+        return {};
+    std::size_t offset = index & (chunk_size - 1);
+    return std::span<const T>(_chunks[index >> chunk_shift] + offset, std::min(chunk_size - offset, _size - index));
+}
+
+template <typename T, std::size_t chunk_bytes>
+void chunked_vector<T, chunk_bytes>::push_back(const T& value)
+{
+    if ((_size & (chunk_size - 1)) == 0)
+        reserve_chunks(_size + 1);
+    (*this)[_size++] = value;
+}
+
+template <typename T, std::size_t chunk_bytes>
+void chunked_vector<T, chunk_bytes>::append(std::span<const T> values)
+{
+    reserve_chunks(_size + values.size());
+    while (!values.empty())
+    {
+        std::size_t offset = _size & (chunk_size - 1);
+        std::size_t count  = std::min(chunk_size - offset, values.size());
+        std::memcpy(_chunks[_size >> chunk_shift] + offset, values.data(), count * sizeof(T));
+        values = values.subspan(count);
+        _size += count;
+    }
+}
+
+template <typename T, std::size_t chunk_bytes>
+void chunked_vector<T, chunk_bytes>::assign(std::span<const T> values)
+{
+    clear();
+    append(values);
+}
+
+template <typename T, std::size_t chunk_bytes>
+void chunked_vector<T, chunk_bytes>::resize(std::size_t size)
+{
+    reserve_chunks(size);
+    for (; _size < size; ++_size)
+        (*this)[_size] = T();
+    _size = size;
+}
+
+template <typename T, std::size_t chunk_bytes>
+void chunked_vector<T, chunk_bytes>::clear() noexcept
+{
+    _size = 0;
+}
+
+template <typename T, std::size_t chunk_bytes>
+void chunked_vector<T, chunk_bytes>::shrink_to_fit() noexcept
+{
+    free_chunks((_size + chunk_size - 1) >> chunk_shift);
+}
+
+template <typename T, std::size_t chunk_bytes>
+void chunked_vector<T, chunk_bytes>::reserve_chunks(std::size_t size)
+{
+    std::size_t num_chunks = (size + chunk_size - 1) >> chunk_shift;
+    _chunks.reserve(num_chunks);
+    while (_chunks.size() < num_chunks)
+        _chunks.push_back(static_cast<T*>(resource()->allocate(chunk_size * sizeof(T), alignof(T))));
+}
+
+template <typename T, std::size_t chunk_bytes>
+void chunked_vector<T, chunk_bytes>::free_chunks(std::size_t first) noexcept
+{
+    for (std::size_t i = first; i < _chunks.size(); ++i)
+        resource()->deallocate(_chunks[i], chunk_size * sizeof(T), alignof(T));
+    _chunks.resize(std::min(first, _chunks.size()));
+}
+
+} // End namespace bedrock.
@@ -0,0 +1,88 @@
+#include <catch2/catch.hpp>
+
+#include <cstdint>
+#include <memory_resource>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "chunked_vector.hpp"
+
+namespace bedrock::test
+{
+
+TEST_CASE("chunked_vector", "[chunked_vector]")
+{
+    // Elements never move once appended, even as more chunks are added.
+    chunked_vector<std::uint32_t, 64> v;
+    REQUIRE(v.chunk_size == 16);
+    REQUIRE(v.empty());
+    REQUIRE(v.contiguous(0).empty());
+    v.push_back(7);
+    const std::uint32_t* first = &v[0];
+    for (std::uint32_t i = 1; i < 100; ++i)
+        v.push_back(7 * i + 7);
+    REQUIRE(&v[0] == first);
+    REQUIRE(v.size() == 100);
+    REQUIRE(v[99] == 700);
+    REQUIRE(v.back() == 700);
+    REQUIRE(v.contiguous(10).size() == 6);
+    REQUIRE(v.contiguous(96).size() == 4);
+
+    std::vector<std::uint32_t> values(40);
+    std::iota(std::begin(values), std::end(values), 0);
+    v.resize(10);
+    v.append(values);
+    REQUIRE(v.size() == 50);
+    REQUIRE(v[9] == 70);
+    REQUIRE(v[10] == 0);
+    REQUIRE(v[49] == 39);
+    REQUIRE(&v[0] == first);
+    v.resize(60);
+    REQUIRE(v[59] == 0);
+
+    chunked_vector<std::uint32_t, 64> copy(v);
+    REQUIRE(copy.size() == 60);
+    REQUIRE(copy[49] == 39);
+    v.clear();
+    REQUIRE(v.empty());
+    REQUIRE(copy[0] == 7);
+    v.assign(std::span(values).first(3));
+    REQUIRE(v.size() == 3);
+    REQUIRE(v[2] == 2);
+    REQUIRE(&v[0] == first);
+}
+
+TEST_CASE("chunked_vector memory resource", "[chunked_vector]")
+{
+    // Chunks come from the resource the sequence was made with, and go back to it when freed.
+    std::pmr::monotonic_buffer_resource    arena;
+    std::pmr::unsynchronized_pool_resource pool(&arena);
+    {
+        chunked_vector<std::uint8_t, 16> v(&pool);
+        REQUIRE(v.resource() == &pool);
+        for (int i = 0; i < 100; ++i)
+            v.push_back(static_cast<std::uint8_t>(i));
+        v.resize(20);
+        v.shrink_to_fit();
+        REQUIRE(v[19] == 19);
+
+        // A copy uses the default resource, while assignment keeps the resource of the target.
+        chunked_vector<std::uint8_t, 16> copy(v);
+        REQUIRE(copy.resource() == std::pmr::get_default_resource());
+        chunked_vector<std::uint8_t, 16> assigned(&pool);
+        assigned = copy;
+        REQUIRE(assigned.resource() == &pool);
+        REQUIRE(assigned[19] == 19);
+        assigned = std::move(copy);
+        REQUIRE(assigned.resource() == &pool);
+        REQUIRE(assigned.size() == 20);
+
+        chunked_vector<std::uint8_t, 16> moved(std::move(v));
+        REQUIRE(moved.resource() == &pool);
+        REQUIRE(moved[19] == 19);
+        REQUIRE(v.empty());
+    }
+}
+
+} // End namespace bedrock::test.
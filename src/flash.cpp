@@ -1,5 +1,8 @@
 #include "flash.hpp"
 
+#include <algorithm>
+#include <array>
+
 namespace bedrock
 {
 
@@ -11,6 +14,9 @@ void flash::perform_user_operation(user_operation op)
     case user_operation::toggle_serial_input: toggle_serial_input(); break;
     case user_operation::toggle_clock: toggle_clock(); break;
     case user_operation::wait_for_write_complete: wait_for_write_complete(); break;
+    case user_operation::toggle_io1: toggle_io(1); break;
+    case user_operation::toggle_io2: toggle_io(2); break;
+    case user_operation::toggle_io3: toggle_io(3); break;
     }
 }
 
@@ -22,6 +28,9 @@ char flash::user_operation_to_char(user_operation op)
     case user_operation::toggle_serial_input: return 'i';
     case user_operation::toggle_clock: return 'c';
     case user_operation::wait_for_write_complete: return 'w';
+    case user_operation::toggle_io1: return '1';
+    case user_operation::toggle_io2: return '2';
+    case user_operation::toggle_io3: return '3';
     default: throw std::invalid_argument("Cannot convert user_operation to char.");
     }
 }
@@ -34,8 +43,167 @@ flash::user_operation flash::char_to_user_operation(char c)
     case 'i': return user_operation::toggle_serial_input;
     case 'c': return user_operation::toggle_clock;
     case 'w': return user_operation::wait_for_write_complete;
+    case '1': return user_operation::toggle_io1;
+    case '2': return user_operation::toggle_io2;
+    case '3': return user_operation::toggle_io3;
     default: throw std::invalid_argument("Cannot convert char to user_operation.");
     }
 }
 
+void flash::clock_in_bytes(std::span<const std::byte> data, std::size_t num_io)
+{
+    for (std::byte b : data)
+    {
+        auto value = std::to_integer<std::uint8_t>(b);
+        switch (num_io)
+        {
+        case 1: clock_in_data_io<1, 8>(value); break;
+        case 2: clock_in_data_io<2, 8>(value); break;
+        case 4: clock_in_data_io<4, 8>(value); break;
+        default: throw std::invalid_argument("Can only clock in data over 1, 2, or 4 IOs.");
+        }
+    }
+}
+
+void flash::clock_out_bytes(std::span<std::byte> data, std::size_t num_io)
+{
+    for (std::byte& b : data)
+    {
+        switch (num_io)
+        {
+        case 1: b = std::byte{clock_out_data_io<1, 8, std::uint8_t>()}; break;
+        case 2: b = std::byte{clock_out_data_io<2, 8, std::uint8_t>()}; break;
+        case 4: b = std::byte{clock_out_data_io<4, 8, std::uint8_t>()}; break;
+        default: throw std::invalid_argument("Can only clock out data over 1, 2, or 4 IOs.");
+        }
+    }
+}
+
+void flash::transfer(std::uint8_t                 opcode,
+                     std::optional<std::uint32_t> address,
+                     std::span<const std::byte>   tx,
+                     std::span<std::byte>         rx)
+{
+    std::array<std::byte, 4> header{std::byte{opcode}};
+    std::size_t              header_size = 1;
+    if (address)
+    {
+        header[1]   = std::byte(*address >> 16);
+        header[2]   = std::byte(*address >> 8);
+        header[3]   = std::byte(*address);
+        header_size = 4;
+    }
+
+    toggle_chip_enable();
+    clock_in_bytes(std::span(header).first(header_size));
+    clock_in_bytes(tx);
+    clock_out_bytes(rx);
+    toggle_chip_enable();
+}
+
+void flash::write_enable()
+{
+    transfer(0x06, std::nullopt, {}, {});
+}
+
+void flash::page_program(std::uint32_t address, std::span<const std::byte> data)
+{
+    write_enable();
+    transfer(0x02, address, data, {});
+    wait_for_write_complete();
+}
+
+void flash::read(std::uint32_t address, std::span<std::byte> out)
+{
+    transfer(0x03, address, {}, out);
+}
+
+void flash::erase(erase_size size, std::uint32_t address)
+{
+    write_enable();
+    switch (size)
+    {
+    case erase_size::sector: transfer(0x20, address, {}, {}); break;
+    case erase_size::block_32k: transfer(0x52, address, {}, {}); break;
+    case erase_size::block_64k: transfer(0xd8, address, {}, {}); break;
+    case erase_size::chip: transfer(0x60, std::nullopt, {}, {}); break;
+    }
+    wait_for_write_complete();
+}
+
+bool flash::poll_write_complete()
+{
+    std::byte status{0};
+    transfer(0x05, std::nullopt, {}, std::span(&status, 1));
+    return (status & std::byte{0x01}) == std::byte{0};
+}
+
+flash::ticket flash::submit(std::span<const request> batch)
+{
+    execute(batch);
+    return ++_last_ticket;
+}
+
+bool flash::poll(ticket t)
+{
+    if (t == 0 || t > _last_ticket)
+        throw std::invalid_argument("Unknown batch ticket.");
+    return true;
+}
+
+void flash::wait(ticket t)
+{
+    poll(t);
+}
+
+void flash::execute(std::span<const request> batch)
+{
+    // Program data is gathered into a page at a time, so that adjacent requests share page program commands.
+    std::array<std::byte, page_size> page;
+    std::uint32_t                    page_address = 0;
+    std::size_t                      page_bytes   = 0;
+
+    auto flush = [&] {
+        if (page_bytes != 0)
+            page_program(page_address, std::span(page).first(page_bytes));
+        page_bytes = 0;
+    };
+
+    for (const request& r : batch)
+    {
+        if (r.kind == request::type::erase)
+        {
+            flush();
+            erase(r.size, r.address);
+            continue;
+        }
+
+        std::uint32_t              address = r.address;
+        std::span<const std::byte> data    = r.data;
+        while (!data.empty())
+        {
+            if (page_bytes != 0 && (address != page_address + page_bytes || address % page_size == 0))
+                flush();
+            if (page_bytes == 0)
+                page_address = address;
+            std::size_t count = std::min(data.size(), page_size - address % page_size);
+            std::copy_n(std::begin(data), count, std::begin(page) + page_bytes);
+            page_bytes += count;
+            address += static_cast<std::uint32_t>(count);
+            data = data.subspan(count);
+        }
+    }
+    flush();
+}
+
+flash::request flash::request::program(std::uint32_t address, std::span<const std::byte> data) noexcept
+{
+    return {type::program, address, data, erase_size::sector};
+}
+
+flash::request flash::request::erase(erase_size size, std::uint32_t address) noexcept
+{
+    return {type::erase, address, {}, size};
+}
+
 } // End namespace bedrock.
@@ -5,6 +5,9 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
 #include <vector>
 
 namespace bedrock
@@ -33,7 +36,17 @@ public:
         /// users of the real chip this probably just means waiting a fixed amount of time (given in the datasheet for
         /// the flash chip). For automation this probably means reading the status register of the chip and making sure
         /// the WIP (write in progress) bit is zero before continuing.
-        wait_for_write_complete
+        wait_for_write_complete,
+
+        /// Toggling the IO1 pin, which is the serial-output pin in single IO mode, sets the second bit clocked in per
+        /// cycle in dual and quad IO modes.
+        toggle_io1,
+
+        /// Toggling the IO2 pin sets the third bit clocked in per cycle in quad IO mode.
+        toggle_io2,
+
+        /// Toggling the IO3 pin sets the fourth bit clocked in per cycle in quad IO mode.
+        toggle_io3
     };
 
     /// Represents the state of a pin on the chip.
@@ -48,6 +61,63 @@ public:
         low
     };
 
+    /// How much an erase command erases.
+    enum class erase_size
+    {
+        /// A 4 KiB sector, erased with opcode 0x20.
+        sector,
+
+        /// A 32 KiB block, erased with opcode 0x52.
+        block_32k,
+
+        /// A 64 KiB block, erased with opcode 0xd8.
+        block_64k,
+
+        /// The whole chip, erased with opcode 0x60.
+        chip
+    };
+
+    /// The number of bytes in a page, the most that a single page program command can write.
+    static constexpr std::size_t page_size = 256;
+
+    /// A program or erase, to be submitted as part of a batch.
+    struct request
+    {
+        /// The kinds of request.
+        enum class type
+        {
+            /// Programs data, which may span any number of pages.
+            program,
+
+            /// Erases a sector, block, or the whole chip.
+            erase
+        };
+
+        /// Makes a request that programs data starting at an address.
+        ///
+        /// \param address The address of the first byte to program.
+        /// \param data The bytes to program. They must stay valid until the batch completes.
+        static request program(std::uint32_t address, std::span<const std::byte> data) noexcept;
+
+        /// Makes a request that erases the sector, block, or chip containing an address.
+        static request erase(erase_size size, std::uint32_t address = 0) noexcept;
+
+        /// What the request does.
+        type kind;
+
+        /// The address of the first byte to program, or any address within the sector or block to erase.
+        std::uint32_t address;
+
+        /// The bytes to program, for a program request.
+        std::span<const std::byte> data;
+
+        /// How much to erase, for an erase request.
+        erase_size size;
+    };
+
+    /// Identifies a submitted batch.
+    using ticket = std::uint64_t;
+
     virtual ~flash() = default;
 
     /// Reads the current state of the chip-enable pin.
@@ -59,12 +129,26 @@ public:
     /// Reads the current state of the serial-output pin.
     virtual pin_state get_serial_output() const noexcept = 0;
 
+    /// Reads the current state of one of the four IO pins used in dual and quad IO modes. IO0 is the serial-input pin
+    /// and IO1 is the serial-output pin. While the chip is driving a pin this is the level the chip outputs, otherwise
+    /// it is the level last set by the user.
+    ///
+    /// \param io Which IO pin to read, from 0 to 3. Anything else reads as pin_state::low.
+    virtual pin_state get_io(std::size_t io) const noexcept = 0;
+
     /// Toggles the chip-enable pin, i.e. if it is pin_state::high it will transition to pin_state::low and vice versa.
     virtual void toggle_chip_enable() = 0;
 
     /// Toggles the serial-input pin, i.e. if it is pin_state::high it will transition to pin_state::low and vice versa.
     virtual void toggle_serial_input() = 0;
 
+    /// Toggles the level the user drives on one of the four IO pins. Toggling IO0 is the same as toggling the
+    /// serial-input pin.
+    ///
+    /// \param io Which IO pin to toggle, from 0 to 3.
+    /// \throws std::invalid_argument if there is no such IO pin.
+    virtual void toggle_io(std::size_t io) = 0;
+
     /// Toggles the clock pin by setting it to pin_state::high then back to pin_state::low.
     ///
     /// It's not useful to make users call toggle_clock twice to initiate a clock cycle, so this method sets it to high
@@ -74,6 +158,13 @@ public:
     /// Waits for an in-progress write to complete.
     virtual void wait_for_write_complete() = 0;
 
+    /// Checks whether an in-progress write has completed, without waiting for it, so something else can be done in
+    /// the meantime. Once this returns true the write is complete, just as after wait_for_write_complete.
+    ///
+    /// The default implementation reads the status register once and checks the write in progress bit. The chip must
+    /// be deselected.
+    virtual bool poll_write_complete();
+
     /// Performs one of the possible operations that can be performed on the chip.
     void perform_user_operation(user_operation op);
 
@@ -90,6 +181,104 @@ public:
     /// Uses the serial-output and clock pins to get a number of bits from the flash chip.
     template <std::size_t num_bits, typename data_type>
     data_type clock_out_data();
+
+    /// Uses the IO and clock pins to input a number of bits to the flash chip, num_io bits per clock cycle.
+    ///
+    /// With one IO this is the same as clock_in_data. With two IOs, IO1 and IO0 carry the two most significant bits of
+    /// each cycle. With four IOs, IO3 down to IO0 carry the four most significant bits of each cycle.
+    template <std::size_t num_io, std::size_t num_bits, typename data_type>
+    void clock_in_data_io(data_type data);
+
+    /// Uses the IO and clock pins to get a number of bits from the flash chip, num_io bits per clock cycle.
+    ///
+    /// With one IO this is the same as clock_out_data, and uses the serial-output pin. With two or four IOs the bits of
+    /// each cycle are read from IO pins in the same order as for clock_in_data_io.
+    template <std::size_t num_io, std::size_t num_bits, typename data_type>
+    data_type clock_out_data_io();
+
+    /// Uses the IO and clock pins to input a series of bytes to the flash chip, most significant bit first.
+    ///
+    /// The default implementation clocks in every byte bit by bit. Implementations may override this to move whole
+    /// bytes at once, but the chip must end up in the same state as if the bytes had been clocked in bit by bit.
+    ///
+    /// \param data The bytes to clock in.
+    /// \param num_io The number of IO pins carrying bits every clock cycle, 1, 2, or 4. Overrides must use the same
+    /// default.
+    virtual void clock_in_bytes(std::span<const std::byte> data, std::size_t num_io = 1);
+
+    /// Uses the IO and clock pins to get a series of bytes from the flash chip, most significant bit first.
+    ///
+    /// The default implementation clocks out every byte bit by bit. Implementations may override this to move whole
+    /// bytes at once, but the chip must end up in the same state as if the bytes had been clocked out bit by bit.
+    ///
+    /// \param data Receives the bytes clocked out.
+    /// \param num_io The number of IO pins carrying bits every clock cycle, 1, 2, or 4. Overrides must use the same
+    /// default.
+    virtual void clock_out_bytes(std::span<std::byte> data, std::size_t num_io = 1);
+
+    /// Performs a complete command: selects the chip, clocks in the opcode, the address if there is one, and tx, then
+    /// clocks out rx, and finally deselects the chip. Everything goes over the serial-input and serial-output pins.
+    ///
+    /// The default implementation goes through clock_in_bytes and clock_out_bytes, so the chip ends up the same as if
+    /// the command had been performed pin by pin.
+    ///
+    /// \param opcode The opcode of the command.
+    /// \param address The 24-bit address clocked in after the opcode, if the command takes one.
+    /// \param tx Bytes clocked in after the address, such as page program data or the dummy byte of a fast read.
+    /// \param rx Receives the bytes clocked out at the end of the command.
+    virtual void transfer(std::uint8_t                 opcode,
+                          std::optional<std::uint32_t> address,
+                          std::span<const std::byte>   tx,
+                          std::span<std::byte>         rx);
+
+    /// Sets the write enable latch, so the next program or erase command is accepted.
+    void write_enable();
+
+    /// Programs bytes within a single page, then waits for the program to complete. The write enable latch is set
+    /// first.
+    ///
+    /// \param address The address of the first byte to program.
+    /// \param data The bytes to program, at most a page.
+    void page_program(std::uint32_t address, std::span<const std::byte> data);
+
+    /// Reads bytes starting at an address with the read command.
+    ///
+    /// \param address The address of the first byte to read.
+    /// \param out Receives the bytes read.
+    void read(std::uint32_t address, std::span<std::byte> out);
+
+    /// Erases the sector, block, or chip containing an address, then waits for the erase to complete. The write
+    /// enable latch is set first.
+    ///
+    /// \param size How much to erase.
+    /// \param address Any address within the sector or block to erase. Ignored for a chip erase.
+    void erase(erase_size size, std::uint32_t address = 0);
+
+    /// Submits a batch of requests, which are carried out in order. Program requests are split at page boundaries,
+    /// and adjacent program requests that fall within the same page are combined into a single page program.
+    ///
+    /// The default implementation carries out the whole batch before returning, so any error is thrown from here.
+    /// Implementations that carry out batches in the background throw errors from wait instead.
+    ///
+    /// \param batch The requests. The request objects themselves may be discarded as soon as this returns.
+    /// \returns The ticket with which to poll for or wait on the completion of the batch.
+    virtual ticket submit(std::span<const request> batch);
+
+    /// Whether or not a submitted batch has completed.
+    virtual bool poll(ticket t);
+
+    /// Waits for a submitted batch to complete.
+    ///
+    /// \throws std::invalid_argument if the ticket wasn't returned by submit.
+    virtual void wait(ticket t);
+
+protected:
+    /// Carries out a batch of requests immediately, as described for submit.
+    void execute(std::span<const request> batch);
+
+private:
+    /// The ticket of the most recently submitted batch.
+    ticket _last_ticket = 0;
 };
 
 } // End namespace bedrock.
@@ -11,9 +11,9 @@ void flash::clock_in_data(data_type data)
     static_assert(sizeof(data_type) * 8 >= num_bits);
     for (int bit = num_bits; bit != 0; --bit)
     {
-        bool             bit_set       = data & (1 << (bit - 1));
+        bool             bit_set       = (data >> (bit - 1)) & 1;
         flash::pin_state current_state = get_serial_input();
-        if ((bit_set && current_state == flash::pin_state::low) || !bit_set && current_state == flash::pin_state::high)
+        if (bit_set != (current_state == flash::pin_state::high))
             toggle_serial_input();
         toggle_clock();
     }
@@ -27,10 +27,53 @@ data_type flash::clock_out_data()
     for (int bit = num_bits; bit != 0; --bit)
     {
         if (get_serial_output() == pin_state::high)
-            value |= 1 << (bit - 1);
+            value |= data_type{1} << (bit - 1);
         toggle_clock();
     }
     return value;
 }
 
+template <std::size_t num_io, std::size_t num_bits, typename data_type>
+void flash::clock_in_data_io(data_type data)
+{
+    static_assert(num_io == 1 || num_io == 2 || num_io == 4);
+    static_assert(sizeof(data_type) * 8 >= num_bits && num_bits % num_io == 0);
+    if constexpr (num_io == 1)
+        clock_in_data<num_bits>(data);
+    else
+    {
+        for (int bit = num_bits; bit != 0; bit -= num_io)
+        {
+            for (int io = num_io - 1; io >= 0; --io)
+            {
+                bool bit_set = (data >> (bit - num_io + io)) & 1;
+                if (bit_set != (get_io(io) == flash::pin_state::high))
+                    toggle_io(io);
+            }
+            toggle_clock();
+        }
+    }
+}
+
+template <std::size_t num_io, std::size_t num_bits, typename data_type>
+data_type flash::clock_out_data_io()
+{
+    static_assert(num_io == 1 || num_io == 2 || num_io == 4);
+    static_assert(sizeof(data_type) * 8 >= num_bits && num_bits % num_io == 0);
+    if constexpr (num_io == 1)
+        return clock_out_data<num_bits, data_type>();
+    else
+    {
+        data_type value{0};
+        for (int bit = num_bits; bit != 0; bit -= num_io)
+        {
+            for (int io = num_io - 1; io >= 0; --io)
+                if (get_io(io) == pin_state::high)
+                    value |= data_type{1} << (bit - num_io + io);
+            toggle_clock();
+        }
+        return value;
+    }
+}
+
 } // End namespace bedrock.
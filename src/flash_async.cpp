@@ -0,0 +1,266 @@
+#include "flash_async.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+namespace bedrock
+{
+
+namespace
+{
+
+/// How long run first sleeps when every parked chip is still busy.
+constexpr std::chrono::microseconds min_backoff{10};
+
+/// The longest run sleeps between rounds of polls, however long the chips stay busy.
+constexpr std::chrono::microseconds max_backoff{1000};
+
+} // End anonymous namespace.
+
+/**********************************************************************************************************************\
+* flash_task::promise_type                                                                                             *
+\**********************************************************************************************************************/
+
+std::coroutine_handle<> flash_task::promise_type::final_awaiter::await_suspend(
+    std::coroutine_handle<promise_type> h) noexcept
+{
+    // A task spawned directly on the scheduler has nobody to resume, so control goes back to the scheduler.
+    if (std::coroutine_handle<> continuation = h.promise()._continuation)
+        return continuation;
+    return std::noop_coroutine();
+}
+
+flash_task flash_task::promise_type::get_return_object() noexcept
+{
+    return flash_task(std::coroutine_handle<promise_type>::from_promise(*this));
+}
+
+void flash_task::promise_type::unhandled_exception() noexcept
+{
+    _error = std::current_exception();
+}
+
+/**********************************************************************************************************************\
+* flash_task::awaiter                                                                                                  *
+\**********************************************************************************************************************/
+
+flash_task::awaiter::awaiter(std::coroutine_handle<promise_type> handle) noexcept
+        : _handle(handle)
+{
+}
+
+bool flash_task::awaiter::await_ready() const noexcept
+{
+    return false;
+}
+
+std::coroutine_handle<> flash_task::awaiter::await_suspend(std::coroutine_handle<promise_type> h) noexcept
+{
+    // The awaited task runs on the same scheduler, and takes over straight away without going through it.
+    _handle.promise()._scheduler    = h.promise()._scheduler;
+    _handle.promise()._continuation = h;
+    return _handle;
+}
+
+void flash_task::awaiter::await_resume() const
+{
+    if (_handle.promise()._error)
+        std::rethrow_exception(_handle.promise()._error);
+}
+
+/**********************************************************************************************************************\
+* flash_task                                                                                                           *
+\**********************************************************************************************************************/
+
+flash_task::flash_task(std::coroutine_handle<promise_type> handle) noexcept
+        : _handle(handle)
+{
+}
+
+flash_task::flash_task(flash_task&& other) noexcept
+        : _handle(std::exchange(other._handle, nullptr))
+{
+}
+
+flash_task& flash_task::operator=(flash_task&& other) noexcept
+{
+    if (this != &other)
+    {
+        if (_handle)
+            _handle.destroy();
+        _handle = std::exchange(other._handle, nullptr);
+    }
+    return *this;
+}
+
+flash_task::~flash_task()
+{
+    if (_handle)
+        _handle.destroy();
+}
+
+bool flash_task::done() const noexcept
+{
+    return _handle && _handle.done();
+}
+
+flash_task::awaiter flash_task::operator co_await() && noexcept
+{
+    return awaiter(_handle);
+}
+
+/**********************************************************************************************************************\
+* flash_scheduler::wait_awaiter                                                                                        *
+\**********************************************************************************************************************/
+
+flash_scheduler::wait_awaiter::wait_awaiter(flash& f, std::optional<flash::ticket> t) noexcept
+        : _flash(&f)
+        , _ticket(t)
+        , _error()
+{
+}
+
+bool flash_scheduler::wait_awaiter::await_ready()
+{
+    return poll();
+}
+
+void flash_scheduler::wait_awaiter::await_suspend(std::coroutine_handle<flash_task::promise_type> h)
+{
+    h.promise()._scheduler->_parked.push_back({h, this});
+}
+
+void flash_scheduler::wait_awaiter::await_resume() const
+{
+    if (_error)
+        std::rethrow_exception(_error);
+}
+
+bool flash_scheduler::wait_awaiter::poll()
+{
+    return _ticket ? _flash->poll(*_ticket) : _flash->poll_write_complete();
+}
+
+/**********************************************************************************************************************\
+* flash_scheduler                                                                                                      *
+\**********************************************************************************************************************/
+
+void flash_scheduler::spawn(flash_task task)
+{
+    if (!task._handle || task._handle.promise()._scheduler)
+        throw std::invalid_argument("Can only spawn a task that hasn't been started.");
+    task._handle.promise()._scheduler = this;
+    _ready.push_back(task._handle);
+    _tasks.push_back(std::move(task));
+}
+
+void flash_scheduler::run()
+{
+    std::chrono::microseconds backoff{0};
+    for (;;)
+    {
+        while (!_ready.empty())
+        {
+            std::coroutine_handle<> h = _ready.front();
+            _ready.pop_front();
+            h.resume();
+        }
+        if (_parked.empty())
+            break;
+
+        // Every parked task's chip is polled once per round, in the order the tasks were parked. A failed poll resumes
+        // the task, which rethrows the error.
+        std::size_t num_busy = 0;
+        for (parked& p : _parked)
+        {
+            bool done = true;
+            try
+            {
+                done = p.wait->poll();
+            }
+            catch (...)
+            {
+                p.wait->_error = std::current_exception();
+            }
+            if (done)
+                _ready.push_back(p.handle);
+            else
+                _parked[num_busy++] = p;
+        }
+        // Rounds that find every chip still busy sleep for twice as long each time, up to a limit, rather than spin.
+        _num_busy_polls += num_busy;
+        if (num_busy == _parked.size())
+        {
+            backoff = std::clamp(backoff * 2, min_backoff, max_backoff);
+            std::this_thread::sleep_for(backoff);
+        }
+        else
+            backoff = std::chrono::microseconds{0};
+        _parked.resize(num_busy);
+    }
+
+    std::exception_ptr error;
+    for (const flash_task& task : _tasks)
+    {
+        if (!error && task._handle.promise()._error)
+            error = task._handle.promise()._error;
+    }
+    _tasks.clear();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+std::uint64_t flash_scheduler::num_busy_polls() const noexcept
+{
+    return _num_busy_polls;
+}
+
+flash_scheduler::wait_awaiter flash_scheduler::wait_for_write_complete(flash& f) noexcept
+{
+    return wait_awaiter(f, std::nullopt);
+}
+
+flash_scheduler::wait_awaiter flash_scheduler::wait(flash& f, flash::ticket t) noexcept
+{
+    return wait_awaiter(f, t);
+}
+
+/**********************************************************************************************************************\
+* Transactions                                                                                                         *
+\**********************************************************************************************************************/
+
+flash_task async_page_program(flash& f, std::uint32_t address, std::span<const std::byte> data)
+{
+    f.write_enable();
+    f.transfer(0x02, address, data, {});
+    co_await flash_scheduler::wait_for_write_complete(f);
+}
+
+flash_task async_erase(flash& f, flash::erase_size size, std::uint32_t address)
+{
+    f.write_enable();
+    switch (size)
+    {
+    case flash::erase_size::sector: f.transfer(0x20, address, {}, {}); break;
+    case flash::erase_size::block_32k: f.transfer(0x52, address, {}, {}); break;
+    case flash::erase_size::block_64k: f.transfer(0xd8, address, {}, {}); break;
+    case flash::erase_size::chip: f.transfer(0x60, std::nullopt, {}, {}); break;
+    }
+    co_await flash_scheduler::wait_for_write_complete(f);
+}
+
+flash_task async_program(flash& f, std::uint32_t address, std::span<const std::byte> data)
+{
+    while (!data.empty())
+    {
+        std::size_t count = std::min(data.size(), flash::page_size - address % flash::page_size);
+        co_await async_page_program(f, address, data.first(count));
+        address += static_cast<std::uint32_t>(count);
+        data = data.subspan(count);
+    }
+}
+
+} // End namespace bedrock.
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "flash.hpp"
+
+namespace bedrock
+{
+
+class flash_scheduler;
+
+/// A coroutine that drives one or more flash chips, suspending while a chip is busy rather than blocking the thread.
+///
+/// A task doesn't start running until it is either spawned on a flash_scheduler or awaited by another task. A task can
+/// only be awaited once, and an error thrown inside it is rethrown to whoever awaits it.
+class flash_task
+{
+public:
+    /// The state shared between a task and the coroutine frame it owns.
+    class promise_type
+    {
+    public:
+        /// Resumes whoever awaited the task once it finishes.
+        struct final_awaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+
+            void await_resume() const noexcept {}
+        };
+
+        flash_task get_return_object() noexcept;
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+
+        final_awaiter final_suspend() const noexcept { return {}; }
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() noexcept;
+
+    private:
+        friend class flash_task;
+        friend class flash_scheduler;
+
+        /// The scheduler running the task, which parks it while it waits on a chip.
+        flash_scheduler* _scheduler = nullptr;
+
+        /// The task that awaited this one, or nullptr for a task spawned directly on a scheduler.
+        std::coroutine_handle<> _continuation;
+
+        /// The error the task finished with, if any.
+        std::exception_ptr _error;
+    };
+
+    /// Starts the task from another task, resuming the awaiting task with the outcome once it finishes.
+    class awaiter
+    {
+    public:
+        bool await_ready() const noexcept;
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept;
+
+        /// \throws Whatever the task threw.
+        void await_resume() const;
+
+    private:
+        friend class flash_task;
+
+        explicit awaiter(std::coroutine_handle<promise_type> handle) noexcept;
+
+        /// The task being awaited.
+        std::coroutine_handle<promise_type> _handle;
+    };
+
+    flash_task(flash_task&& other) noexcept;
+
+    flash_task& operator=(flash_task&& other) noexcept;
+
+    flash_task(const flash_task&) = delete;
+
+    flash_task& operator=(const flash_task&) = delete;
+
+    /// Destroys the coroutine frame, whether or not the task ever finished.
+    ~flash_task();
+
+    /// Whether or not the task has finished.
+    bool done() const noexcept;
+
+    /// Awaits the task from another task.
+    awaiter operator co_await() && noexcept;
+
+private:
+    friend class flash_scheduler;
+
+    explicit flash_task(std::coroutine_handle<promise_type> handle) noexcept;
+
+    /// The coroutine frame of the task, or empty once moved from.
+    std::coroutine_handle<promise_type> _handle;
+};
+
+/// Runs flash tasks on a single thread, switching to another task whenever one has to wait for a chip.
+///
+/// Tasks waiting for a chip are parked, and the scheduler polls each of their chips once every time it runs out of
+/// tasks that are ready to run. When every chip is still busy it sleeps before the next round, twice as long each time
+/// up to a millisecond. A single thread can in this way keep dozens of chips busy programming and erasing at the same
+/// time. Polling a chip must not touch any other chip, so each chip must only be driven by one task at a time.
+class flash_scheduler
+{
+public:
+    /// Waits for one of a chip's in-progress writes or batches to complete, suspending the task in the meantime.
+    class wait_awaiter
+    {
+    public:
+        /// Polls the chip once, so a task never suspends when there is nothing to wait for.
+        bool await_ready();
+
+        void await_suspend(std::coroutine_handle<flash_task::promise_type> h);
+
+        /// \throws Whatever polling the chip threw.
+        void await_resume() const;
+
+    private:
+        friend class flash_scheduler;
+
+        wait_awaiter(flash& f, std::optional<flash::ticket> t) noexcept;
+
+        /// Polls the chip once.
+        bool poll();
+
+        /// The chip being waited on.
+        flash* _flash;
+
+        /// The batch being waited on, or empty to wait for a write.
+        std::optional<flash::ticket> _ticket;
+
+        /// The error thrown while polling the chip on behalf of the suspended task.
+        std::exception_ptr _error;
+    };
+
+    flash_scheduler() = default;
+
+    flash_scheduler(const flash_scheduler&) = delete;
+
+    flash_scheduler& operator=(const flash_scheduler&) = delete;
+
+    /// Queues a task to run once run is called.
+    ///
+    /// \throws std::invalid_argument if the task was moved from, or has already been started.
+    void spawn(flash_task task);
+
+    /// Runs every task spawned so far, and any they spawn, until all of them have finished.
+    ///
+    /// \throws Whatever the first task to fail since the last run threw. Every other task still runs to completion.
+    void run();
+
+    /// The number of times run polled a chip and found it still busy.
+    std::uint64_t num_busy_polls() const noexcept;
+
+    /// Waits for an in-progress write to complete, like flash::wait_for_write_complete.
+    static wait_awaiter wait_for_write_complete(flash& f) noexcept;
+
+    /// Waits for a submitted batch to complete, like flash::wait.
+    static wait_awaiter wait(flash& f, flash::ticket t) noexcept;
+
+private:
+    /// A task suspended until a chip is done.
+    struct parked
+    {
+        /// The innermost task waiting, which resumes the tasks that awaited it as it finishes.
+        std::coroutine_handle<flash_task::promise_type> handle;
+
+        /// What the task is waiting for, which lives in the suspended task.
+        wait_awaiter* wait;
+    };
+
+    /// The tasks spawned on the scheduler, so they are destroyed along with it.
+    std::vector<flash_task> _tasks;
+
+    /// The tasks ready to be resumed, in order.
+    std::deque<std::coroutine_handle<>> _ready;
+
+    /// The tasks waiting on a chip.
+    std::vector<parked> _parked;
+
+    /// See num_busy_polls.
+    std::uint64_t _num_busy_polls = 0;
+};
+
+/// Programs bytes within a single page, like flash::page_program, but suspends the task rather than blocking while the
+/// program completes.
+///
+/// \param f The chip, which must outlive the task.
+/// \param address The address of the first byte to program.
+/// \param data The bytes to program, at most a page. They must stay valid until the task finishes.
+flash_task async_page_program(flash& f, std::uint32_t address, std::span<const std::byte> data);
+
+/// Erases a sector, block, or the whole chip, like flash::erase, but suspends the task rather than blocking while the
+/// erase completes.
+///
+/// \param f The chip, which must outlive the task.
+/// \param size How much to erase.
+/// \param address Any address within the sector or block to erase. Ignored for a chip erase.
+flash_task async_erase(flash& f, flash::erase_size size, std::uint32_t address = 0);
+
+/// Programs data spanning any number of pages, one page program at a time, suspending the task while each completes.
+///
+/// \param f The chip, which must outlive the task.
+/// \param address The address of the first byte to program.
+/// \param data The bytes to program. They must stay valid until the task finishes.
+flash_task async_program(flash& f, std::uint32_t address, std::span<const std::byte> data);
+
+} // End namespace bedrock.
@@ -0,0 +1,126 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "flash_async.hpp"
+#include "flash_sim.hpp"
+
+namespace bedrock::test
+{
+
+namespace
+{
+
+/// A simulated chip that stays busy for a few polls after every program or erase, like a real chip does, rather than
+/// skipping straight to the end of the write.
+class slow_flash : public flash_sim
+{
+public:
+    slow_flash()
+            : flash_sim(0x10000)
+    {
+        timing t;
+        t.page_program = std::chrono::microseconds(800);
+        t.sector_erase = std::chrono::milliseconds(45);
+        t.chip_erase   = std::chrono::seconds(45);
+        set_timing(t);
+    }
+
+    virtual bool poll_write_complete() override
+    {
+        if (write_in_progress() && ++_polls % 4 != 0)
+            return false;
+        return flash_sim::poll_write_complete();
+    }
+
+private:
+    std::size_t _polls = 0;
+};
+
+/// Erases a chip, then programs data a page at a time, noting down the chip every time a page is done.
+flash_task program_pages(flash& f, int chip, std::span<const std::byte> data, std::vector<int>& done)
+{
+    co_await async_erase(f, flash::erase_size::chip);
+    for (std::size_t offset = 0; offset < data.size(); offset += flash::page_size)
+    {
+        std::size_t count = std::min(flash::page_size, data.size() - offset);
+        co_await async_page_program(f, static_cast<std::uint32_t>(offset), data.subspan(offset, count));
+        done.push_back(chip);
+    }
+}
+
+/// Fails partway through.
+flash_task fail(flash& f)
+{
+    co_await async_erase(f, flash::erase_size::sector);
+    throw std::runtime_error("Failed.");
+}
+
+} // End anonymous namespace.
+
+TEST_CASE("flash_scheduler", "[flash_async]")
+{
+    // While one chip is busy the other gets to run, so the pages of the two chips are programmed in turn.
+    std::vector<std::byte> data(3 * flash::page_size);
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = std::byte(i * 7);
+    slow_flash       a;
+    slow_flash       b;
+    std::vector<int> done;
+    flash_scheduler  scheduler;
+    scheduler.spawn(program_pages(a, 0, data, done));
+    scheduler.spawn(program_pages(b, 1, data, done));
+    scheduler.run();
+    REQUIRE(done == std::vector<int>{0, 1, 0, 1, 0, 1});
+    REQUIRE(scheduler.num_busy_polls() > 0);
+    REQUIRE(std::vector(std::begin(a.get_data()), std::begin(a.get_data()) + data.size()) == data);
+    REQUIRE(std::vector(std::begin(b.get_data()), std::begin(b.get_data()) + data.size()) == data);
+
+    // Completing a write through the scheduler records the same operations as waiting for it.
+    flash_sim blocking(0x10000);
+    blocking.erase(flash::erase_size::chip);
+    for (std::size_t offset = 0; offset < data.size(); offset += flash::page_size)
+    {
+        std::size_t count = std::min(flash::page_size, data.size() - offset);
+        blocking.page_program(static_cast<std::uint32_t>(offset), std::span(data).subspan(offset, count));
+    }
+    REQUIRE(std::vector(std::begin(a.get_user_operations()), std::end(a.get_user_operations()))
+            == std::vector(std::begin(blocking.get_user_operations()), std::end(blocking.get_user_operations())));
+
+    // A chip that is never busy never suspends a task.
+    flash_sim       fast(0x10000);
+    flash_scheduler never_busy;
+    never_busy.spawn(async_erase(fast, flash::erase_size::chip));
+    never_busy.spawn(async_program(fast, 0x80, data));
+    never_busy.run();
+    REQUIRE(never_busy.num_busy_polls() == 0);
+    REQUIRE(std::vector(std::begin(fast.get_data()) + 0x80, std::begin(fast.get_data()) + 0x80 + data.size()) == data);
+}
+
+TEST_CASE("flash_scheduler errors", "[flash_async]")
+{
+    // A failed task doesn't stop the others, and its error is thrown once they are done.
+    slow_flash       a;
+    slow_flash       b;
+    std::vector<int> done;
+    flash_scheduler  scheduler;
+    std::byte        value{0x5a};
+    scheduler.spawn(fail(a));
+    scheduler.spawn(program_pages(b, 1, std::span(&value, 1), done));
+    REQUIRE_THROWS_AS(scheduler.run(), std::runtime_error);
+    REQUIRE(done == std::vector<int>{1});
+    scheduler.run();
+
+    flash_task task = async_erase(a, flash::erase_size::chip);
+    flash_task moved(std::move(task));
+    REQUIRE_THROWS_AS(scheduler.spawn(std::move(task)), std::invalid_argument);
+    scheduler.spawn(std::move(moved));
+    scheduler.run();
+}
+
+} // End namespace bedrock::test.
@@ -1,21 +1,61 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstddef>
-#include <functional>
-#include <map>
+#include <cstdint>
+#include <istream>
 #include <memory>
+#include <memory_resource>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <unordered_map>
+#include <variant>
 #include <vector>
 
 #include "flash.hpp"
+#include "flash_sim_traits.hpp"
+#include "flash_store.hpp"
+#include "user_operation_log.hpp"
 
 namespace bedrock
 {
 
-/// Simulates the functionality of an SPI flash memory chip, specifically the IS25LP128 found on the SiFive HiFive-1
-/// development board.
-class flash_sim : public flash
+/// The binary format of the deltas written by basic_flash_sim::export_delta.
+///
+/// A delta is a short header, then the size of the chip and the number of runs of pages it holds, then every run as
+/// its address and its size followed by its bytes. Every number is a 64-bit little-endian integer.
+struct flash_delta_format
 {
+    /// The bytes every delta starts with.
+    static constexpr char magic[4] = {'B', 'F', 'D', 'L'};
+
+    /// The version of the delta format written by export_delta.
+    static constexpr std::uint8_t version = 1;
+};
+
+/// Simulates the functionality of an SPI flash memory chip. The geometry and command set of the chip come from a traits
+/// type such as is25lp128_traits, so they are all compile-time constants. flash_sim simulates the IS25LP128 found on
+/// the SiFive HiFive-1 development board, and is what most users want.
+///
+/// A chip is not thread-safe, but separate chips share no mutable state, so different threads can each use their own
+/// chip at the same time. flash_sim_pool runs many chips that way.
+///
+/// \tparam traits The geometry and command set of the chip, with the same members as is25lp128_traits.
+template <typename traits>
+class basic_flash_sim : public flash
+{
+    static_assert(traits::page_size != 0);
+    static_assert(traits::address_bits % 8 == 0 && traits::address_bits != 0 && traits::address_bits <= 32);
+
 public:
+    /// The geometry and command set of the chip.
+    using traits_type = traits;
+
+    /// The number of bytes in a page of the chip, the most a single page program can write.
+    static constexpr std::size_t page_size = traits::page_size;
+
     /// Simple state machine that the chip follows for every command.
     enum class chip_state
     {
@@ -29,15 +69,182 @@ public:
         operation
     };
 
+    /// Which user operations the chip keeps a record of.
+    enum class recording
+    {
+        /// No user operations are recorded, get_user_operations always returns an empty log.
+        off,
+
+        /// Every user operation is recorded.
+        full
+    };
+
+    /// How long things take on the simulated chip. Time on the chip is virtual: it only moves forward as the clock is
+    /// toggled and when waiting for a write to complete. With the default of all zeros, nothing takes any time and
+    /// writes complete immediately.
+    struct timing
+    {
+        /// The period of the serial clock, the time taken by every clock toggle.
+        std::chrono::nanoseconds clock_period{0};
+
+        /// How long a page program takes to complete, tPP in the datasheet.
+        std::chrono::nanoseconds page_program{0};
+
+        /// How long a 4 KiB sector erase takes to complete, tSE in the datasheet.
+        std::chrono::nanoseconds sector_erase{0};
+
+        /// How long a 32 KiB block erase takes to complete, tBE in the datasheet.
+        std::chrono::nanoseconds block_erase_32k{0};
+
+        /// How long a 64 KiB block erase takes to complete, tBE in the datasheet.
+        std::chrono::nanoseconds block_erase_64k{0};
+
+        /// How long a chip erase takes to complete, tCE in the datasheet.
+        std::chrono::nanoseconds chip_erase{0};
+    };
+
+    /// The write in progress (WIP) bit of the status register, set while a program or erase is completing.
+    static constexpr std::uint8_t status_write_in_progress = 0x01;
+
+    /// The write enable latch (WEL) bit of the status register, set by the write enable command.
+    static constexpr std::uint8_t status_write_enable_latch = 0x02;
+
+    /// Counters of where simulation time goes, collected only when the library is built with the STATS option, which
+    /// the generated flash_config.hpp records as BEDROCK_FLASH_STATS. Otherwise none of the counting is compiled in and
+    /// every counter stays zero.
+    struct stats
+    {
+        /// Counts of durations, where bucket i counts durations of at least 2^i but less than 2^(i+1) nanoseconds.
+        /// Bucket 0 also counts durations under a nanosecond, and the last bucket also counts anything longer.
+        using histogram = std::array<std::uint64_t, 40>;
+
+        /// The counters for a single opcode.
+        struct command
+        {
+            /// The number of times the opcode was dispatched.
+            std::uint64_t count = 0;
+
+            /// The number of clock toggles across every command with the opcode, from selecting the chip to
+            /// deselecting it, including the opcode itself.
+            std::uint64_t clocks = 0;
+
+            /// The wall time taken by every complete command with the opcode, from selecting the chip to deselecting
+            /// it.
+            histogram wall_time{};
+        };
+
+        /// The counters of every opcode, indexed by opcode.
+        std::array<command, 256> commands{};
+
+        /// The number of bytes written by page programs.
+        std::uint64_t bytes_programmed = 0;
+
+        /// The number of bytes erased by sector, block, and chip erases.
+        std::uint64_t bytes_erased = 0;
+
+        /// The number of bytes of storage used by the log of user operations.
+        std::size_t log_bytes = 0;
+
+        /// Writes the counters as a JSON object. Opcodes that were never dispatched are left out, as are the trailing
+        /// empty buckets of every histogram.
+        void write_json(std::ostream& out) const;
+    };
+
+    /// How the read cache has been used since it was last resized.
+    struct read_cache_stats
+    {
+        /// The number of reads answered from the cache.
+        std::uint64_t hits = 0;
+
+        /// The number of reads that could have been cached but were performed.
+        std::uint64_t misses = 0;
+
+        /// The number of reads in the cache.
+        std::size_t size = 0;
+    };
+
+    /// A run of consecutive pages, as found by diff.
+    struct page_range
+    {
+        /// The address of the first byte of the first page.
+        std::size_t address = 0;
+
+        /// The number of bytes in the run. The last page of a chip whose size isn't a multiple of the page size is
+        /// partial.
+        std::size_t num_bytes = 0;
+
+        bool operator==(const page_range&) const = default;
+    };
+
+    /// The state of a chip between commands, as taken by take_snapshot: its data, the write enable latch, its pins,
+    /// its virtual time, and how far its log of user operations had got.
+    class snapshot
+    {
+    private:
+        friend basic_flash_sim;
+
+        /// The data of the chip.
+        flash_store::snapshot _data;
+
+        /// Whether or not the write enable latch was set.
+        bool _write_enabled = false;
+
+        /// The levels the user was driving on the IO pins.
+        std::array<pin_state, 4> _io_input{};
+
+        /// The levels the chip last output on the IO pins.
+        std::array<pin_state, 4> _io_output{};
+
+        /// The virtual time that had passed on the chip.
+        std::chrono::nanoseconds _elapsed{0};
+
+        /// The virtual time at which the write that was in progress completes.
+        std::chrono::nanoseconds _write_complete{0};
+
+        /// The most recently performed user operation.
+        user_operation _last_operation = user_operation::wait_for_write_complete;
+
+        /// The end of the log of user operations.
+        user_operation_log::cursor _log;
+
+        /// The pages that were dirty.
+        std::vector<std::uint64_t> _dirty;
+
+        /// The mark the dirty pages were relative to.
+        std::uint64_t _mark = 0;
+    };
+
     /// Makes a new flash chip simulation.
     ///
     /// Every byte starts with the value 0x00. The chip-enable pin starts as high, meaning the chip is deselected. The
-    /// serial-input pin starts as low.
+    /// IO pins, including the serial-input pin, start as low.
     ///
     /// \param num_bytes The number of bytes the flash chip contains.
-    flash_sim(std::size_t num_bytes = 0xffffffUL);
+    /// \param mode Which user operations are recorded. Turning recording off is useful when only the resulting data is
+    /// of interest.
+    /// \param resource Where the log of user operations is allocated from, such as an arena for the whole session. It
+    /// must outlive the chip and any chip forked from it.
+    basic_flash_sim(std::size_t                num_bytes = traits::default_size,
+                    recording                  mode      = recording::full,
+                    std::pmr::memory_resource* resource  = std::pmr::get_default_resource());
+
+    /// Makes a new flash chip simulation whose data is held in the given store, such as one backed by a memory-mapped
+    /// image file. The pins start out the same as for any other new chip.
+    ///
+    /// \param data The data of the flash chip.
+    /// \param mode Which user operations are recorded.
+    /// \param resource Where the log of user operations is allocated from.
+    basic_flash_sim(flash_store                data,
+                    recording                  mode     = recording::full,
+                    std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+    /// The chip's operations refer back to the chip, so it can be neither copied nor moved.
+    basic_flash_sim(const basic_flash_sim&) = delete;
 
-    virtual ~flash_sim() = default;
+    /// The chip's operations refer back to the chip, so it can be neither copied nor moved.
+    basic_flash_sim& operator=(const basic_flash_sim&) = delete;
+
+    virtual ~basic_flash_sim() = default;
 
     /// Gets the current state of the chip as a whole.
     chip_state get_chip_state() const noexcept;
@@ -51,28 +258,195 @@ public:
     /// Reads the current state of the serial-output pin.
     virtual pin_state get_serial_output() const noexcept override;
 
-    /// Accesses the raw data of this flash chip.
-    const std::vector<std::byte>& get_data() const noexcept;
+    /// Reads the current state of one of the four IO pins. While a read operation is outputting data on a pin this is
+    /// the level the chip outputs, otherwise it is the level last set by the user.
+    virtual pin_state get_io(std::size_t io) const noexcept override;
 
     /// Accesses the raw data of this flash chip.
-    const std::vector<user_operation>& get_user_operations() const noexcept;
+    ///
+    /// The data is stored sparsely, so this flattens it into a contiguous copy whenever it has changed since the last
+    /// call. The returned reference stays valid, but only reflects the data as of the most recent call.
+    const std::vector<std::byte>& get_data() const;
+
+    /// Accesses the sparse storage backing the data of this flash chip, without flattening it.
+    const flash_store& get_store() const noexcept;
+
+    /// Whether or not every byte of a range is erased, i.e. 0xff. Erased sectors are checked in constant time, and
+    /// written sectors a word at a time.
+    ///
+    /// \throws std::out_of_range if the range extends beyond the end of the chip.
+    bool is_erased(std::size_t address, std::size_t num_bytes) const;
+
+    /// Finds the first byte of a range that isn't erased, in the same way as is_erased.
+    ///
+    /// \returns The address of the byte, or std::nullopt if the whole range is erased.
+    /// \throws std::out_of_range if the range extends beyond the end of the chip.
+    std::optional<std::size_t> first_non_erased(std::size_t address, std::size_t num_bytes) const;
+
+    /// Compares the data of the chip against an image of the whole chip, without flattening the data. Erased and
+    /// never-written sectors are compared against their fill value, and written sectors a word at a time.
+    ///
+    /// \returns Every run of consecutive pages that differ from the image, in address order.
+    /// \throws std::invalid_argument if the image is not the same size as the chip.
+    std::vector<page_range> diff(std::span<const std::byte> image) const;
+
+    /// Makes sure a memory-mapped image file backing the chip with a shared mapping reflects the chip's data. This also
+    /// happens automatically when the chip is destroyed.
+    ///
+    /// \throws std::system_error if the image file couldn't be flushed.
+    void sync();
+
+    /// Gets which user operations the chip keeps a record of.
+    recording get_recording() const noexcept;
+
+    /// Gets how long things take on the simulated chip.
+    const timing& get_timing() const noexcept;
+
+    /// Sets how long things take on the simulated chip from now on. A write that is already in progress still
+    /// completes when it would have before.
+    void set_timing(const timing& t) noexcept;
+
+    /// The virtual time that has passed on the chip since it was made.
+    std::chrono::nanoseconds elapsed() const noexcept;
+
+    /// Whether or not a program or erase is still completing, as reported by the WIP bit of the status register. While
+    /// a write is in progress the only command the chip accepts is read status register.
+    bool write_in_progress() const noexcept;
+
+    /// Gets the current contents of the status register.
+    std::uint8_t get_status() const noexcept;
+
+    /// Accesses the series of operations that a user would need to perform to get the data of the chip into the current
+    /// state.
+    const user_operation_log& get_user_operations() const noexcept;
+
+    /// Whether or not the library was built with the counters of get_stats enabled.
+    static bool stats_enabled() noexcept;
+
+    /// Gets the counters collected since the chip was made or reset_stats was last called. Every counter is zero if
+    /// stats_enabled is false.
+    stats get_stats() const;
+
+    /// Sets every counter back to zero.
+    void reset_stats() noexcept;
+
+    /// Sets how many reads the read cache holds, turning it off with zero, which is the default. Resizing the cache
+    /// empties it and resets its stats.
+    ///
+    /// With the cache on, reads and fast reads performed with transfer are remembered, and a later read with the same
+    /// opcode, address, length, and dummy bytes, starting with the pins at the same levels, is answered without
+    /// clocking anything. The data, the pins, the virtual time, and the recorded user operations all end up as if the
+    /// read had been performed, but get_stats doesn't count it. Programs and erases drop the reads of the pages they
+    /// touch, and after restore every read is checked against the data once before it is used again. Once the cache is
+    /// full it is emptied, rather than keeping track of which reads are used least.
+    void set_read_cache_capacity(std::size_t num_reads);
+
+    /// Gets how the read cache has been used.
+    read_cache_stats get_read_cache_stats() const noexcept;
+
+    /// Forgets which pages are dirty, so that dirty_pages and export_delta only cover what changes from now on. A new
+    /// chip starts out with no dirty pages, as if it had just been marked clean.
+    void mark_clean() noexcept;
+
+    /// Gets every run of consecutive pages that has been programmed or erased since the chip was made or mark_clean
+    /// was last called, in address order. Pages written by apply_delta count too. Restoring a snapshot taken since the
+    /// last mark makes the pages that were dirty when it was taken dirty again, and restoring any other snapshot makes
+    /// every page dirty. A page programmed with the contents it already had is still dirty.
+    std::vector<page_range> dirty_pages() const;
+
+    /// Writes the current contents of every dirty page to a stream, which apply_delta can then use to bring a chip
+    /// that had the data this chip had at its last mark up to date. The delta scales with the number of dirty pages,
+    /// not with the size of the chip.
+    void export_delta(std::ostream& out) const;
+
+    /// Writes the pages held in a delta written by export_delta into the data of the chip. No user operations are
+    /// recorded, since the data doesn't arrive through the pins, but the pages become dirty. The whole delta is read
+    /// before anything is written, so the chip is unchanged if anything is wrong with it.
+    ///
+    /// \throws std::runtime_error if the chip is selected, or if the delta is corrupt or truncated.
+    /// \throws std::invalid_argument if the delta is of a chip with a different size.
+    void apply_delta(std::istream& in);
+
+    /// Programs an image, ending up exactly as if page_program had been called for every page the image touches, in
+    /// address order: the data, the pins, the virtual time, the dirty pages, every counter but the wall time
+    /// histograms, and the recorded user operations. Rather than clocking every bit, the data is written directly and
+    /// the user operations are encoded a range of pages per thread, then added to the log in order.
+    ///
+    /// \param image The bytes to program, which can span any number of pages.
+    /// \param address The address of the first byte to program.
+    /// \param num_threads The most threads to encode the user operations on, or zero for one per hardware thread.
+    /// \throws std::runtime_error if the chip is selected, a write is in progress, or a byte to program isn't erased.
+    /// \throws std::out_of_range if the image extends beyond the end of the chip.
+    /// \throws std::logic_error if the chip has no write enable or page program command.
+    void program_image(std::span<const std::byte> image, std::uint32_t address, std::size_t num_threads = 0);
+
+    /// Captures the current state of the chip, which can later be put back with restore. The data is shared with the
+    /// snapshot copy-on-write, so this only costs time proportional to the number of sectors.
+    ///
+    /// \throws std::runtime_error if the chip is selected, since a command in progress can't be captured.
+    snapshot take_snapshot();
+
+    /// Puts the chip back into the state it was in when a snapshot was taken, abandoning any command in progress.
+    /// Only sectors written since the snapshot need to be put back, and even those aren't copied until they are next
+    /// written. The log of user operations is truncated back to where it was, so the snapshot must have been taken from
+    /// this chip or from a chip it was forked from, with the log not truncated past the snapshot since.
+    ///
+    /// \throws std::invalid_argument if the snapshot is of a chip with a different size, or its log is shorter than it
+    /// was when the snapshot was taken. The chip is unchanged in that case.
+    void restore(const snapshot& s);
+
+    /// Makes a new chip in exactly the same state as this one, sharing the data copy-on-write. The log of user
+    /// operations and the timing are copied, so snapshots of this chip can also be restored into the new chip. The new
+    /// chip allocates its log from the same memory resource as this one.
+    ///
+    /// \throws std::runtime_error if the chip is selected.
+    std::unique_ptr<basic_flash_sim> fork();
 
     /// Toggles the chip-enable pin, i.e. if it is pin_state::high it will transition to pin_state::low and vice versa.
     virtual void toggle_chip_enable() override;
 
     /// Toggles the serial-input pin, i.e. if it is pin_state::high it will transition to pin_state::low and vice versa.
+    ///
+    /// \throws std::runtime_error if the chip is outputting data on the pin.
     virtual void toggle_serial_input() override;
 
+    /// Toggles the level the user drives on one of the four IO pins. Toggling IO0 is the same as toggling the
+    /// serial-input pin.
+    ///
+    /// \throws std::invalid_argument if there is no such IO pin.
+    /// \throws std::runtime_error if the chip is outputting data on the pin.
+    virtual void toggle_io(std::size_t io) override;
+
     /// Toggles the clock pin by setting it to pin_state::high then back to pin_state::low.
     ///
     /// It's not useful to make users call toggle_clock twice to initiate a clock cycle, so this method sets it to high
     /// and then to low instead of just having one transition.
     virtual void toggle_clock() override;
 
-    /// Waits for an in-progress write to complete. Does nothing for this implementation, since simulated writes always
-    /// complete immediately.
+    /// Waits for an in-progress write to complete, by moving the virtual time forward to when the write completes.
+    /// Does nothing else if no write is in progress.
     virtual void wait_for_write_complete() override;
 
+    /// Completes an in-progress write just like wait_for_write_complete, recording the same user operation, and
+    /// returns true. Waiting costs no real time on the simulated chip, so there is never a reason to come back later.
+    virtual bool poll_write_complete() override;
+
+    /// Inputs a series of bytes to the flash chip. When the chip can accept whole bytes, such as an opcode or the data
+    /// phase of a page program, the bytes are moved directly rather than bit by bit. The pins and the recorded user
+    /// operations end up exactly as if the bytes had been clocked in bit by bit.
+    virtual void clock_in_bytes(std::span<const std::byte> data, std::size_t num_io = 1) override;
+
+    /// Gets a series of bytes from the flash chip. When the current operation can provide whole bytes they are moved
+    /// directly rather than bit by bit. The pins and the recorded user operations end up exactly as if the bytes had
+    /// been clocked out bit by bit.
+    virtual void clock_out_bytes(std::span<std::byte> data, std::size_t num_io = 1) override;
+
+    /// Performs a complete command just like flash::transfer, but answers reads from the read cache when it can.
+    virtual void transfer(std::uint8_t                 opcode,
+                          std::optional<std::uint32_t> address,
+                          std::span<const std::byte>   tx,
+                          std::span<std::byte>         rx) override;
+
 private:
     /// Abstract base class for any operation that the chip can perform.
     class operation
@@ -81,7 +455,7 @@ private:
         /// Starts execution of the operation.
         ///
         /// \param f The underlying flash object upon which this operation is running.
-        operation(flash_sim& f);
+        operation(basic_flash_sim& f);
 
         /// Called when toggle_chip_enable is called on the flash object and this operation is currently running.
         virtual void toggle_chip_enable() = 0;
@@ -89,68 +463,149 @@ private:
         /// Called when toggle_clock is called on the flash object and this operation is currently running.
         virtual void toggle_clock() = 0;
 
+        /// Called when clock_in_bytes is called on the flash object and this operation is currently running. Operations
+        /// that can accept whole bytes override this. Only bytes that are guaranteed to be accepted without error may
+        /// be consumed, so that any error is raised by the bit-by-bit path exactly as it would have been otherwise.
+        ///
+        /// \returns The number of bytes consumed from the front of data. The default implementation consumes nothing.
+        virtual std::size_t clock_in_bytes(std::span<const std::byte> data, std::size_t num_io);
+
+        /// Called when clock_out_bytes is called on the flash object and this operation is currently running.
+        /// Operations that can provide whole bytes override this, with the same restrictions as clock_in_bytes.
+        ///
+        /// \returns The number of bytes produced at the front of data. The default implementation produces nothing.
+        virtual std::size_t clock_out_bytes(std::span<std::byte> data, std::size_t num_io);
+
+        /// Called as soon as the last bit of the address has been clocked in, for operations with an address phase.
+        /// The default implementation does nothing.
+        virtual void address_complete();
+
     protected:
         /// The flash object upon which this operation is running.
-        flash_sim& _flash;
+        basic_flash_sim& _flash;
     };
 
     /// Any operation that requires a data address. The address is always read in immediately following the operation's
-    /// opcode.
+    /// opcode, by the chip itself as the phase table says, so none of the operation's methods are called until the
+    /// address is complete.
     class operation_with_address : public operation
     {
     public:
         /// Starts execution of the operation.
         ///
         /// \param f The underlying flash object upon which this operation is running.
-        operation_with_address(flash_sim& f);
+        operation_with_address(basic_flash_sim& f);
 
-        /// Called when toggle_chip_enable is called on the flash object and this operation is currently running.
+        /// Gets the completed address that has been clocked in.
         ///
         /// \throws std::runtime_error if the address has not been fully clocked in yet.
-        virtual void toggle_chip_enable() override final;
+        std::uint32_t address() const;
 
-        /// Called when toggle_chip_enable is called on the flash object and this operation is currently running.
-        ///
-        /// \throws std::runtime_error if the address has not been fully clocked in yet.
-        virtual void toggle_clock() override final;
+        /// Whether or not the address has been fully clocked in.
+        bool address_ready() const noexcept;
+    };
 
-        /// Derived classes must override this. Called when toggle_chip_enable is called on the flash object and this
-        /// operation is currently running and the address has been fully clocked in.
-        virtual void toggle_chip_enable_impl() = 0;
+    /// An operation that starts reading data at a given address. Reading continues for as long as the clock is toggled,
+    /// moving on to the next address after every byte and wrapping around to address zero after the end of the chip.
+    class read_operation : public operation_with_address
+    {
+    public:
+        /// Starts execution of the operation.
+        ///
+        /// \param f The underlying flash object upon which this operation is running.
+        /// \param command The read command, whose phases give the number of dummy cycles and of IO pins data is output
+        /// on. With one IO pin, data is output on the serial-output pin.
+        read_operation(basic_flash_sim& f, flash_sim_command command = flash_sim_command::read);
 
-        /// Derived classes must override this. Called when toggle_clock is called on the flash object and this
-        /// operation is currently running and the address has been fully clocked in.
-        virtual void toggle_clock_impl() = 0;
+        /// Ends the read operation.
+        virtual void toggle_chip_enable() override;
 
-        /// Gets the completed address that has been clocked in.
+        /// Outputs the next bits of read data on the data IO pins.
         ///
-        /// \throws std::runtime_error if the address has not been fully clocked in yet.
-        std::uint32_t address() const;
+        /// \throws std::out_of_range if the address is beyond the capacity of the flash device.
+        virtual void toggle_clock() override;
+
+        /// Moves whole bytes of read data out, as long as the read is at a byte boundary.
+        virtual std::size_t clock_out_bytes(std::span<std::byte> data, std::size_t num_io) override;
+
+        /// Skips over whole bytes of read data, or the dummy cycles, as long as the read is at a byte boundary.
+        virtual std::size_t clock_in_bytes(std::span<const std::byte> data, std::size_t num_io) override;
+
+        /// Outputs the first bit of data, unless there are dummy cycles to go first.
+        virtual void address_complete() override;
 
     private:
-        /// The address being read.
-        std::uint32_t _address;
+        /// Loads the byte at _current_address and outputs its first bits.
+        void load();
+
+        /// Outputs the bits of the current byte that come next.
+        void present() noexcept;
 
-        /// Which bit of _address is currently being read.
+        /// Moves past the given number of whole bytes and outputs the first bit of the following byte.
+        void advance(std::size_t num_bytes);
+
+        /// The address of the byte currently being output.
+        std::uint32_t _current_address;
+
+        /// The byte currently being output.
+        std::byte _current_byte;
+
+        /// Which bit of the current byte is being output.
         std::uint8_t _bit_index;
+
+        /// The number of dummy cycles still to go before data is output.
+        std::uint8_t _dummy_cycles;
+
+        /// The number of IO pins data is output on.
+        std::uint8_t _data_io;
     };
 
-    /// An operation that starts reading data at a given address.
-    class read_operation : public operation_with_address
+    /// A read operation with eight dummy cycles between the address and the data, which lets the real chip run at a
+    /// higher clock frequency.
+    class fast_read_operation : public read_operation
     {
     public:
         /// Starts execution of the operation.
         ///
         /// \param f The underlying flash object upon which this operation is running.
-        read_operation(flash_sim& f);
+        fast_read_operation(basic_flash_sim& f);
+    };
 
-        /// Ends the read operation.
-        virtual void toggle_chip_enable_impl() override;
+    /// A fast read that outputs two bits of data per clock cycle, on IO1 and IO0.
+    class dual_output_read_operation : public read_operation
+    {
+    public:
+        /// Starts execution of the operation.
+        ///
+        /// \param f The underlying flash object upon which this operation is running.
+        dual_output_read_operation(basic_flash_sim& f);
+    };
+
+    /// A fast read that outputs four bits of data per clock cycle, on IO3 down to IO0.
+    class quad_output_read_operation : public read_operation
+    {
+    public:
+        /// Starts execution of the operation.
+        ///
+        /// \param f The underlying flash object upon which this operation is running.
+        quad_output_read_operation(basic_flash_sim& f);
+    };
 
-        /// Clocks in the next bit of read data, and outputs that bit on the serial-output pin.
-        virtual void toggle_clock_impl() override;
+    /// A fast read that clocks in the address and outputs data four bits per clock cycle. The address is followed by
+    /// six dummy cycles, the first two of which carry the chip's mode bits. The simulation ignores the mode bits, so
+    /// every quad IO read needs its own opcode.
+    class quad_io_read_operation : public read_operation
+    {
+    public:
+        /// Starts execution of the operation.
+        ///
+        /// \param f The underlying flash object upon which this operation is running.
+        quad_io_read_operation(basic_flash_sim& f);
     };
 
+    /// The chip's page latch, into which page program commands clock their data before it is committed.
+    using page_buffer = std::array<std::byte, traits::page_size>;
+
     /// An operation that starts writing data at a given address.
     class write_operation : public operation_with_address
     {
@@ -158,23 +613,41 @@ private:
         /// Starts execution of the operation.
         ///
         /// \param f The underlying flash object upon which this operation is running.
-        write_operation(flash_sim& f);
+        /// \param command The page program command, whose phases give the number of IO pins data is clocked in over.
+        write_operation(basic_flash_sim& f, flash_sim_command command = flash_sim_command::page_program);
 
         /// Ends the write operation and actually commits the write buffer to the flash data.
-        virtual void toggle_chip_enable_impl() override;
+        virtual void toggle_chip_enable() override;
 
-        /// Clocks the next bit from the serial-input pin into the write buffer.
-        virtual void toggle_clock_impl() override;
+        /// Clocks the next bits from the data IO pins into the write buffer.
+        virtual void toggle_clock() override;
+
+        /// Moves whole bytes into the write buffer, up to the first byte that would be rejected.
+        virtual std::size_t clock_in_bytes(std::span<const std::byte> data, std::size_t num_io) override;
 
     private:
-        /// A buffer into which the data to be written is read.
-        std::vector<std::byte> _write_buffer;
+        /// A buffer into which the data to be written is read. This is the chip's page buffer, so that nothing is
+        /// allocated per page program.
+        page_buffer& _write_buffer;
 
         /// Which byte of the write buffer is currently being read.
-        std::vector<std::byte>::iterator _current_byte;
+        page_buffer::iterator _current_byte;
 
         /// Which bit of the current byte in the write buffer is currently being read.
         std::uint8_t _bit_index;
+
+        /// The number of IO pins data is clocked in over.
+        std::uint8_t _data_io;
+    };
+
+    /// A page program that clocks in data four bits per clock cycle, on IO3 down to IO0.
+    class quad_write_operation : public write_operation
+    {
+    public:
+        /// Starts execution of the operation.
+        ///
+        /// \param f The underlying flash object upon which this operation is running.
+        quad_write_operation(basic_flash_sim& f);
     };
 
     /// An operation that sets the write enable bit so that the next operation can perform a write.
@@ -184,7 +657,7 @@ private:
         /// Starts execution of the operation.
         ///
         /// \param f The underlying flash object upon which this operation is running.
-        write_enable_operation(flash_sim& f);
+        write_enable_operation(basic_flash_sim& f);
 
         /// Completes the write enable operation by actually setting the write enable bit.
         virtual void toggle_chip_enable() override;
@@ -193,6 +666,36 @@ private:
         virtual void toggle_clock() override;
     };
 
+    /// An operation that outputs the status register on the serial-output pin, over and over for as long as the clock
+    /// is toggled. Every repeat reflects the status at the time it starts, so the WIP bit can be polled.
+    class read_status_operation : public operation
+    {
+    public:
+        /// Starts execution of the operation.
+        ///
+        /// \param f The underlying flash object upon which this operation is running.
+        read_status_operation(basic_flash_sim& f);
+
+        /// Ends the read status operation.
+        virtual void toggle_chip_enable() override;
+
+        /// Outputs the next bit of the status register on the serial-output pin.
+        virtual void toggle_clock() override;
+
+        /// Moves whole copies of the status register out, as long as the output is at a byte boundary.
+        virtual std::size_t clock_out_bytes(std::span<std::byte> data, std::size_t num_io) override;
+
+    private:
+        /// Latches the current status and outputs its first bit.
+        void load();
+
+        /// The status being output.
+        std::byte _status;
+
+        /// Which bit of the status is being output.
+        std::uint8_t _bit_index;
+    };
+
     /// An operation that sets all data on the chip to 0xff.
     class chip_erase_operation : public operation
     {
@@ -200,7 +703,7 @@ private:
         /// Starts execution of the operation.
         ///
         /// \param f The underlying flash object upon which this operation is running.
-        chip_erase_operation(flash_sim& f);
+        chip_erase_operation(basic_flash_sim& f);
 
         /// Completes the chip erase operation by actually setting all of the data bytes to 0xff.
         virtual void toggle_chip_enable() override;
@@ -209,20 +712,182 @@ private:
         virtual void toggle_clock() override;
     };
 
-    /// Mapping from opcode value to a function that can create an operation object. When the instruction reigster is
-    /// completed we look up the operation given by the instruction register in this map and then start executing that
-    /// operation.
-    static std::map<std::byte, std::function<std::unique_ptr<operation>(flash_sim&)>> _operation_map;
+    /// Identifies a read in the read cache.
+    struct read_key
+    {
+        /// The opcode of the read.
+        std::uint8_t opcode;
+
+        /// The address of the first byte read.
+        std::uint32_t address;
+
+        /// The number of bytes read.
+        std::size_t num_bytes;
+
+        bool operator==(const read_key&) const = default;
+    };
+
+    /// Hashes a read_key.
+    struct read_key_hash
+    {
+        std::size_t operator()(const read_key& k) const noexcept;
+    };
+
+    /// A read remembered by the read cache, along with everything it did to the chip.
+    struct cached_read
+    {
+        /// The bytes clocked in after the address.
+        std::vector<std::byte> tx;
+
+        /// The levels the user drove on the IO pins before the read, with IO0 in the least significant bit.
+        std::uint8_t levels_before;
+
+        /// The bytes read, which are also the data of the chip where they were read from.
+        std::vector<std::byte> data;
+
+        /// The user operations the read recorded, if recording is on.
+        user_operation_log operations;
+
+        /// The levels the user drove on the IO pins after the read.
+        std::array<pin_state, 4> io_input;
+
+        /// The levels the chip last output on the IO pins after the read.
+        std::array<pin_state, 4> io_output;
+
+        /// The last user operation of the read.
+        user_operation last_operation;
+
+        /// Whether or not the data is known to still match the data of the chip.
+        bool verified;
+    };
+
+    /// Answers a read from the read cache, if it is there and still valid.
+    ///
+    /// \returns Whether or not the read was answered.
+    bool read_from_cache(const read_key& key, std::span<const std::byte> tx, std::span<std::byte> rx);
+
+    /// Sets everything but the data and the log of user operations back to how it was when a snapshot was taken.
+    void restore_state(const snapshot& s) noexcept;
+
+    /// Gets the first opcode of a command, or std::nullopt if the chip doesn't have the command.
+    static constexpr std::optional<std::uint8_t> find_opcode(flash_sim_command command) noexcept;
+
+    /// Appends the user operations page_program records for every page of part of an image to a log.
+    ///
+    /// \param log The log to append to.
+    /// \param image The part of the image.
+    /// \param address The address of the first byte of the part.
+    /// \param level Whether or not the serial input is high before the first page.
+    static void encode_page_programs(user_operation_log&        log,
+                                     std::span<const std::byte> image,
+                                     std::uint32_t              address,
+                                     bool                       level);
+
+    /// Starts the operation for the opcode in the instruction register, once it has been fully clocked in.
+    ///
+    /// \throws std::out_of_range if the opcode is unknown.
+    /// \throws std::runtime_error if a write is in progress and the opcode isn't read status register.
+    void start_command();
+
+    /// Notes that a user operation was performed, and records it if recording is enabled. Clock toggles also move the
+    /// virtual time forward.
+    void record(user_operation op);
+
+    /// Starts a program or erase that takes the given time to complete.
+    void start_write(std::chrono::nanoseconds duration) noexcept;
+
+    /// Clocks whole bytes of the address in, as long as the address phase is at a byte boundary and uses num_io IO
+    /// pins. Calls address_complete on the operation once the last byte is in.
+    ///
+    /// \returns The number of bytes consumed from the front of data.
+    std::size_t clock_in_address(std::span<const std::byte> data, std::size_t num_io);
+
+    /// Notes that a range of bytes has been programmed or erased, making every page it touches dirty.
+    void mark_dirty(std::size_t address, std::size_t num_bytes) noexcept;
+
+    /// Gets a mark that no chip has used before.
+    static std::uint64_t next_mark() noexcept;
+
+    /// Counts bytes programmed or erased, if stats are enabled.
+    void count_written(std::size_t programmed, std::size_t erased) noexcept;
+
+    /// Gets the user operation that toggles the given IO pin.
+    static user_operation toggle_io_operation(std::size_t io) noexcept;
+
+    /// Gets the levels the user drives on the first num_io IO pins, with IO0 in the least significant bit.
+    std::uint8_t sample_io(std::size_t num_io) const noexcept;
+
+    /// Updates the IO pins and records the user operations needed to clock in a byte bit by bit over num_io IO pins,
+    /// without actually clocking the byte into the current operation.
+    ///
+    /// \throws std::runtime_error if the first toggle would toggle the same pin as the last user operation.
+    void record_clock_in(std::byte value, std::size_t num_io);
+
+    /// Records the user operations needed to clock out a byte bit by bit over num_io IO pins, without actually clocking
+    /// the byte out of the current operation.
+    void record_clock_out(std::size_t num_io);
+
+    /// An operation that sets all data in the block containing a given address to 0xff. Used for the sector erase and
+    /// both block erase commands, which only differ in how much they erase.
+    ///
+    /// \tparam command The erase command, which determines how much is erased.
+    template <flash_sim_command command>
+    class block_erase_operation : public operation_with_address
+    {
+    public:
+        /// The number of bytes erased, a multiple of the sector size.
+        static constexpr std::size_t block_size = command == flash_sim_command::sector_erase ? traits::sector_erase_size
+                                                  : command == flash_sim_command::block_erase_32k
+                                                      ? traits::block_erase_32k_size
+                                                      : traits::block_erase_64k_size;
+
+        static_assert(block_size != 0 && block_size % flash_store::sector_size == 0);
+
+        /// Starts execution of the operation.
+        ///
+        /// \param f The underlying flash object upon which this operation is running.
+        block_erase_operation(basic_flash_sim& f);
+
+        /// Completes the erase operation by actually setting all of the data bytes in the block to 0xff.
+        ///
+        /// \throws std::out_of_range if the address is beyond the capacity of the flash device.
+        virtual void toggle_chip_enable() override;
+
+        /// Toggling the clock after the address is not a valid thing to do for an erase operation, so this method
+        /// always throws.
+        virtual void toggle_clock() override;
+    };
+
+    /// A function that starts an operation in the chip's operation storage.
+    using operation_factory = operation* (*)(basic_flash_sim&);
+
+    /// Starts an operation of the given type in the chip's operation storage.
+    template <typename operation_type>
+    static operation* start_operation(basic_flash_sim& f);
+
+    /// Builds _operation_table.
+    static constexpr std::array<operation_factory, 256> make_operation_table() noexcept;
+
+    /// Mapping from opcode value to a function that can start an operation, built from the command the traits give
+    /// each opcode. When the instruction register is completed we look up the operation given by the instruction
+    /// register in this table and then start executing that operation. Unknown opcodes map to nullptr. The table is
+    /// constant-initialized, so it never needs any dynamic initialization or allocation.
+    static const std::array<operation_factory, 256> _operation_table;
 
     /// The state of the chip enable (CE) pin on the flash chip. This pin has inverted logic, so the chip is deselected
     /// when the pin is set to high, and it is selected when the pin is set to low.
     pin_state _chip_enable;
 
-    /// The state of the serial input (SI) pin on the flash chip. Used when reading in commands, addresses, and data.
-    pin_state _serial_input;
+    /// The levels the user drives on the IO pins. IO0 is the serial input (SI) pin, used when reading in commands,
+    /// addresses, and data.
+    std::array<pin_state, 4> _io_input;
+
+    /// The levels the chip outputs on the IO pins. IO1 is the serial output (SO) pin, used when reading out data from
+    /// the chip.
+    std::array<pin_state, 4> _io_output;
 
-    /// The state of the serial output (SO) pin on the flash chip. Used when reading out data from the chip.
-    pin_state _serial_output;
+    /// A mask of the IO pins the chip is currently outputting data on, with IO0 in the least significant bit.
+    std::uint8_t _driven_io;
 
     /// The current state of the chip in the chip state machine.
     chip_state _chip_state;
@@ -236,14 +901,106 @@ private:
     /// The contents of the instruction register, used during the command phase.
     std::byte _instruction_register;
 
-    /// The currently ongoing operation object. This is nullptr when there is no active operation.
-    std::unique_ptr<operation> _operation;
+    /// The address register, into which the address phase of the current command shifts its bits.
+    std::uint32_t _address;
+
+    /// The number of clock cycles left in the address phase of the current command, or zero once it is complete or if
+    /// the command has no address.
+    std::uint8_t _address_clocks;
+
+    /// The number of IO pins the address phase of the current command clocks bits in over.
+    std::uint8_t _address_io;
+
+    /// In-place storage for the currently ongoing operation object, so starting an operation never allocates.
+    std::variant<std::monostate,
+                 read_operation,
+                 fast_read_operation,
+                 dual_output_read_operation,
+                 quad_output_read_operation,
+                 quad_io_read_operation,
+                 write_operation,
+                 quad_write_operation,
+                 write_enable_operation,
+                 read_status_operation,
+                 chip_erase_operation,
+                 block_erase_operation<flash_sim_command::sector_erase>,
+                 block_erase_operation<flash_sim_command::block_erase_32k>,
+                 block_erase_operation<flash_sim_command::block_erase_64k>>
+        _operation_storage;
+
+    /// The currently ongoing operation object, which lives in _operation_storage. This is nullptr when there is no
+    /// active operation.
+    operation* _operation;
+
+    /// The page latch shared by every page program command. Aligned to a cache line so filling it never straddles more
+    /// lines than necessary.
+    alignas(64) page_buffer _page_buffer;
 
     /// The actual data stored by the flash chip.
-    std::vector<std::byte> _data;
+    flash_store _data;
+
+    /// A contiguous copy of _data, made on demand by get_data.
+    mutable std::vector<std::byte> _flattened_data;
+
+    /// The version of _data that _flattened_data was copied from.
+    mutable std::uint64_t _flattened_version;
+
+    /// Which user operations are recorded into _user_operations.
+    recording _recording;
+
+    /// How long things take on the chip.
+    timing _timing;
+
+    /// The virtual time that has passed on the chip.
+    std::chrono::nanoseconds _elapsed;
+
+    /// The virtual time at which the write in progress completes. The write is complete once _elapsed reaches this.
+    std::chrono::nanoseconds _write_complete;
+
+    /// The most recently performed user operation, whether or not it was recorded.
+    user_operation _last_operation;
 
     /// The series of operations that a user would need to perform to get the data of the chip into the current state.
-    std::vector<user_operation> _user_operations;
+    user_operation_log _user_operations;
+
+    /// One bit per page, set once the page has been programmed or erased since the last mark. Page i is bit i % 64 of
+    /// word i / 64.
+    std::vector<std::uint64_t> _dirty;
+
+    /// Identifies the last mark, so a snapshot can tell whether it was taken since then.
+    std::uint64_t _mark;
+
+    /// The reads in the read cache.
+    std::unordered_map<read_key, cached_read, read_key_hash> _read_cache;
+
+    /// The most reads the read cache holds, or zero if it is off.
+    std::size_t _read_cache_capacity;
+
+    /// How the read cache has been used.
+    read_cache_stats _read_cache_stats;
+
+    /// The counters behind get_stats, along with what is needed to collect them.
+    struct stats_collector
+    {
+        /// The counters.
+        stats totals;
+
+        /// The number of clock toggles since the chip was last selected.
+        std::uint64_t clocks = 0;
+
+        /// When the chip was last selected.
+        std::chrono::steady_clock::time_point selected;
+    };
+
+    /// The counters, or nullptr if stats are not enabled.
+    std::unique_ptr<stats_collector> _stats;
 };
 
+/// A simulated IS25LP128.
+using flash_sim = basic_flash_sim<is25lp128_traits>;
+
+// The IS25LP128 is instantiated once, in the library. Simulating any other chip needs flash_sim.ipp, which holds the
+// definitions of every member.
+extern template class basic_flash_sim<is25lp128_traits>;
+
 } // End namespace bedrock.
@@ -0,0 +1,1591 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <exception>
+#include <system_error>
+#include <thread>
+
+#include "flash_config.hpp"
+#include "flash_sim.hpp"
+
+namespace bedrock
+{
+
+/// Helpers for the definitions of basic_flash_sim. Every translation unit that instantiates basic_flash_sim shares
+/// them, so they live in a named namespace rather than an anonymous one.
+namespace detail
+{
+
+/// Whether or not basic_flash_sim collects stats.
+inline constexpr bool collect_stats = BEDROCK_FLASH_STATS != 0;
+
+/// Writes the contents of a histogram as a JSON array, leaving out the trailing empty buckets.
+template <typename histogram>
+inline void write_histogram(std::ostream& out, const histogram& h)
+{
+    auto last = std::find_if(std::rbegin(h), std::rend(h), [](std::uint64_t n) { return n != 0; }).base();
+    out << '[';
+    for (auto it = std::begin(h); it != last; ++it)
+        out << (it == std::begin(h) ? "" : ",") << *it;
+    out << ']';
+}
+
+/// Writes a number as a 64-bit little-endian integer.
+inline void write_u64(std::ostream& out, std::uint64_t value)
+{
+    char bytes[8];
+    for (std::size_t i = 0; i < sizeof(bytes); ++i)
+        bytes[i] = static_cast<char>(value >> (8 * i));
+    out.write(bytes, sizeof(bytes));
+}
+
+/// Reads a 64-bit little-endian integer, returning false if the stream ends first.
+inline bool read_u64(std::istream& in, std::uint64_t& value)
+{
+    unsigned char bytes[8];
+    if (!in.read(reinterpret_cast<char*>(bytes), sizeof(bytes)))
+        return false;
+    value = 0;
+    for (std::size_t i = sizeof(bytes); i-- != 0;)
+        value = value << 8 | bytes[i];
+    return true;
+}
+
+} // End namespace detail.
+
+/**********************************************************************************************************************\
+* basic_flash_sim::stats                                                                                               *
+\**********************************************************************************************************************/
+
+template <typename traits>
+void basic_flash_sim<traits>::stats::write_json(std::ostream& out) const
+{
+    constexpr char digits[] = "0123456789abcdef";
+    out << "{\"commands\":{";
+    bool first = true;
+    for (std::size_t opcode = 0; opcode < commands.size(); ++opcode)
+    {
+        const command& c = commands[opcode];
+        if (c.count == 0)
+            continue;
+        out << (first ? "" : ",") << "\"0x" << digits[opcode >> 4] << digits[opcode & 0xf] << "\":{";
+        out << "\"count\":" << c.count << ",\"clocks\":" << c.clocks << ",\"wall_time_ns_log2\":";
+        detail::write_histogram(out, c.wall_time);
+        out << '}';
+        first = false;
+    }
+    out << "},\"bytes_programmed\":" << bytes_programmed << ",\"bytes_erased\":" << bytes_erased
+        << ",\"log_bytes\":" << log_bytes << '}';
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim                                                                                                      *
+\**********************************************************************************************************************/
+
+template <typename traits>
+template <typename operation_type>
+typename basic_flash_sim<traits>::operation* basic_flash_sim<traits>::start_operation(basic_flash_sim& f)
+{
+    return &f._operation_storage.template emplace<operation_type>(f);
+}
+
+template <typename traits>
+constexpr std::array<typename basic_flash_sim<traits>::operation_factory, 256>
+basic_flash_sim<traits>::make_operation_table() noexcept
+{
+    using enum flash_sim_command;
+    std::array<operation_factory, 256> table{};
+    for (std::size_t opcode = 0; opcode < table.size(); ++opcode)
+    {
+        switch (traits::command(static_cast<std::uint8_t>(opcode)))
+        {
+        case none: break;
+        case read: table[opcode] = &start_operation<read_operation>; break;
+        case fast_read: table[opcode] = &start_operation<fast_read_operation>; break;
+        case dual_output_read: table[opcode] = &start_operation<dual_output_read_operation>; break;
+        case quad_output_read: table[opcode] = &start_operation<quad_output_read_operation>; break;
+        case quad_io_read: table[opcode] = &start_operation<quad_io_read_operation>; break;
+        case page_program: table[opcode] = &start_operation<write_operation>; break;
+        case quad_page_program: table[opcode] = &start_operation<quad_write_operation>; break;
+        case write_enable: table[opcode] = &start_operation<write_enable_operation>; break;
+        case read_status: table[opcode] = &start_operation<read_status_operation>; break;
+        case chip_erase: table[opcode] = &start_operation<chip_erase_operation>; break;
+        case sector_erase: table[opcode] = &start_operation<block_erase_operation<sector_erase>>; break;
+        case block_erase_32k: table[opcode] = &start_operation<block_erase_operation<block_erase_32k>>; break;
+        case block_erase_64k: table[opcode] = &start_operation<block_erase_operation<block_erase_64k>>; break;
+        }
+    }
+    return table;
+}
+
+template <typename traits>
+constinit const std::array<typename basic_flash_sim<traits>::operation_factory, 256>
+    basic_flash_sim<traits>::_operation_table = make_operation_table();
+
+template <typename traits>
+basic_flash_sim<traits>::basic_flash_sim(std::size_t num_bytes, recording mode, std::pmr::memory_resource* resource)
+        : basic_flash_sim(flash_store(num_bytes), mode, resource)
+{
+}
+
+template <typename traits>
+basic_flash_sim<traits>::basic_flash_sim(flash_store data, recording mode, std::pmr::memory_resource* resource)
+        : _chip_enable(pin_state::high)
+        , _io_input{pin_state::low, pin_state::low, pin_state::low, pin_state::low}
+        , _io_output{pin_state::low, pin_state::low, pin_state::low, pin_state::low}
+        , _driven_io(0)
+        , _chip_state(chip_state::deselected)
+        , _write_enabled(false)
+        , _bit_index(0)
+        , _instruction_register{0}
+        , _address(0)
+        , _address_clocks(0)
+        , _address_io(0)
+        , _operation_storage()
+        , _operation(nullptr)
+        , _page_buffer()
+        , _data(std::move(data))
+        , _flattened_data()
+        , _flattened_version(0)
+        , _recording(mode)
+        , _timing()
+        , _elapsed(0)
+        , _write_complete(0)
+        , _last_operation(user_operation::wait_for_write_complete)
+        , _user_operations(resource)
+        , _dirty(((_data.size() + page_size - 1) / page_size + 63) / 64)
+        , _mark(next_mark())
+        , _read_cache()
+        , _read_cache_capacity(0)
+        , _read_cache_stats()
+        , _stats(detail::collect_stats ? std::make_unique<stats_collector>() : nullptr)
+{
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::chip_state basic_flash_sim<traits>::get_chip_state() const noexcept
+{
+    return _chip_state;
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::pin_state basic_flash_sim<traits>::get_chip_enable() const noexcept
+{
+    return _chip_enable;
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::pin_state basic_flash_sim<traits>::get_serial_input() const noexcept
+{
+    return _io_input[0];
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::pin_state basic_flash_sim<traits>::get_serial_output() const noexcept
+{
+    return _io_output[1];
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::pin_state basic_flash_sim<traits>::get_io(std::size_t io) const noexcept
+{
+    if (io >= _io_input.size())
+        return pin_state::low;
+    return (_driven_io >> io & 1) != 0 ? _io_output[io] : _io_input[io];
+}
+
+template <typename traits>
+const std::vector<std::byte>& basic_flash_sim<traits>::get_data() const
+{
+    if (_flattened_data.size() != _data.size() || _flattened_version != _data.version())
+    {
+        _data.flatten(_flattened_data);
+        _flattened_version = _data.version();
+    }
+    return _flattened_data;
+}
+
+template <typename traits>
+const flash_store& basic_flash_sim<traits>::get_store() const noexcept
+{
+    return _data;
+}
+
+template <typename traits>
+bool basic_flash_sim<traits>::is_erased(std::size_t address, std::size_t num_bytes) const
+{
+    return _data.find_not(address, num_bytes, std::byte{0xff}) == address + num_bytes;
+}
+
+template <typename traits>
+std::optional<std::size_t> basic_flash_sim<traits>::first_non_erased(std::size_t address, std::size_t num_bytes) const
+{
+    std::size_t found = _data.find_not(address, num_bytes, std::byte{0xff});
+    if (found == address + num_bytes)
+        return std::nullopt;
+    return found;
+}
+
+template <typename traits>
+std::vector<typename basic_flash_sim<traits>::page_range>
+basic_flash_sim<traits>::diff(std::span<const std::byte> image) const
+{
+    if (image.size() != _data.size())
+        throw std::invalid_argument("Image is not the same size as the chip.");
+
+    // Skip straight to the next mismatch, then extend the run one page at a time for as long as every page differs.
+    std::vector<page_range> ranges;
+    for (std::size_t address = 0; address != image.size();)
+    {
+        std::size_t found = _data.mismatch(address, image.subspan(address));
+        if (found == image.size())
+            break;
+        std::size_t first = found / page_size * page_size;
+        std::size_t last  = first;
+        do
+        {
+            std::size_t count = std::min(page_size, image.size() - last);
+            if (last != first && _data.mismatch(last, image.subspan(last, count)) == last + count)
+                break;
+            last += count;
+        } while (last != image.size());
+        ranges.push_back({first, last - first});
+        address = last;
+    }
+    return ranges;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::sync()
+{
+    _data.sync();
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::recording basic_flash_sim<traits>::get_recording() const noexcept
+{
+    return _recording;
+}
+
+template <typename traits>
+const typename basic_flash_sim<traits>::timing& basic_flash_sim<traits>::get_timing() const noexcept
+{
+    return _timing;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::set_timing(const timing& t) noexcept
+{
+    _timing = t;
+}
+
+template <typename traits>
+std::chrono::nanoseconds basic_flash_sim<traits>::elapsed() const noexcept
+{
+    return _elapsed;
+}
+
+template <typename traits>
+bool basic_flash_sim<traits>::write_in_progress() const noexcept
+{
+    return _elapsed < _write_complete;
+}
+
+template <typename traits>
+std::uint8_t basic_flash_sim<traits>::get_status() const noexcept
+{
+    return (write_in_progress() ? status_write_in_progress : 0) | (_write_enabled ? status_write_enable_latch : 0);
+}
+
+template <typename traits>
+const user_operation_log& basic_flash_sim<traits>::get_user_operations() const noexcept
+{
+    return _user_operations;
+}
+
+template <typename traits>
+bool basic_flash_sim<traits>::stats_enabled() noexcept
+{
+    return detail::collect_stats;
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::stats basic_flash_sim<traits>::get_stats() const
+{
+    stats result;
+    if constexpr (detail::collect_stats)
+    {
+        result           = _stats->totals;
+        result.log_bytes = _user_operations.storage_bytes();
+    }
+    return result;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::reset_stats() noexcept
+{
+    if constexpr (detail::collect_stats)
+        _stats->totals = stats();
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::set_read_cache_capacity(std::size_t num_reads)
+{
+    _read_cache.clear();
+    _read_cache_capacity = num_reads;
+    _read_cache_stats    = read_cache_stats();
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::read_cache_stats basic_flash_sim<traits>::get_read_cache_stats() const noexcept
+{
+    read_cache_stats s = _read_cache_stats;
+    s.size             = _read_cache.size();
+    return s;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::mark_clean() noexcept
+{
+    std::fill(std::begin(_dirty), std::end(_dirty), 0);
+    _mark = next_mark();
+}
+
+template <typename traits>
+std::vector<typename basic_flash_sim<traits>::page_range> basic_flash_sim<traits>::dirty_pages() const
+{
+    std::vector<page_range> ranges;
+    const std::size_t       num_pages = (_data.size() + page_size - 1) / page_size;
+    for (std::size_t page = 0; page < num_pages;)
+    {
+        // Whole words of clean pages are skipped at once.
+        std::uint64_t word = _dirty[page / 64] >> page % 64;
+        if (word == 0)
+        {
+            page = (page / 64 + 1) * 64;
+            continue;
+        }
+        page += static_cast<std::size_t>(std::countr_zero(word));
+        if (page >= num_pages)
+            break;
+        std::size_t first = page;
+        while (page < num_pages && (_dirty[page / 64] >> page % 64 & 1) != 0)
+            ++page;
+        ranges.push_back({first * page_size, std::min(page * page_size, _data.size()) - first * page_size});
+    }
+    return ranges;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::export_delta(std::ostream& out) const
+{
+    std::vector<page_range> ranges = dirty_pages();
+    out.write(flash_delta_format::magic, sizeof(flash_delta_format::magic));
+    out.put(static_cast<char>(flash_delta_format::version));
+    detail::write_u64(out, _data.size());
+    detail::write_u64(out, ranges.size());
+
+    // Pages are copied out through a bounded buffer, so a large run doesn't need a copy of its own.
+    std::vector<std::byte> buffer(std::min<std::size_t>(_data.size(), 0x10000));
+    for (const page_range& r : ranges)
+    {
+        detail::write_u64(out, r.address);
+        detail::write_u64(out, r.num_bytes);
+        for (std::size_t done = 0; done < r.num_bytes;)
+        {
+            auto chunk = std::span(buffer).first(std::min(buffer.size(), r.num_bytes - done));
+            _data.read(r.address + done, chunk);
+            out.write(reinterpret_cast<const char*>(chunk.data()), static_cast<std::streamsize>(chunk.size()));
+            done += chunk.size();
+        }
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::apply_delta(std::istream& in)
+{
+    if (_chip_state != chip_state::deselected)
+        throw std::runtime_error("Cannot apply a delta while the chip is selected.");
+
+    char header[sizeof(flash_delta_format::magic) + 1];
+    if (!in.read(header, sizeof(header))
+        || !std::equal(std::begin(flash_delta_format::magic), std::end(flash_delta_format::magic), header))
+        throw std::runtime_error("Stream is not a flash delta.");
+    if (static_cast<std::uint8_t>(header[sizeof(flash_delta_format::magic)]) != flash_delta_format::version)
+        throw std::runtime_error("Unsupported flash delta version.");
+    std::uint64_t size     = 0;
+    std::uint64_t num_runs = 0;
+    if (!detail::read_u64(in, size) || !detail::read_u64(in, num_runs))
+        throw std::runtime_error("Truncated flash delta.");
+    if (size != _data.size())
+        throw std::invalid_argument("Delta is of a chip with a different size.");
+
+    // Runs are in address order and never overlap, so their total size can't exceed the size of the chip.
+    std::vector<page_range> ranges;
+    std::vector<std::byte>  bytes;
+    for (std::uint64_t i = 0, end = 0; i < num_runs; ++i)
+    {
+        std::uint64_t address   = 0;
+        std::uint64_t num_bytes = 0;
+        if (!detail::read_u64(in, address) || !detail::read_u64(in, num_bytes))
+            throw std::runtime_error("Truncated flash delta.");
+        if (address < end || address > size || num_bytes > size - address)
+            throw std::runtime_error("Corrupt flash delta.");
+        ranges.push_back({address, num_bytes});
+        bytes.resize(bytes.size() + num_bytes);
+        if (!in.read(reinterpret_cast<char*>(bytes.data() + bytes.size() - num_bytes),
+                     static_cast<std::streamsize>(num_bytes)))
+            throw std::runtime_error("Truncated flash delta.");
+        end = address + num_bytes;
+    }
+
+    std::span<const std::byte> data(bytes);
+    for (const page_range& r : ranges)
+    {
+        _data.write(r.address, data.first(r.num_bytes));
+        mark_dirty(r.address, r.num_bytes);
+        data = data.subspan(r.num_bytes);
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::program_image(std::span<const std::byte> image,
+                                            std::uint32_t              address,
+                                            std::size_t                num_threads)
+{
+    std::optional<std::uint8_t> write_enable_opcode = find_opcode(flash_sim_command::write_enable);
+    std::optional<std::uint8_t> page_program_opcode = find_opcode(flash_sim_command::page_program);
+    if (!write_enable_opcode || !page_program_opcode)
+        throw std::logic_error("The chip has no write enable or page program command.");
+    if (_chip_state != chip_state::deselected)
+        throw std::runtime_error("Cannot program an image while the chip is selected.");
+    if (write_in_progress())
+        throw std::runtime_error("Cannot program an image while a write is in progress.");
+    if (address > _data.size() || image.size() > _data.size() - address)
+        throw std::out_of_range("The image extends beyond the end of the chip.");
+    if (image.empty())
+        return;
+    if (_data.find_not(address, image.size(), std::byte{0xff}) != address + image.size())
+        throw std::runtime_error("Writing a non-erased byte.");
+    std::size_t offset    = address % page_size;
+    std::size_t num_pages = (offset + image.size() + page_size - 1) / page_size;
+
+    // Every page starts with the serial input where the last bit of the page before left it, so any range of pages
+    // can be encoded without waiting for the pages before it. The first range is encoded straight into the log on this
+    // thread. The others are encoded into storage of their own, since the memory resource of the log needn't be safe
+    // to use from several threads at once, then appended in order. Encoding a few pages costs less than starting a
+    // thread, so every thread gets at least 64 pages.
+    if (_recording == recording::full)
+    {
+        if (num_threads == 0)
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        num_threads = std::min(num_threads, (num_pages + 63) / 64);
+        std::vector<user_operation_log> pieces;
+        pieces.reserve(num_threads - 1);
+        for (std::size_t i = 1; i < num_threads; ++i)
+            pieces.emplace_back(std::pmr::new_delete_resource());
+        std::vector<std::exception_ptr> errors(num_threads);
+        auto                            encode = [&](std::size_t i) {
+            std::size_t first = num_pages * i / num_threads;
+            std::size_t begin = first == 0 ? 0 : first * page_size - offset;
+            std::size_t end   = std::min(image.size(), num_pages * (i + 1) / num_threads * page_size - offset);
+            bool        level = begin == 0 ? _io_input[0] == pin_state::high
+                                           : (image[begin - 1] & std::byte{1}) == std::byte{1};
+            try
+            {
+                user_operation_log& log = i == 0 ? _user_operations : pieces[i - 1];
+                encode_page_programs(log, image.subspan(begin, end - begin), address + begin, level);
+            }
+            catch (...)
+            {
+                errors[i] = std::current_exception();
+            }
+        };
+
+        // Whatever can't get a thread of its own is encoded on this one. Reserving up front means only starting a
+        // thread can fail in the loop, never growing the vector while earlier threads still need joining.
+        user_operation_log::cursor start = _user_operations.mark();
+        std::vector<std::thread>   threads;
+        threads.reserve(num_threads - 1);
+        for (std::size_t i = 1; i < num_threads; ++i)
+        {
+            try
+            {
+                threads.emplace_back(encode, i);
+            }
+            catch (const std::system_error&)
+            {
+                encode(i);
+            }
+        }
+        encode(0);
+        for (std::thread& t : threads)
+            t.join();
+        try
+        {
+            for (const std::exception_ptr& error : errors)
+            {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+            for (const user_operation_log& piece : pieces)
+                _user_operations.append(piece);
+        }
+        catch (...)
+        {
+            _user_operations.truncate(start);
+            throw;
+        }
+    }
+
+    // Every page takes the write enable opcode, the page program opcode, the address, and its data to clock in, then
+    // waits out the page program.
+    std::size_t address_bits = command_phases<traits>(flash_sim_command::page_program).address_bits;
+    _data.write(address, image);
+    mark_dirty(address, image.size());
+    count_written(image.size(), 0);
+    _elapsed += _timing.clock_period * ((16 + address_bits) * num_pages + 8 * image.size());
+    _elapsed += _timing.page_program * num_pages;
+    _write_complete = _elapsed;
+    _write_enabled  = false;
+    _io_input[0]    = (image.back() & std::byte{1}) == std::byte{1} ? pin_state::high : pin_state::low;
+    _last_operation = user_operation::wait_for_write_complete;
+    if constexpr (detail::collect_stats)
+    {
+        auto& write_enable_stats = _stats->totals.commands[*write_enable_opcode];
+        auto& page_program_stats = _stats->totals.commands[*page_program_opcode];
+        write_enable_stats.count += num_pages;
+        write_enable_stats.clocks += 8 * num_pages;
+        page_program_stats.count += num_pages;
+        page_program_stats.clocks += (8 + address_bits) * num_pages + 8 * image.size();
+    }
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::snapshot basic_flash_sim<traits>::take_snapshot()
+{
+    if (_chip_state != chip_state::deselected)
+        throw std::runtime_error("Cannot take a snapshot while the chip is selected.");
+    snapshot s;
+    s._data           = _data.take_snapshot();
+    s._write_enabled  = _write_enabled;
+    s._io_input       = _io_input;
+    s._io_output      = _io_output;
+    s._elapsed        = _elapsed;
+    s._write_complete = _write_complete;
+    s._last_operation = _last_operation;
+    s._log            = _user_operations.mark();
+    s._dirty          = _dirty;
+    s._mark           = _mark;
+    return s;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::restore(const snapshot& s)
+{
+    if (s._data.size() != _data.size())
+        throw std::invalid_argument("Snapshot is of a chip with a different size.");
+
+    // Nothing is recorded with recording off, so there is nothing to truncate.
+    if (_recording != recording::off)
+        _user_operations.truncate(s._log);
+    _data.restore(s._data);
+    restore_state(s);
+
+    // Only a snapshot taken since the last mark knows which pages differ from their contents at the mark. Bits past
+    // the last page are never looked at, so every page can be marked dirty a word at a time.
+    if (s._mark == _mark)
+        _dirty = s._dirty;
+    else
+        std::fill(std::begin(_dirty), std::end(_dirty), ~std::uint64_t{0});
+
+    // Which pages the restore changed isn't known, but most cached reads usually survive it, so rather than dropping
+    // them they are checked against the data the next time they are used.
+    for (auto& [key, read] : _read_cache)
+        read.verified = false;
+}
+
+template <typename traits>
+std::unique_ptr<basic_flash_sim<traits>> basic_flash_sim<traits>::fork()
+{
+    snapshot s    = take_snapshot();
+    auto     copy = std::make_unique<basic_flash_sim>(flash_store(s._data), _recording, _user_operations.resource());
+    copy->_timing          = _timing;
+    copy->_user_operations = _user_operations;
+    copy->_dirty           = _dirty;
+    copy->_mark            = _mark;
+    copy->set_read_cache_capacity(_read_cache_capacity);
+    copy->restore_state(s);
+    return copy;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::toggle_chip_enable()
+{
+    switch (_chip_state)
+    {
+    case chip_state::deselected:
+        record(user_operation::toggle_chip_enable);
+        _chip_state = chip_state::command;
+        _bit_index  = 8;
+        if constexpr (detail::collect_stats)
+        {
+            _stats->clocks   = 0;
+            _stats->selected = std::chrono::steady_clock::now();
+        }
+        break;
+
+    case chip_state::command:
+        throw std::runtime_error("Cannot toggle chip enable while chip is in command state.");
+
+    case chip_state::operation:
+        if (!_operation)
+            throw std::logic_error("In operation state without an operation.");
+        record(user_operation::toggle_chip_enable);
+        if (_address_clocks != 0)
+            throw std::runtime_error("Cannot toggle chip enable while command is reading address.");
+        _operation->toggle_chip_enable();
+        if constexpr (detail::collect_stats)
+        {
+            // Bucket by the bit width of the duration, so a nanosecond and anything shorter go in the first bucket.
+            auto        wall_time = std::chrono::steady_clock::now() - _stats->selected;
+            auto        ns        = std::max<std::int64_t>(wall_time / std::chrono::nanoseconds(1), 1);
+            std::size_t bucket    = std::bit_width(static_cast<std::uint64_t>(ns)) - 1;
+            auto&       command   = _stats->totals.commands[std::to_integer<std::size_t>(_instruction_register)];
+            command.clocks += _stats->clocks;
+            ++command.wall_time[std::min(bucket, command.wall_time.size() - 1)];
+        }
+        _operation = nullptr;
+        _operation_storage.template emplace<std::monostate>();
+        _instruction_register = std::byte{0};
+        _chip_state           = chip_state::deselected;
+        _driven_io            = 0;
+        break;
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::toggle_serial_input()
+{
+    switch (_chip_state)
+    {
+    case chip_state::deselected:
+        throw std::runtime_error("Cannot toggle serial input while chip is deselected.");
+
+    case chip_state::command:
+        [[fallthrough]];
+
+    case chip_state::operation:
+        if (_last_operation == user_operation::toggle_serial_input)
+            throw std::runtime_error("Cannot toggle serial input twice in a row.");
+        if ((_driven_io & 1) != 0)
+            throw std::runtime_error("Cannot toggle serial input while the chip is outputting data on it.");
+        record(user_operation::toggle_serial_input);
+        _io_input[0] = _io_input[0] == pin_state::high ? pin_state::low : pin_state::high;
+        break;
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::toggle_io(std::size_t io)
+{
+    if (io >= _io_input.size())
+        throw std::invalid_argument("There is no such IO pin.");
+    if (io == 0)
+        return toggle_serial_input();
+
+    switch (_chip_state)
+    {
+    case chip_state::deselected:
+        throw std::runtime_error("Cannot toggle IO pins while chip is deselected.");
+
+    case chip_state::command:
+        [[fallthrough]];
+
+    case chip_state::operation:
+        if (_last_operation == toggle_io_operation(io))
+            throw std::runtime_error("Cannot toggle an IO pin twice in a row.");
+        if ((_driven_io >> io & 1) != 0)
+            throw std::runtime_error("Cannot toggle an IO pin while the chip is outputting data on it.");
+        record(toggle_io_operation(io));
+        _io_input[io] = _io_input[io] == pin_state::high ? pin_state::low : pin_state::high;
+        break;
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::toggle_clock()
+{
+    switch (_chip_state)
+    {
+    case chip_state::deselected:
+        throw std::runtime_error("Cannot toggle serial input while chip is deselected.");
+
+    case chip_state::command:
+        record(user_operation::toggle_clock);
+        _instruction_register |= std::byte{sample_io(1)} << --_bit_index;
+        if (_bit_index == 0)
+            start_command();
+        break;
+
+    case chip_state::operation:
+        if (!_operation)
+            throw std::logic_error("In operation state without an operation.");
+        record(user_operation::toggle_clock);
+
+        // The address phase is the same for every command, so it is clocked in right here rather than by the operation.
+        if (_address_clocks != 0)
+        {
+            _address = _address << _address_io | sample_io(_address_io);
+            if (--_address_clocks == 0)
+                _operation->address_complete();
+        }
+        else
+            _operation->toggle_clock();
+        break;
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::wait_for_write_complete()
+{
+    record(user_operation::wait_for_write_complete);
+    _elapsed = std::max(_elapsed, _write_complete);
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::transfer(std::uint8_t                 opcode,
+                                       std::optional<std::uint32_t> address,
+                                       std::span<const std::byte>   tx,
+                                       std::span<std::byte>         rx)
+{
+    // Only reads that clock their data out over the serial-output pin, as transfer does, can be remembered.
+    const flash_sim_phases& phases    = phase_table<traits>[opcode];
+    bool                    cacheable = _read_cache_capacity != 0 && address && !rx.empty() && phases.address_bits == 24
+                     && phases.address_io == 1 && phases.data_in_io == 0 && phases.data_out_io == 1
+                     && *address + rx.size() <= _data.size();
+    if (!cacheable)
+        return flash::transfer(opcode, address, tx, rx);
+    read_key key{opcode, *address, rx.size()};
+    if (read_from_cache(key, tx, rx))
+        return;
+    ++_read_cache_stats.misses;
+
+    // The read records into a log of its own, which is then added to the end of the chip's log, so that the cache can
+    // keep a copy of just the operations of the read.
+    std::uint8_t       levels = sample_io(4);
+    user_operation_log operations(_user_operations.resource());
+    std::swap(operations, _user_operations);
+    try
+    {
+        flash::transfer(opcode, address, tx, rx);
+    }
+    catch (...)
+    {
+        std::swap(operations, _user_operations);
+        _user_operations.append(operations);
+        throw;
+    }
+    std::swap(operations, _user_operations);
+    _user_operations.append(operations);
+
+    // A read that doesn't return the data where it started, such as a fast read without its dummy byte, isn't kept.
+    if (_data.mismatch(*address, rx) != *address + rx.size())
+        return;
+    if (_read_cache.size() == _read_cache_capacity)
+        _read_cache.clear();
+    _read_cache.insert_or_assign(key,
+                                 cached_read{std::vector(std::begin(tx), std::end(tx)),
+                                             levels,
+                                             std::vector(std::begin(rx), std::end(rx)),
+                                             std::move(operations),
+                                             _io_input,
+                                             _io_output,
+                                             _last_operation,
+                                             true});
+}
+
+template <typename traits>
+bool basic_flash_sim<traits>::poll_write_complete()
+{
+    wait_for_write_complete();
+    return true;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::clock_in_bytes(std::span<const std::byte> data, std::size_t num_io)
+{
+    if (num_io != 1 && num_io != 2 && num_io != 4)
+        throw std::invalid_argument("Can only clock in data over 1, 2, or 4 IOs.");
+    while (!data.empty())
+    {
+        std::size_t consumed = 0;
+        if (_operation)
+            consumed = _address_clocks != 0 ? clock_in_address(data, num_io) : _operation->clock_in_bytes(data, num_io);
+        else if (_chip_state == chip_state::command && _bit_index == 8 && num_io == 1)
+        {
+            record_clock_in(data[0], num_io);
+            _instruction_register = data[0];
+            _bit_index            = 0;
+            start_command();
+            consumed = 1;
+        }
+
+        // Fall back to the bit-by-bit path for anything the operation can't take whole, so errors are raised exactly as
+        // they would have been otherwise.
+        if (consumed == 0)
+        {
+            flash::clock_in_bytes(data.first(1), num_io);
+            consumed = 1;
+        }
+        data = data.subspan(consumed);
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::clock_out_bytes(std::span<std::byte> data, std::size_t num_io)
+{
+    if (num_io != 1 && num_io != 2 && num_io != 4)
+        throw std::invalid_argument("Can only clock out data over 1, 2, or 4 IOs.");
+    while (!data.empty())
+    {
+        std::size_t produced = _operation && _address_clocks == 0 ? _operation->clock_out_bytes(data, num_io) : 0;
+        if (produced == 0)
+        {
+            flash::clock_out_bytes(data.first(1), num_io);
+            produced = 1;
+        }
+        data = data.subspan(produced);
+    }
+}
+
+template <typename traits>
+std::size_t basic_flash_sim<traits>::read_key_hash::operator()(const read_key& k) const noexcept
+{
+    return std::hash<std::uint64_t>()(std::uint64_t{k.address} << 8 | k.opcode) ^ k.num_bytes * 0x9e3779b97f4a7c15;
+}
+
+template <typename traits>
+bool basic_flash_sim<traits>::read_from_cache(const read_key&            key,
+                                              std::span<const std::byte> tx,
+                                              std::span<std::byte>       rx)
+{
+    auto it = _read_cache.find(key);
+    if (it == std::end(_read_cache))
+        return false;
+
+    // Anything that would make the read go differently, or fail, is left to actually performing it.
+    cached_read& read = it->second;
+    if (_chip_state != chip_state::deselected || write_in_progress() || read.levels_before != sample_io(4)
+        || !std::equal(std::begin(tx), std::end(tx), std::begin(read.tx), std::end(read.tx)))
+        return false;
+    if (!read.verified)
+    {
+        if (_data.mismatch(key.address, read.data) != key.address + read.data.size())
+        {
+            _read_cache.erase(it);
+            return false;
+        }
+        read.verified = true;
+    }
+
+    // The opcode and address bytes, the bytes clocked in, and the bytes read each take eight clock cycles.
+    std::copy(std::begin(read.data), std::end(read.data), std::begin(rx));
+    if (_recording == recording::full)
+        _user_operations.append(read.operations);
+    _elapsed += _timing.clock_period * (8 * (4 + tx.size() + rx.size()));
+    _io_input       = read.io_input;
+    _io_output      = read.io_output;
+    _last_operation = read.last_operation;
+    ++_read_cache_stats.hits;
+    return true;
+}
+
+template <typename traits>
+constexpr std::optional<std::uint8_t> basic_flash_sim<traits>::find_opcode(flash_sim_command command) noexcept
+{
+    for (std::size_t opcode = 0; opcode < 256; ++opcode)
+    {
+        if (traits::command(static_cast<std::uint8_t>(opcode)) == command)
+            return static_cast<std::uint8_t>(opcode);
+    }
+    return std::nullopt;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::encode_page_programs(user_operation_log&        log,
+                                                   std::span<const std::byte> image,
+                                                   std::uint32_t              address,
+                                                   bool                       level)
+{
+    // Every byte is clocked in over a single IO, just as record_clock_in records it, the address most significant
+    // byte first.
+    const auto        write_enable_opcode = std::byte{find_opcode(flash_sim_command::write_enable).value()};
+    const auto        page_program_opcode = std::byte{find_opcode(flash_sim_command::page_program).value()};
+    const std::size_t address_bytes       = command_phases<traits>(flash_sim_command::page_program).address_bits / 8;
+    while (!image.empty())
+    {
+        std::size_t count = std::min(image.size(), page_size - address % page_size);
+        log.push_back(user_operation::toggle_chip_enable);
+        log.push_clock_in(write_enable_opcode, level);
+        log.push_back(user_operation::toggle_chip_enable);
+        log.push_back(user_operation::toggle_chip_enable);
+        log.push_clock_in(page_program_opcode, level);
+        for (std::size_t i = address_bytes; i-- != 0;)
+            log.push_clock_in(std::byte(address >> 8 * i), level);
+        for (std::byte value : image.first(count))
+            log.push_clock_in(value, level);
+        log.push_back(user_operation::toggle_chip_enable);
+        log.push_back(user_operation::wait_for_write_complete);
+        address += static_cast<std::uint32_t>(count);
+        image = image.subspan(count);
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::restore_state(const snapshot& s) noexcept
+{
+    _operation = nullptr;
+    _operation_storage.template emplace<std::monostate>();
+    _chip_state           = chip_state::deselected;
+    _instruction_register = std::byte{0};
+    _bit_index            = 0;
+    _address              = 0;
+    _address_clocks       = 0;
+    _address_io           = 0;
+    _driven_io            = 0;
+    _write_enabled        = s._write_enabled;
+    _io_input             = s._io_input;
+    _io_output            = s._io_output;
+    _elapsed              = s._elapsed;
+    _write_complete       = s._write_complete;
+    _last_operation       = s._last_operation;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::start_command()
+{
+    operation_factory factory = _operation_table[std::to_integer<std::size_t>(_instruction_register)];
+    if (!factory)
+        throw std::out_of_range("Unknown opcode.");
+    auto command = traits::command(std::to_integer<std::uint8_t>(_instruction_register));
+    if (write_in_progress() && command != flash_sim_command::read_status)
+        throw std::runtime_error("Cannot start a command other than read status while a write is in progress.");
+    _operation = factory(*this);
+
+    // Everything the chip does from here on follows the phases of the command, starting with its address, if any.
+    const flash_sim_phases& phases = phase_table<traits>[std::to_integer<std::size_t>(_instruction_register)];
+    _address                       = 0;
+    _address_io                    = phases.address_io;
+    _address_clocks = phases.address_io != 0 ? static_cast<std::uint8_t>(phases.address_bits / phases.address_io) : 0;
+    _chip_state     = chip_state::operation;
+    if constexpr (detail::collect_stats)
+        ++_stats->totals.commands[std::to_integer<std::size_t>(_instruction_register)].count;
+}
+
+template <typename traits>
+std::size_t basic_flash_sim<traits>::clock_in_address(std::span<const std::byte> data, std::size_t num_io)
+{
+    if (num_io != _address_io || _address_clocks * _address_io % 8 != 0)
+        return 0;
+
+    std::size_t consumed = 0;
+    while (_address_clocks != 0 && consumed != data.size())
+    {
+        record_clock_in(data[consumed], num_io);
+        _address = _address << 8 | std::to_integer<std::uint32_t>(data[consumed++]);
+        _address_clocks -= static_cast<std::uint8_t>(8 / num_io);
+        if (_address_clocks == 0)
+            _operation->address_complete();
+    }
+    return consumed;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::record(user_operation op)
+{
+    _last_operation = op;
+    if (op == user_operation::toggle_clock)
+    {
+        _elapsed += _timing.clock_period;
+        if constexpr (detail::collect_stats)
+            ++_stats->clocks;
+    }
+    if (_recording == recording::full)
+        _user_operations.push_back(op);
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::start_write(std::chrono::nanoseconds duration) noexcept
+{
+    _write_complete = _elapsed + duration;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::mark_dirty(std::size_t address, std::size_t num_bytes) noexcept
+{
+    if (num_bytes == 0)
+        return;
+    for (std::size_t page = address / page_size, last = (address + num_bytes - 1) / page_size; page <= last; ++page)
+        _dirty[page / 64] |= std::uint64_t{1} << page % 64;
+
+    // Cached reads of anything that changed are dropped. A cached read covers the whole pages it touches, just like
+    // the dirty pages do.
+    if (_read_cache.empty())
+        return;
+    std::size_t first = address / page_size * page_size;
+    std::size_t end   = (address + num_bytes + page_size - 1) / page_size * page_size;
+    std::erase_if(_read_cache, [&](const auto& entry) {
+        const read_key& key = entry.first;
+        return key.address < end && key.address + key.num_bytes > first;
+    });
+}
+
+template <typename traits>
+std::uint64_t basic_flash_sim<traits>::next_mark() noexcept
+{
+    static std::atomic<std::uint64_t> marks{0};
+    return ++marks;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::count_written([[maybe_unused]] std::size_t programmed,
+                                            [[maybe_unused]] std::size_t erased) noexcept
+{
+    if constexpr (detail::collect_stats)
+    {
+        _stats->totals.bytes_programmed += programmed;
+        _stats->totals.bytes_erased += erased;
+    }
+}
+
+template <typename traits>
+typename basic_flash_sim<traits>::user_operation basic_flash_sim<traits>::toggle_io_operation(std::size_t io) noexcept
+{
+    if (io == 0)
+        return user_operation::toggle_serial_input;
+    return static_cast<user_operation>(static_cast<std::size_t>(user_operation::toggle_io1) + io - 1);
+}
+
+template <typename traits>
+std::uint8_t basic_flash_sim<traits>::sample_io(std::size_t num_io) const noexcept
+{
+    std::uint8_t value = 0;
+    for (std::size_t io = 0; io < num_io; ++io)
+        if (_io_input[io] == pin_state::high)
+            value |= std::uint8_t{1} << io;
+    return value;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::record_clock_in(std::byte value, std::size_t num_io)
+{
+    // Only the first toggle of the first cycle can follow a toggle made pin by pin, every later one follows a toggle of
+    // another IO or of the clock. It gets the same check as toggling that pin by hand.
+    for (std::size_t io = num_io; io-- != 0;)
+    {
+        pin_state level = (value >> (8 - num_io + io) & std::byte{1}) == std::byte{1} ? pin_state::high
+                                                                                      : pin_state::low;
+        if (level == _io_input[io])
+            continue;
+        if (_last_operation == toggle_io_operation(io))
+        {
+            throw std::runtime_error(io == 0 ? "Cannot toggle serial input twice in a row."
+                                             : "Cannot toggle an IO pin twice in a row.");
+        }
+        break;
+    }
+
+    // Without recording there is nothing to remember about the individual toggles, so just skip to where they end up.
+    if (_recording == recording::off)
+    {
+        for (std::size_t io = 0; io < num_io; ++io)
+            _io_input[io] = (value >> io & std::byte{1}) == std::byte{1} ? pin_state::high : pin_state::low;
+        _elapsed += _timing.clock_period * (8 / num_io);
+        _last_operation = user_operation::toggle_clock;
+        if constexpr (detail::collect_stats)
+            _stats->clocks += 8 / num_io;
+        return;
+    }
+
+    // Mirrors clock_in_data_io: every cycle sets the highest IO first, then toggles the clock.
+    for (std::size_t bit = 8; bit != 0; bit -= num_io)
+    {
+        for (std::size_t io = num_io; io-- != 0;)
+        {
+            pin_state level = (value >> (bit - num_io + io) & std::byte{1}) == std::byte{1} ? pin_state::high
+                                                                                            : pin_state::low;
+            if (level != _io_input[io])
+            {
+                record(toggle_io_operation(io));
+                _io_input[io] = level;
+            }
+        }
+        record(user_operation::toggle_clock);
+    }
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::record_clock_out(std::size_t num_io)
+{
+    if (_recording == recording::off)
+    {
+        _elapsed += _timing.clock_period * (8 / num_io);
+        _last_operation = user_operation::toggle_clock;
+        if constexpr (detail::collect_stats)
+            _stats->clocks += 8 / num_io;
+        return;
+    }
+    for (std::size_t cycle = 0; cycle < 8 / num_io; ++cycle)
+        record(user_operation::toggle_clock);
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::operation                                                                                           *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::operation::operation(basic_flash_sim& f)
+        : _flash(f)
+{
+}
+
+template <typename traits>
+std::size_t basic_flash_sim<traits>::operation::clock_in_bytes(std::span<const std::byte>, std::size_t)
+{
+    return 0;
+}
+
+template <typename traits>
+std::size_t basic_flash_sim<traits>::operation::clock_out_bytes(std::span<std::byte>, std::size_t)
+{
+    return 0;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::operation::address_complete()
+{
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::operation_with_address                                                                              *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::operation_with_address::operation_with_address(basic_flash_sim& f)
+        : operation(f)
+{
+}
+
+template <typename traits>
+std::uint32_t basic_flash_sim<traits>::operation_with_address::address() const
+{
+    if (!address_ready())
+        throw std::runtime_error("Requested address, but address is not ready yet.");
+    return this->_flash._address;
+}
+
+template <typename traits>
+bool basic_flash_sim<traits>::operation_with_address::address_ready() const noexcept
+{
+    return this->_flash._address_clocks == 0;
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::read_operation                                                                                      *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::read_operation::read_operation(basic_flash_sim& f, flash_sim_command command)
+        : operation_with_address(f)
+        , _current_address(0)
+        , _current_byte{0}
+        , _bit_index(0)
+        , _dummy_cycles(command_phases<traits>(command).dummy_cycles)
+        , _data_io(command_phases<traits>(command).data_out_io)
+{
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_operation::toggle_chip_enable()
+{
+    this->_flash._io_output.fill(pin_state::low);
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_operation::toggle_clock()
+{
+    if (_dummy_cycles != 0)
+    {
+        if (--_dummy_cycles == 0)
+            load();
+        return;
+    }
+
+    _bit_index -= _data_io;
+    if (_bit_index == 0)
+        advance(1);
+    else
+        present();
+}
+
+template <typename traits>
+std::size_t basic_flash_sim<traits>::read_operation::clock_out_bytes(std::span<std::byte> data, std::size_t num_io)
+{
+    if (_dummy_cycles != 0 || _bit_index != 8 || num_io != _data_io)
+        return 0;
+
+    // Copy in chunks, since the read wraps around at the end of the chip.
+    for (std::size_t produced = 0; produced != data.size();)
+    {
+        std::size_t count = std::min(data.size() - produced, this->_flash._data.size() - _current_address);
+        this->_flash._data.read(_current_address, data.subspan(produced, count));
+        _current_address = static_cast<std::uint32_t>((_current_address + count) % this->_flash._data.size());
+        produced += count;
+    }
+    for (std::size_t i = 0; i < data.size(); ++i)
+        this->_flash.record_clock_out(num_io);
+    load();
+    return data.size();
+}
+
+template <typename traits>
+std::size_t basic_flash_sim<traits>::read_operation::clock_in_bytes(std::span<const std::byte> data, std::size_t num_io)
+{
+    // Whatever is clocked in during a read is ignored, only the pins and the recorded operations change.
+    std::size_t consumed = 0;
+    while (_dummy_cycles >= 8 / num_io && consumed != data.size())
+    {
+        this->_flash.record_clock_in(data[consumed++], num_io);
+        _dummy_cycles -= static_cast<std::uint8_t>(8 / num_io);
+        if (_dummy_cycles == 0)
+            load();
+    }
+
+    // While data is being output the chip drives the data pins, so only single IO reads can take input at all.
+    if (consumed == data.size() || _dummy_cycles != 0 || _bit_index != 8 || _data_io != 1 || num_io != 1)
+        return consumed;
+
+    for (std::byte b : data.subspan(consumed))
+        this->_flash.record_clock_in(b, num_io);
+    advance(data.size() - consumed);
+    return data.size();
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_operation::address_complete()
+{
+    _current_address = this->address();
+    if (_dummy_cycles == 0)
+        load();
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_operation::load()
+{
+    // This will also throw std::out_of_range if our current address is beyond the capacity of the flash device.
+    _current_byte = this->_flash._data.read(_current_address);
+    _bit_index    = 8;
+    present();
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_operation::present() noexcept
+{
+    auto level = [this](int bit) {
+        return (_current_byte >> bit & std::byte{1}) == std::byte{1} ? pin_state::high : pin_state::low;
+    };
+
+    // A single IO read outputs on the serial-output pin, anything wider outputs the highest bit on the highest IO.
+    if (_data_io == 1)
+    {
+        this->_flash._io_output[1] = level(_bit_index - 1);
+        this->_flash._driven_io    = 0x2;
+        return;
+    }
+    for (int io = 0; io < _data_io; ++io)
+        this->_flash._io_output[io] = level(_bit_index - _data_io + io);
+    this->_flash._driven_io = static_cast<std::uint8_t>((1 << _data_io) - 1);
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_operation::advance(std::size_t num_bytes)
+{
+    if (num_bytes == 0)
+        return;
+    _current_address = static_cast<std::uint32_t>((_current_address + num_bytes) % this->_flash._data.size());
+    load();
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::fast_read_operation                                                                                 *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::fast_read_operation::fast_read_operation(basic_flash_sim& f)
+        : read_operation(f, flash_sim_command::fast_read)
+{
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::dual_output_read_operation                                                                          *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::dual_output_read_operation::dual_output_read_operation(basic_flash_sim& f)
+        : read_operation(f, flash_sim_command::dual_output_read)
+{
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::quad_output_read_operation                                                                          *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::quad_output_read_operation::quad_output_read_operation(basic_flash_sim& f)
+        : read_operation(f, flash_sim_command::quad_output_read)
+{
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::quad_io_read_operation                                                                              *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::quad_io_read_operation::quad_io_read_operation(basic_flash_sim& f)
+        : read_operation(f, flash_sim_command::quad_io_read)
+{
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::write_operation                                                                                     *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::write_operation::write_operation(basic_flash_sim& f, flash_sim_command command)
+        : operation_with_address(f)
+        , _write_buffer(f._page_buffer)
+        , _current_byte(std::begin(_write_buffer))
+        , _bit_index(8)
+        , _data_io(command_phases<traits>(command).data_in_io)
+{
+    if (!this->_flash._write_enabled)
+        throw std::runtime_error("Cannot write without write enabled.");
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::write_operation::toggle_chip_enable()
+{
+    // Only whole bytes that were clocked in get written, a partially clocked in byte is dropped.
+    std::span<const std::byte> data(std::begin(_write_buffer), _current_byte);
+    this->_flash._data.write(this->address(), data);
+    this->_flash._write_enabled = false;
+    this->_flash.mark_dirty(this->address(), data.size());
+    this->_flash.count_written(data.size(), 0);
+    this->_flash.start_write(this->_flash._timing.page_program);
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::write_operation::toggle_clock()
+{
+    if (_current_byte == _write_buffer.end())
+        throw std::runtime_error("Write buffer is full.");
+
+    // This will also throw std::out_of_range if our current address is beyond the capacity of the flash device.
+    auto byte_index = std::distance(std::begin(_write_buffer), _current_byte);
+    if (_bit_index == 8 && this->_flash._data.read(this->address() + byte_index) != std::byte{0xff})
+        throw std::runtime_error("Writing a non-erased byte.");
+
+    // The page buffer is reused between commands, so every byte starts out clear before its first bit is read.
+    if (_bit_index == 8)
+        *_current_byte = std::byte{0};
+    _bit_index -= _data_io;
+    *_current_byte |= std::byte{this->_flash.sample_io(_data_io)} << _bit_index;
+    if (_bit_index == 0)
+    {
+        ++_current_byte;
+        _bit_index = 8;
+    }
+}
+
+template <typename traits>
+std::size_t basic_flash_sim<traits>::write_operation::clock_in_bytes(std::span<const std::byte> data,
+                                                                     std::size_t                num_io)
+{
+    if (_bit_index != 8 || num_io != _data_io)
+        return 0;
+
+    // Only bytes that fit in the page buffer and land on erased bytes of the chip are taken, which is checked for all
+    // of them in one pass.
+    const flash_store& store      = this->_flash._data;
+    auto               byte_index = static_cast<std::size_t>(std::distance(std::begin(_write_buffer), _current_byte));
+    std::size_t        address    = this->address() + byte_index;
+    if (address >= store.size())
+        return 0;
+    std::size_t count = std::min({data.size(), _write_buffer.size() - byte_index, store.size() - address});
+    count             = store.find_not(address, count, std::byte{0xff}) - address;
+    for (std::byte value : data.first(count))
+        this->_flash.record_clock_in(value, num_io);
+    _current_byte = std::copy_n(std::begin(data), count, _current_byte);
+    return count;
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::quad_write_operation                                                                                *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::quad_write_operation::quad_write_operation(basic_flash_sim& f)
+        : write_operation(f, flash_sim_command::quad_page_program)
+{
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::write_enable_operation                                                                              *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::write_enable_operation::write_enable_operation(basic_flash_sim& f)
+        : operation(f)
+{
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::write_enable_operation::toggle_chip_enable()
+{
+    if (this->_flash._write_enabled)
+        throw std::runtime_error("Cannot write enable when already write enabled.");
+    this->_flash._write_enabled = true;
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::write_enable_operation::toggle_clock()
+{
+    throw std::runtime_error("Write enable does not require clock toggling.");
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::read_status_operation                                                                               *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::read_status_operation::read_status_operation(basic_flash_sim& f)
+        : operation(f)
+        , _status{0}
+        , _bit_index(0)
+{
+    load();
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_status_operation::toggle_chip_enable()
+{
+    this->_flash._io_output.fill(pin_state::low);
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_status_operation::toggle_clock()
+{
+    if (--_bit_index == 0)
+        load();
+    else
+        this->_flash._io_output[1] = (_status >> (_bit_index - 1) & std::byte{1}) == std::byte{1} ? pin_state::high
+                                                                                                  : pin_state::low;
+}
+
+template <typename traits>
+std::size_t basic_flash_sim<traits>::read_status_operation::clock_out_bytes(std::span<std::byte> data,
+                                                                            std::size_t          num_io)
+{
+    if (_bit_index != 8 || num_io != 1)
+        return 0;
+
+    // The status is latched at the start of every byte, and the clocks of each byte move time forward.
+    for (std::byte& b : data)
+    {
+        b = std::byte{this->_flash.get_status()};
+        this->_flash.record_clock_out(num_io);
+    }
+    load();
+    return data.size();
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::read_status_operation::load()
+{
+    _status                    = std::byte{this->_flash.get_status()};
+    _bit_index                 = 8;
+    this->_flash._io_output[1] = (_status >> 7 & std::byte{1}) == std::byte{1} ? pin_state::high : pin_state::low;
+    this->_flash._driven_io    = 0x2;
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::chip_erase_operation                                                                                *
+\**********************************************************************************************************************/
+
+template <typename traits>
+basic_flash_sim<traits>::chip_erase_operation::chip_erase_operation(basic_flash_sim& f)
+        : operation(f)
+{
+    if (!this->_flash._write_enabled)
+        throw std::runtime_error("Cannot chip erase without write enabled.");
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::chip_erase_operation::toggle_chip_enable()
+{
+    this->_flash._data.fill(std::byte{0xff});
+    this->_flash._write_enabled = false;
+    this->_flash.mark_dirty(0, this->_flash._data.size());
+    this->_flash.count_written(0, this->_flash._data.size());
+    this->_flash.start_write(this->_flash._timing.chip_erase);
+}
+
+template <typename traits>
+void basic_flash_sim<traits>::chip_erase_operation::toggle_clock()
+{
+    throw std::runtime_error("Chip erase does not require clock toggling.");
+}
+
+/**********************************************************************************************************************\
+* basic_flash_sim::block_erase_operation                                                                               *
+\**********************************************************************************************************************/
+
+template <typename traits>
+template <flash_sim_command command>
+basic_flash_sim<traits>::block_erase_operation<command>::block_erase_operation(basic_flash_sim& f)
+        : operation_with_address(f)
+{
+    if (!this->_flash._write_enabled)
+        throw std::runtime_error("Cannot erase without write enabled.");
+}
+
+template <typename traits>
+template <flash_sim_command command>
+void basic_flash_sim<traits>::block_erase_operation<command>::toggle_chip_enable()
+{
+    // The chip ignores the address bits within the block, so the whole aligned block is erased.
+    constexpr std::size_t sectors_per_block = block_size / flash_store::sector_size;
+    std::size_t           start             = this->address() / block_size * block_size;
+    this->_flash._data.fill_sectors(start / flash_store::sector_size, sectors_per_block, std::byte{0xff});
+    this->_flash._write_enabled = false;
+    this->_flash.mark_dirty(start, std::min(block_size, this->_flash._data.size() - start));
+    this->_flash.count_written(0, std::min(block_size, this->_flash._data.size() - start));
+    if constexpr (command == flash_sim_command::sector_erase)
+        this->_flash.start_write(this->_flash._timing.sector_erase);
+    else if constexpr (command == flash_sim_command::block_erase_32k)
+        this->_flash.start_write(this->_flash._timing.block_erase_32k);
+    else
+        this->_flash.start_write(this->_flash._timing.block_erase_64k);
+}
+
+template <typename traits>
+template <flash_sim_command command>
+void basic_flash_sim<traits>::block_erase_operation<command>::toggle_clock()
+{
+    throw std::runtime_error("Erase does not require clock toggling after the address.");
+}
+
+} // End namespace bedrock.
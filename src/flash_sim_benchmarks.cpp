@@ -0,0 +1,195 @@
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "flash_sim.hpp"
+#include "user_operation_log.hpp"
+
+namespace bedrock::benchmarks
+{
+
+namespace
+{
+
+/// The size of the default flash_sim chip, the largest size every benchmark goes up to.
+constexpr std::int64_t chip_size = 0x1000000;
+
+/// Gets the recording mode selected by a benchmark argument.
+flash_sim::recording recording_mode(std::int64_t arg)
+{
+    return arg != 0 ? flash_sim::recording::full : flash_sim::recording::off;
+}
+
+/// Reports the number of bits moved over the pins as a rate.
+void report_bits(benchmark::State& state, double bits_per_iteration)
+{
+    state.counters["bits/s"] = benchmark::Counter(bits_per_iteration, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+/// Clocks a whole page program in bit by bit with clock_in_data, moving on to the next page every iteration.
+void clock_in_data(benchmark::State& state)
+{
+    flash_sim f(chip_size, recording_mode(state.range(0)));
+    f.erase(flash::erase_size::chip);
+    auto          erased  = f.take_snapshot();
+    std::uint32_t address = 0;
+    for (auto _ : state)
+    {
+        // Starting over from the erased chip, rather than erasing it, also keeps the log from growing without bound.
+        if (address == 0)
+        {
+            state.PauseTiming();
+            f.restore(erased);
+            state.ResumeTiming();
+        }
+        f.write_enable();
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(std::uint8_t{0x02});
+        f.clock_in_data<24>(address);
+        for (std::size_t i = 0; i < flash::page_size; ++i)
+            f.clock_in_data<8>(static_cast<std::uint8_t>(i));
+        f.toggle_chip_enable();
+        address = (address + flash::page_size) % chip_size;
+    }
+    report_bits(state, (1 + 3 + 1 + flash::page_size) * 8);
+}
+BENCHMARK(clock_in_data)->ArgName("recording")->Arg(0)->Arg(1);
+
+/// Reads the given number of bytes out bit by bit with clock_out_data, in a single read command.
+void clock_out_data(benchmark::State& state)
+{
+    flash_sim f(chip_size, recording_mode(state.range(1)));
+    auto      start = f.take_snapshot();
+    for (auto _ : state)
+    {
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(std::uint8_t{0x03});
+        f.clock_in_data<24>(std::uint32_t{0});
+        for (std::int64_t i = 0; i < state.range(0); ++i)
+            benchmark::DoNotOptimize(f.clock_out_data<8, std::uint8_t>());
+        f.toggle_chip_enable();
+
+        // Recording every clock would otherwise grow the log without bound over many iterations.
+        state.PauseTiming();
+        f.restore(start);
+        state.ResumeTiming();
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+    report_bits(state, static_cast<double>(state.range(0) * 8));
+}
+BENCHMARK(clock_out_data)
+    ->ArgNames({"bytes", "recording"})
+    ->ArgsProduct({benchmark::CreateRange(flash::page_size, chip_size, 64), {0, 1}});
+
+/// Programs one page per iteration with flash::page_program, which moves the data phase a whole page at a time.
+void page_program(benchmark::State& state)
+{
+    flash_sim f(chip_size, recording_mode(state.range(0)));
+    f.erase(flash::erase_size::chip);
+    auto                   erased = f.take_snapshot();
+    std::vector<std::byte> page(flash::page_size, std::byte{0x5a});
+    std::uint32_t          address = 0;
+    for (auto _ : state)
+    {
+        if (address == 0)
+        {
+            state.PauseTiming();
+            f.restore(erased);
+            state.ResumeTiming();
+        }
+        f.page_program(address, page);
+        address = (address + flash::page_size) % chip_size;
+    }
+    state.SetBytesProcessed(state.iterations() * flash::page_size);
+}
+BENCHMARK(page_program)->ArgName("recording")->Arg(0)->Arg(1);
+
+/// Programs an image of the whole chip with program_image, recording the user operations on the given number of
+/// threads, where zero is one per hardware thread.
+void program_image(benchmark::State& state)
+{
+    flash_sim f(chip_size);
+    f.erase(flash::erase_size::chip);
+    auto                   erased = f.take_snapshot();
+    std::vector<std::byte> image(chip_size);
+    for (std::size_t i = 0; i < image.size(); ++i)
+        image[i] = std::byte(i * 13 + i / 256);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        f.restore(erased);
+        state.ResumeTiming();
+        f.program_image(image, 0, static_cast<std::size_t>(state.range(0)));
+    }
+    state.SetBytesProcessed(state.iterations() * chip_size);
+}
+BENCHMARK(program_image)->ArgName("threads")->Arg(1)->Arg(0)->Iterations(4)->Unit(benchmark::kMillisecond);
+
+/// Erases a whole chip of the given size after every page of it has been programmed.
+void chip_erase(benchmark::State& state)
+{
+    flash_sim              f(state.range(0), flash_sim::recording::off);
+    std::vector<std::byte> page(flash::page_size, std::byte{0x5a});
+    f.erase(flash::erase_size::chip);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (std::uint32_t address = 0; address < state.range(0); address += flash::page_size)
+            f.page_program(address, page);
+        state.ResumeTiming();
+        f.erase(flash::erase_size::chip);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(chip_erase)->ArgName("bytes")->RangeMultiplier(16)->Range(0x10000, chip_size)->Iterations(8);
+
+/// Compares a chip with every page programmed against an identical image.
+void diff(benchmark::State& state)
+{
+    flash_sim              f(chip_size, flash_sim::recording::off);
+    std::vector<std::byte> page(flash::page_size, std::byte{0x5a});
+    f.erase(flash::erase_size::chip);
+    for (std::uint32_t address = 0; address < chip_size; address += flash::page_size)
+        f.page_program(address, page);
+    std::vector<std::byte> image = f.get_data();
+    for (auto _ : state)
+        benchmark::DoNotOptimize(f.diff(image));
+    state.SetBytesProcessed(state.iterations() * chip_size);
+}
+BENCHMARK(diff)->Iterations(8);
+
+/// Dispatches a read status register command without reading anything, clocking its opcode in bit by bit.
+void opcode_dispatch(benchmark::State& state)
+{
+    flash_sim f(chip_size, flash_sim::recording::off);
+    for (auto _ : state)
+    {
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(std::uint8_t{0x05});
+        f.toggle_chip_enable();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(opcode_dispatch);
+
+/// Grows a log to the given number of operations, in the mix a page program of varied data produces.
+void user_operation_log_growth(benchmark::State& state)
+{
+    using op = flash::user_operation;
+    for (auto _ : state)
+    {
+        user_operation_log log;
+        for (std::int64_t i = 0; i < state.range(0); ++i)
+            log.push_back(i % 3 == 0 ? op::toggle_serial_input : op::toggle_clock);
+        benchmark::DoNotOptimize(log.storage_bytes());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(user_operation_log_growth)->ArgName("ops")->RangeMultiplier(16)->Range(0x1000, chip_size);
+
+} // End anonymous namespace.
+
+} // End namespace bedrock::benchmarks.
+
+BENCHMARK_MAIN();
@@ -0,0 +1,219 @@
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "flash_sim.hpp"
+
+namespace bedrock::fuzz
+{
+
+namespace
+{
+
+/// The size of the fuzzed chip. A small chip keeps restoring the snapshot between inputs cheap, while still having
+/// more than one sector and block to erase.
+constexpr std::size_t chip_size = 0x20000;
+
+/// The chip every input runs against, along with the erased state it is put back into before every input.
+struct target
+{
+    target()
+            : chip(chip_size, flash_sim::recording::off)
+            , erased()
+            , decodable()
+    {
+        chip.erase(flash::erase_size::chip);
+        erased = chip.take_snapshot();
+
+        // Bytes that aren't user operations are skipped, rather than throwing out the rest of the input.
+        for (int c = 0; c < 256; ++c)
+        {
+            try
+            {
+                chip.char_to_user_operation(static_cast<char>(c));
+                decodable[c] = true;
+            }
+            catch (const std::invalid_argument&)
+            {
+            }
+        }
+    }
+
+    /// Performs the user operations in an input until one of them is rejected. The chip only rejects misuse with
+    /// the exceptions it documents, so anything else escapes as a crash for the fuzzer to report.
+    void run(const std::uint8_t* data, std::size_t size)
+    {
+        chip.restore(erased);
+        try
+        {
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                if (decodable[data[i]])
+                    chip.perform_user_operation(chip.char_to_user_operation(static_cast<char>(data[i])));
+            }
+        }
+        catch (const std::runtime_error&)
+        {
+        }
+        catch (const std::invalid_argument&)
+        {
+        }
+        catch (const std::out_of_range&)
+        {
+        }
+    }
+
+    /// The chip.
+    flash_sim chip;
+
+    /// The chip right after being erased.
+    flash_sim::snapshot erased;
+
+    /// Which bytes char_to_user_operation decodes.
+    std::array<bool, 256> decodable;
+};
+
+/// Gets the target, made the first time it is needed.
+target& get_target()
+{
+    static target t;
+    return t;
+}
+
+} // End anonymous namespace.
+
+} // End namespace bedrock::fuzz.
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+    bedrock::fuzz::get_target().run(data, size);
+    return 0;
+}
+
+#ifndef BEDROCK_FLASH_LIBFUZZER
+
+namespace bedrock::fuzz
+{
+
+namespace
+{
+
+/// Reads every file named on the command line, and every file in every directory named, as an input.
+std::vector<std::string> read_corpus(const std::vector<std::filesystem::path>& paths)
+{
+    std::vector<std::string> corpus;
+    auto                     add = [&](const std::filesystem::path& p) {
+        std::ifstream in(p, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Cannot read " + p.string());
+        corpus.emplace_back(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+    for (const std::filesystem::path& path : paths)
+    {
+        if (!std::filesystem::is_directory(path))
+        {
+            add(path);
+            continue;
+        }
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(path))
+        {
+            if (entry.is_regular_file())
+                add(entry.path());
+        }
+    }
+    return corpus;
+}
+
+/// Makes inputs from recorded commands, for when there is no corpus: a page program, a read, and a sector erase, each
+/// followed by the same command cut off partway through.
+std::vector<std::string> seed_corpus()
+{
+    flash_sim f(chip_size);
+    f.erase(flash::erase_size::chip);
+    auto                   erased = f.take_snapshot();
+    std::vector<std::byte> page(flash::page_size, std::byte{0x5a});
+    std::vector<std::byte> out(16);
+    auto                   record = [&](auto command) {
+        f.restore(erased);
+        auto start = f.get_user_operations().size();
+        command();
+        std::string input;
+        for (auto it = std::next(std::begin(f.get_user_operations()), static_cast<std::ptrdiff_t>(start));
+             it != std::end(f.get_user_operations());
+             ++it)
+            input.push_back(f.user_operation_to_char(*it));
+        return input;
+    };
+
+    std::vector<std::string> corpus;
+    corpus.push_back(record([&] { f.page_program(0x100, page); }));
+    corpus.push_back(record([&] { f.read(0x100, out); }));
+    corpus.push_back(record([&] { f.erase(flash::erase_size::sector, 0x1000); }));
+    for (std::size_t i = 0, n = corpus.size(); i < n; ++i)
+        corpus.push_back(corpus[i].substr(0, corpus[i].size() / 2));
+    return corpus;
+}
+
+} // End anonymous namespace.
+
+} // End namespace bedrock::fuzz.
+
+/// Without libFuzzer, runs every input of a corpus over and over for a while, then reports how many inputs per second
+/// the target got through. Inputs are files, or directories of files, named on the command line, and a handful of
+/// recorded commands if none are. The number of seconds to run for can be given as -seconds=N.
+int main(int argc, char** argv)
+{
+    using namespace bedrock::fuzz;
+    try
+    {
+        double                             seconds = 5;
+        std::vector<std::filesystem::path> paths;
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg.rfind("-seconds=", 0) == 0)
+                seconds = std::stod(arg.substr(9));
+            else
+                paths.emplace_back(arg);
+        }
+        std::vector<std::string> corpus = paths.empty() ? seed_corpus() : read_corpus(paths);
+        if (corpus.empty())
+            throw std::runtime_error("The corpus is empty.");
+
+        using clock         = std::chrono::steady_clock;
+        std::uint64_t execs = 0;
+        std::uint64_t bytes = 0;
+        auto          start = clock::now();
+        auto          end   = start + std::chrono::duration<double>(seconds);
+        while (clock::now() < end)
+        {
+            for (const std::string& input : corpus)
+            {
+                LLVMFuzzerTestOneInput(reinterpret_cast<const std::uint8_t*>(input.data()), input.size());
+                bytes += input.size();
+            }
+            execs += corpus.size();
+        }
+        double elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        std::cout << corpus.size() << " inputs, " << execs << " execs in " << elapsed << " s, "
+                  << static_cast<std::uint64_t>(execs / elapsed) << " execs/s, "
+                  << static_cast<std::uint64_t>(bytes / elapsed) << " bytes/s\n";
+        return EXIT_SUCCESS;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << '\n';
+        return EXIT_FAILURE;
+    }
+}
+
+#endif
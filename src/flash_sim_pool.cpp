@@ -0,0 +1,199 @@
+#include "flash_sim_pool.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+namespace bedrock
+{
+
+/**********************************************************************************************************************\
+* flash_sim_pool::slot                                                                                                 *
+\**********************************************************************************************************************/
+
+flash_sim_pool::slot::slot(std::size_t num_bytes, flash_sim::recording mode)
+        : sim(num_bytes, mode)
+        , mutex()
+        , jobs()
+        , scheduled(false)
+{
+}
+
+/**********************************************************************************************************************\
+* flash_sim_pool                                                                                                       *
+\**********************************************************************************************************************/
+
+flash_sim_pool::flash_sim_pool(std::size_t          num_chips,
+                               std::size_t          num_bytes,
+                               std::size_t          num_threads,
+                               flash_sim::recording mode)
+        : _slots()
+        , _queues()
+        , _mutex()
+        , _work_available()
+        , _idle()
+        , _queued(0)
+        , _pending(0)
+        , _error()
+        , _stopping(false)
+        , _threads()
+{
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    _slots.reserve(num_chips);
+    for (std::size_t i = 0; i < num_chips; ++i)
+        _slots.push_back(std::make_unique<slot>(num_bytes, mode));
+    _queues.reserve(num_threads);
+    for (std::size_t i = 0; i < num_threads; ++i)
+        _queues.push_back(std::make_unique<worker_queue>());
+    _threads.reserve(num_threads);
+    for (std::size_t i = 0; i < num_threads; ++i)
+        _threads.emplace_back(&flash_sim_pool::work, this, i);
+}
+
+flash_sim_pool::~flash_sim_pool()
+{
+    {
+        std::unique_lock lock(_mutex);
+        _idle.wait(lock, [this] { return _pending == 0; });
+        _stopping = true;
+    }
+    _work_available.notify_all();
+    for (std::thread& t : _threads)
+        t.join();
+}
+
+std::size_t flash_sim_pool::size() const noexcept
+{
+    return _slots.size();
+}
+
+std::size_t flash_sim_pool::num_threads() const noexcept
+{
+    return _threads.size();
+}
+
+flash_sim& flash_sim_pool::chip(std::size_t index)
+{
+    return _slots.at(index)->sim;
+}
+
+void flash_sim_pool::submit(std::size_t index, job j)
+{
+    slot& s = *_slots.at(index);
+    {
+        std::lock_guard lock(_mutex);
+        ++_pending;
+    }
+
+    // A chip that is already scheduled picks the job up when its worker gets to it, otherwise it needs scheduling.
+    {
+        std::lock_guard lock(s.mutex);
+        s.jobs.push_back(std::move(j));
+        if (s.scheduled)
+            return;
+        s.scheduled = true;
+    }
+
+    // Chips are spread over the workers by index, and stealing evens out whatever imbalance that leaves.
+    worker_queue& q = *_queues[index % _queues.size()];
+    {
+        std::lock_guard lock(_mutex);
+        std::lock_guard queue_lock(q.mutex);
+        q.chips.push_back(index);
+        ++_queued;
+    }
+    _work_available.notify_one();
+}
+
+void flash_sim_pool::wait()
+{
+    std::unique_lock lock(_mutex);
+    _idle.wait(lock, [this] { return _pending == 0; });
+    if (_error)
+        std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+void flash_sim_pool::work(std::size_t worker)
+{
+    while (true)
+    {
+        std::size_t index = 0;
+        if (take(worker, index))
+        {
+            run(index);
+            continue;
+        }
+
+        std::unique_lock lock(_mutex);
+        _work_available.wait(lock, [this] { return _stopping || _queued != 0; });
+        if (_stopping)
+            return;
+    }
+}
+
+bool flash_sim_pool::take(std::size_t worker, std::size_t& index)
+{
+    // Work from the front of our own queue, and steal from the back of everyone else's.
+    for (std::size_t i = 0; i < _queues.size(); ++i)
+    {
+        worker_queue& q = *_queues[(worker + i) % _queues.size()];
+        {
+            std::lock_guard lock(q.mutex);
+            if (q.chips.empty())
+                continue;
+            if (i == 0)
+            {
+                index = q.chips.front();
+                q.chips.pop_front();
+            }
+            else
+            {
+                index = q.chips.back();
+                q.chips.pop_back();
+            }
+        }
+        std::lock_guard lock(_mutex);
+        --_queued;
+        return true;
+    }
+    return false;
+}
+
+void flash_sim_pool::run(std::size_t index)
+{
+    slot& s = *_slots[index];
+    while (true)
+    {
+        job j;
+        {
+            std::lock_guard lock(s.mutex);
+            if (s.jobs.empty())
+            {
+                s.scheduled = false;
+                return;
+            }
+            j = std::move(s.jobs.front());
+            s.jobs.pop_front();
+        }
+
+        std::exception_ptr error;
+        try
+        {
+            j(s.sim);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        std::lock_guard lock(_mutex);
+        if (error && !_error)
+            _error = error;
+        if (--_pending == 0)
+            _idle.notify_all();
+    }
+}
+
+} // End namespace bedrock.
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "flash_sim.hpp"
+
+namespace bedrock
+{
+
+/// Runs many simulated flash chips in parallel on a pool of worker threads.
+///
+/// Every chip has its own queue of jobs, which are run one after another in the order they were submitted, so a chip
+/// is only ever used by one thread at a time. Chips with jobs waiting are spread over per-worker queues, and an idle
+/// worker steals chips from the other workers' queues, so the work stays balanced even when some chips have far more
+/// to do than others.
+class flash_sim_pool
+{
+public:
+    /// A unit of work to run against a single chip, such as replaying a trace or performing a series of transfers.
+    using job = std::function<void(flash_sim&)>;
+
+    /// Makes a new pool of identical chips.
+    ///
+    /// \param num_chips The number of chips in the pool.
+    /// \param num_bytes The number of bytes each chip contains.
+    /// \param num_threads The number of worker threads. Zero means one per hardware thread.
+    /// \param mode Which user operations each chip records.
+    flash_sim_pool(std::size_t          num_chips,
+                   std::size_t          num_bytes,
+                   std::size_t          num_threads = 0,
+                   flash_sim::recording mode        = flash_sim::recording::full);
+
+    flash_sim_pool(const flash_sim_pool&) = delete;
+
+    flash_sim_pool& operator=(const flash_sim_pool&) = delete;
+
+    /// Finishes every job that was submitted, then stops the worker threads. Any error from a job is dropped.
+    ~flash_sim_pool();
+
+    /// The number of chips in the pool.
+    std::size_t size() const noexcept;
+
+    /// The number of worker threads.
+    std::size_t num_threads() const noexcept;
+
+    /// Accesses one of the chips. This must only be done while the chip has no jobs pending, such as after wait.
+    ///
+    /// \throws std::out_of_range if there is no such chip.
+    flash_sim& chip(std::size_t index);
+
+    /// Queues a job to run against one of the chips, after every job already queued for that chip.
+    ///
+    /// \throws std::out_of_range if there is no such chip.
+    void submit(std::size_t index, job j);
+
+    /// Waits for every job submitted so far to finish.
+    ///
+    /// \throws Whatever the first job to fail since the last wait threw. Every other job still runs.
+    void wait();
+
+private:
+    /// A chip along with the jobs waiting to run against it.
+    struct slot
+    {
+        /// Makes a new chip with no jobs.
+        slot(std::size_t num_bytes, flash_sim::recording mode);
+
+        /// The chip.
+        flash_sim sim;
+
+        /// Guards jobs and scheduled.
+        std::mutex mutex;
+
+        /// The jobs waiting to run, in order.
+        std::deque<job> jobs;
+
+        /// Whether or not the chip is in a worker's queue or being run by a worker.
+        bool scheduled;
+    };
+
+    /// The chips waiting to be run by a single worker.
+    struct worker_queue
+    {
+        /// Guards chips.
+        std::mutex mutex;
+
+        /// The indices of the chips, in the order they became ready.
+        std::deque<std::size_t> chips;
+    };
+
+    /// The body of every worker thread.
+    void work(std::size_t worker);
+
+    /// Takes a chip to run from a worker's own queue, or failing that steals one from another worker.
+    ///
+    /// \returns false if every queue was empty.
+    bool take(std::size_t worker, std::size_t& index);
+
+    /// Runs every job queued for a chip, until its queue is empty.
+    void run(std::size_t index);
+
+    /// The chips.
+    std::vector<std::unique_ptr<slot>> _slots;
+
+    /// The queue of every worker thread.
+    std::vector<std::unique_ptr<worker_queue>> _queues;
+
+    /// Guards _queued, _pending, _error, and _stopping.
+    std::mutex _mutex;
+
+    /// Signalled when a chip is added to a worker's queue, or when the pool is stopping.
+    std::condition_variable _work_available;
+
+    /// Signalled when the last pending job finishes.
+    std::condition_variable _idle;
+
+    /// The number of chips across every worker's queue.
+    std::size_t _queued;
+
+    /// The number of jobs submitted but not finished yet.
+    std::size_t _pending;
+
+    /// The error thrown by the first job to fail since the last wait.
+    std::exception_ptr _error;
+
+    /// Whether or not the worker threads should stop.
+    bool _stopping;
+
+    /// The worker threads.
+    std::vector<std::thread> _threads;
+};
+
+} // End namespace bedrock.
@@ -0,0 +1,98 @@
+#include <catch2/catch.hpp>
+
+#include <stdexcept>
+#include <vector>
+
+#include "flash_sim_pool.hpp"
+#include "replay.hpp"
+
+namespace bedrock::test
+{
+
+TEST_CASE("flash_sim_pool", "[flash_sim_pool]")
+{
+    // Chips start out with garbage, so every one is erased before anything is programmed.
+    auto erase = [](flash_sim& f) { f.erase(flash::erase_size::chip); };
+
+    // Programs a page of a pattern that depends on the chip, so every chip ends up different.
+    auto program = [](std::size_t chip, std::uint32_t address) {
+        return [chip, address](flash_sim& f) {
+            std::vector<std::byte> data(flash::page_size);
+            for (std::size_t i = 0; i < data.size(); ++i)
+                data[i] = std::byte(i * 3 + chip + address / flash::page_size);
+            f.page_program(address, data);
+        };
+    };
+
+    SECTION("jobs")
+    {
+        // The chips get very different amounts of work, so some of them end up stolen by other workers.
+        flash_sim_pool pool(16, 0x10000, 4);
+        REQUIRE(pool.size() == 16);
+        REQUIRE(pool.num_threads() == 4);
+        for (std::size_t chip = 0; chip < pool.size(); ++chip)
+        {
+            pool.submit(chip, erase);
+            for (std::uint32_t page = 0; page < chip * 4; ++page)
+                pool.submit(chip, program(chip, page * flash::page_size));
+        }
+        pool.wait();
+
+        for (std::size_t chip = 0; chip < pool.size(); ++chip)
+        {
+            flash_sim expected(0x10000);
+            erase(expected);
+            for (std::uint32_t page = 0; page < chip * 4; ++page)
+                program(chip, page * flash::page_size)(expected);
+            REQUIRE(pool.chip(chip).get_data() == expected.get_data());
+            REQUIRE(pool.chip(chip).get_user_operations().size() == expected.get_user_operations().size());
+        }
+        REQUIRE_THROWS_AS(pool.chip(16), std::out_of_range);
+        REQUIRE_THROWS_AS(pool.submit(16, program(0, 0)), std::out_of_range);
+    }
+
+    SECTION("replay")
+    {
+        // Every chip replays the same recorded session, twice over.
+        flash_sim recorded(0x10000);
+        erase(recorded);
+        for (std::uint32_t page = 0; page < 8; ++page)
+            program(0, page * flash::page_size)(recorded);
+        recorded.erase(flash::erase_size::sector, 0x0000);
+
+        flash_sim_pool pool(8, 0x10000, 3, flash_sim::recording::off);
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (std::size_t chip = 0; chip < pool.size(); ++chip)
+                pool.submit(chip, [&recorded](flash_sim& f) { replayer(f).replay(recorded.get_user_operations()); });
+            pool.wait();
+        }
+        for (std::size_t chip = 0; chip < pool.size(); ++chip)
+            REQUIRE(pool.chip(chip).get_data() == recorded.get_data());
+    }
+
+    SECTION("errors")
+    {
+        // A failing job doesn't stop the rest, and its error comes out of the next wait, only once.
+        flash_sim_pool pool(4, 0x1000, 2);
+        for (std::size_t chip = 0; chip < pool.size(); ++chip)
+        {
+            pool.submit(chip, erase);
+            if (chip == 2)
+                pool.submit(chip, [](flash_sim&) { throw std::runtime_error("Job failed."); });
+            pool.submit(chip, program(chip, 0));
+        }
+        REQUIRE_THROWS_AS(pool.wait(), std::runtime_error);
+        pool.wait();
+
+        for (std::size_t chip = 0; chip < pool.size(); ++chip)
+        {
+            flash_sim expected(0x1000);
+            erase(expected);
+            program(chip, 0)(expected);
+            REQUIRE(pool.chip(chip).get_data() == expected.get_data());
+        }
+    }
+}
+
+} // End namespace bedrock::test.
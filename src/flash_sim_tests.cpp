@@ -1,11 +1,69 @@
 #define CATCH_CONFIG_MAIN
 #include <catch2/catch.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <memory_resource>
+#include <numeric>
+#include <sstream>
+#include <utility>
+#include <vector>
+
 #include "flash_sim.hpp"
+#include "flash_sim.ipp"
 
 namespace bedrock::test
 {
 
+namespace
+{
+
+/// Runs a command made of just an opcode and, optionally, an address.
+void command(flash_sim& f, std::uint8_t opcode, int address = -1)
+{
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(opcode);
+    if (address >= 0)
+        f.clock_in_data<24>(static_cast<std::uint32_t>(address));
+    f.toggle_chip_enable();
+}
+
+/// Write enables the chip and then programs the given data at the given address.
+void page_program(flash_sim& f, std::uint32_t address, std::span<const std::byte> data)
+{
+    command(f, 0x06);
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x02);
+    f.clock_in_data<24>(address);
+    f.clock_in_bytes(data);
+    f.toggle_chip_enable();
+}
+
+/// A made-up chip with small pages, four address bytes, and only a few commands on opcodes of its own.
+struct small_page_traits
+{
+    static constexpr std::size_t page_size            = 16;
+    static constexpr std::size_t address_bits         = 32;
+    static constexpr std::size_t default_size         = 0x10000;
+    static constexpr std::size_t sector_erase_size    = 0x1000;
+    static constexpr std::size_t block_erase_32k_size = 0x8000;
+    static constexpr std::size_t block_erase_64k_size = 0x10000;
+
+    static constexpr flash_sim_command command(std::uint8_t opcode) noexcept
+    {
+        switch (opcode)
+        {
+        case 0x06: return flash_sim_command::write_enable;
+        case 0x12: return flash_sim_command::page_program;
+        case 0x13: return flash_sim_command::read;
+        case 0x21: return flash_sim_command::sector_erase;
+        default: return flash_sim_command::none;
+        }
+    }
+};
+
+} // End anonymous namespace.
+
 TEST_CASE("flash", "[flash]")
 {
     flash_sim f(4096);
@@ -19,4 +77,963 @@ TEST_CASE("flash", "[flash]")
     f.toggle_chip_enable();
 }
 
+TEST_CASE("flash recording", "[flash]")
+{
+    for (auto mode : {flash_sim::recording::off, flash_sim::recording::full})
+    {
+        flash_sim f(4096, mode);
+        REQUIRE(f.get_recording() == mode);
+
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(0x06);
+        f.toggle_chip_enable();
+
+        f.toggle_chip_enable();
+        f.toggle_serial_input();
+        REQUIRE_THROWS_AS(f.toggle_serial_input(), std::runtime_error);
+
+        if (mode == flash_sim::recording::off)
+            REQUIRE(f.get_user_operations().empty());
+        else
+            REQUIRE(f.get_user_operations().size() == 14);
+    }
+}
+
+TEST_CASE("flash clock_in_bytes", "[flash]")
+{
+    std::vector<std::byte> page(256);
+    for (std::size_t i = 0; i < page.size(); ++i)
+        page[i] = std::byte(i * 37);
+
+    // Program the same page once bit by bit through the base class and once through the byte-level override.
+    flash_sim per_bit(4096);
+    flash_sim per_byte(4096);
+    for (flash_sim* f : {&per_bit, &per_byte})
+    {
+        f->toggle_chip_enable();
+        f->clock_in_data<8>(0x06);
+        f->toggle_chip_enable();
+
+        f->toggle_chip_enable();
+        f->clock_in_data<8>(0x60);
+        f->toggle_chip_enable();
+
+        f->toggle_chip_enable();
+        f->clock_in_data<8>(0x06);
+        f->toggle_chip_enable();
+
+        f->toggle_chip_enable();
+        f->clock_in_data<8>(0x02);
+        f->clock_in_data<24>(0x100);
+        if (f == &per_bit)
+            f->flash::clock_in_bytes(page);
+        else
+            f->clock_in_bytes(page);
+        f->toggle_chip_enable();
+    }
+
+    REQUIRE(per_bit.get_data() == per_byte.get_data());
+    REQUIRE(std::equal(std::begin(page), std::end(page), std::begin(per_byte.get_data()) + 0x100));
+    REQUIRE(std::all_of(std::begin(per_byte.get_data()),
+                        std::begin(per_byte.get_data()) + 0x100,
+                        [](std::byte b) { return b == std::byte{0xff}; }));
+    REQUIRE(per_bit.get_serial_input() == per_byte.get_serial_input());
+    REQUIRE(per_bit.get_user_operations().size() == per_byte.get_user_operations().size());
+    REQUIRE(std::equal(std::begin(per_bit.get_user_operations()),
+                       std::end(per_bit.get_user_operations()),
+                       std::begin(per_byte.get_user_operations())));
+}
+
+TEST_CASE("flash clock_in_bytes errors", "[flash]")
+{
+    // Overrunning the page buffer is reported the same way by the byte-level path as by the bit-by-bit path.
+    std::vector<std::byte> too_much(257, std::byte{0x5a});
+    flash_sim              f(4096);
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x60);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x02);
+    f.clock_in_data<24>(0);
+    REQUIRE_THROWS_AS(f.clock_in_bytes(too_much), std::runtime_error);
+}
+
+TEST_CASE("flash clock_in_bytes after a toggle", "[flash]")
+{
+    // A byte that toggles the serial input again straight after it was toggled by hand is rejected by both paths.
+    const std::byte write_enable[]{std::byte{0x06}};
+    for (bool bytes : {false, true})
+    {
+        flash_sim f(4096);
+        f.toggle_chip_enable();
+        f.toggle_serial_input();
+        if (bytes)
+            REQUIRE_THROWS_AS(f.clock_in_bytes(write_enable), std::runtime_error);
+        else
+            REQUIRE_THROWS_AS(f.flash::clock_in_bytes(write_enable), std::runtime_error);
+    }
+
+    // One that starts at the level the serial input was toggled to is fine.
+    const std::byte sector_erase[]{std::byte{0xd7}, std::byte{0}, std::byte{0}, std::byte{0}};
+    flash_sim       f(4096);
+    f.toggle_chip_enable();
+    f.clock_in_bytes(write_enable);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.toggle_serial_input();
+    f.clock_in_bytes(sector_erase);
+    f.toggle_chip_enable();
+    REQUIRE(f.get_status() == 0);
+}
+
+TEST_CASE("flash unknown opcode", "[flash]")
+{
+    flash_sim f(4096);
+    f.toggle_chip_enable();
+    REQUIRE_THROWS_AS(f.clock_in_data<8>(0xa5), std::out_of_range);
+    REQUIRE(f.get_chip_state() == flash_sim::chip_state::command);
+}
+
+TEST_CASE("flash page buffer reuse", "[flash]")
+{
+    flash_sim f(4096);
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x60);
+    f.toggle_chip_enable();
+
+    // A full page, followed by a short page program bit by bit, which must not pick up stale bits from the first.
+    std::vector<std::byte> full(flash_sim::page_size, std::byte{0xf0});
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x02);
+    f.clock_in_data<24>(0);
+    f.clock_in_bytes(full);
+    f.toggle_chip_enable();
+
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x02);
+    f.clock_in_data<24>(flash_sim::page_size);
+    f.clock_in_data<8>(0x0f);
+    f.clock_in_data<8>(0x01);
+    f.toggle_chip_enable();
+
+    const auto& data = f.get_data();
+    REQUIRE(std::all_of(std::begin(data), std::begin(data) + 256, [](std::byte b) { return b == std::byte{0xf0}; }));
+    REQUIRE(data[256] == std::byte{0x0f});
+    REQUIRE(data[257] == std::byte{0x01});
+    REQUIRE(std::all_of(std::begin(data) + 258, std::end(data), [](std::byte b) { return b == std::byte{0xff}; }));
+}
+
+TEST_CASE("flash sparse data", "[flash]")
+{
+    // A default sized chip starts out without any sector storage, and a page program only materializes one sector.
+    flash_sim f;
+    REQUIRE(f.get_store().num_materialized_sectors() == 0);
+
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x60);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x02);
+    f.clock_in_data<24>(0x123456);
+    f.clock_in_data<8>(0x42);
+    f.toggle_chip_enable();
+
+    REQUIRE(f.get_store().num_materialized_sectors() == 1);
+    REQUIRE(f.get_data().size() == 0xffffff);
+    REQUIRE(f.get_data()[0x123456] == std::byte{0x42});
+}
+
+TEST_CASE("flash sector and block erase", "[flash]")
+{
+    flash_sim f(0x20000);
+    command(f, 0x06);
+    command(f, 0x60);
+
+    std::vector<std::byte> page(flash_sim::page_size, std::byte{0x00});
+    for (std::uint32_t address = 0; address < 0x20000; address += 0x1000)
+        page_program(f, address, page);
+    REQUIRE(f.get_store().num_materialized_sectors() == 32);
+
+    auto erased = [&f](std::size_t begin, std::size_t end) {
+        const auto& data = f.get_data();
+        return std::all_of(
+            std::begin(data) + begin, std::begin(data) + end, [](std::byte b) { return b == std::byte{0xff}; });
+    };
+
+    // Sector erase, through both opcodes, with an address in the middle of the sector.
+    command(f, 0x06);
+    command(f, 0x20, 0x1234);
+    command(f, 0x06);
+    command(f, 0xd7, 0x2000);
+    REQUIRE(erased(0x1000, 0x3000));
+    REQUIRE(f.get_data()[0x0000] == std::byte{0x00});
+    REQUIRE(f.get_data()[0x3000] == std::byte{0x00});
+    REQUIRE(!f.get_store().sector_dirty(1));
+    REQUIRE(f.get_store().sector_dirty(3));
+
+    // 32K and 64K block erase.
+    command(f, 0x06);
+    command(f, 0x52, 0x8fff);
+    REQUIRE(erased(0x8000, 0x10000));
+    REQUIRE(f.get_data()[0x7000] == std::byte{0x00});
+    command(f, 0x06);
+    command(f, 0xd8, 0x10000);
+    REQUIRE(erased(0x10000, 0x20000));
+    REQUIRE(f.get_store().num_materialized_sectors() == 6);
+
+    // An erased sector can be programmed again.
+    page_program(f, 0x1000, page);
+    REQUIRE(f.get_data()[0x1000] == std::byte{0x00});
+
+    // Erasing requires an address within the chip, and write enable.
+    command(f, 0x06);
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x20);
+    f.clock_in_data<24>(0x20000);
+    REQUIRE_THROWS_AS(f.toggle_chip_enable(), std::out_of_range);
+
+    flash_sim not_enabled(0x20000);
+    not_enabled.toggle_chip_enable();
+    REQUIRE_THROWS_AS(not_enabled.clock_in_data<8>(0x20), std::runtime_error);
+}
+
+TEST_CASE("flash read", "[flash]")
+{
+    flash_sim f(0x2000);
+    command(f, 0x06);
+    command(f, 0x60);
+    std::vector<std::byte> page(flash_sim::page_size);
+    for (std::uint32_t address = 0; address < 0x2000; address += flash_sim::page_size)
+    {
+        for (std::size_t i = 0; i < page.size(); ++i)
+            page[i] = std::byte(address / flash_sim::page_size * 7 + i);
+        page_program(f, address, page);
+    }
+    const std::vector<std::byte> expected = f.get_data();
+
+    // Reads a number of bytes starting at an address, either bit by bit or a byte at a time.
+    auto read = [&f](std::uint8_t opcode, std::uint32_t address, std::size_t num_bytes, bool per_bit) {
+        std::vector<std::byte> result(num_bytes);
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(opcode);
+        f.clock_in_data<24>(address);
+        if (opcode == 0x0b)
+            f.clock_in_data<8>(0);
+        if (per_bit)
+            f.flash::clock_out_bytes(result);
+        else
+            f.clock_out_bytes(result);
+        f.toggle_chip_enable();
+        return result;
+    };
+
+    for (std::uint8_t opcode : {0x03, 0x0b})
+    {
+        // Continuous reads run across page boundaries, and wrap around at the end of the chip.
+        for (std::uint32_t address : {0x0000, 0x00f0, 0x1ff0})
+        {
+            auto per_bit_ops  = f.get_user_operations().size();
+            auto per_bit      = read(opcode, address, 0x300, true);
+            per_bit_ops       = f.get_user_operations().size() - per_bit_ops;
+            auto per_byte_ops = f.get_user_operations().size();
+            auto per_byte     = read(opcode, address, 0x300, false);
+            per_byte_ops      = f.get_user_operations().size() - per_byte_ops;
+
+            REQUIRE(per_bit == per_byte);
+            REQUIRE(per_bit_ops == per_byte_ops);
+            for (std::size_t i = 0; i < per_bit.size(); ++i)
+                REQUIRE(per_bit[i] == expected[(address + i) % expected.size()]);
+        }
+    }
+
+    // A read from beyond the end of the chip fails as soon as the address is complete.
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x03);
+    REQUIRE_THROWS_AS(f.clock_in_data<24>(0x2000), std::out_of_range);
+}
+
+TEST_CASE("flash timing", "[flash]")
+{
+    using namespace std::chrono_literals;
+
+    flash_sim f(0x2000);
+    REQUIRE(f.elapsed() == 0ns);
+    command(f, 0x06);
+    REQUIRE(f.get_status() == flash_sim::status_write_enable_latch);
+    command(f, 0x60);
+    REQUIRE_FALSE(f.write_in_progress());
+
+    flash_sim::timing timing;
+    timing.clock_period = 10ns;
+    timing.page_program = 10us;
+    f.set_timing(timing);
+
+    // Only clock toggles take time, 8 for the opcodes, 24 for the address, and 8 per byte programmed.
+    std::vector<std::byte> data(16, std::byte{0x5a});
+    page_program(f, 0, data);
+    REQUIRE(f.elapsed() == 10ns * (8 + 8 + 24 + 8 * data.size()));
+    REQUIRE(f.write_in_progress());
+
+    // Nothing but read status is accepted until the program completes.
+    flash_sim g(0x2000);
+    g.set_timing(timing);
+    command(g, 0x06);
+    command(g, 0x60);
+    page_program(g, 0, data);
+    g.toggle_chip_enable();
+    REQUIRE_THROWS_AS(g.clock_in_data<8>(0x03), std::runtime_error);
+
+    // Polling the status register bit by bit and a byte at a time sees the same statuses at the same times.
+    auto poll = [&timing](bool per_bit) {
+        flash_sim p(0x2000);
+        p.set_timing(timing);
+        command(p, 0x06);
+        command(p, 0x60);
+        page_program(p, 0, std::vector<std::byte>(16, std::byte{0x5a}));
+        std::vector<std::byte> statuses(200);
+        p.toggle_chip_enable();
+        p.clock_in_data<8>(0x05);
+        if (per_bit)
+            p.flash::clock_out_bytes(statuses);
+        else
+            p.clock_out_bytes(statuses);
+        p.toggle_chip_enable();
+        return std::pair(statuses, p.elapsed());
+    };
+    auto [per_bit, per_bit_elapsed]   = poll(true);
+    auto [per_byte, per_byte_elapsed] = poll(false);
+    REQUIRE(per_bit == per_byte);
+    REQUIRE(per_bit_elapsed == per_byte_elapsed);
+    REQUIRE(per_bit.front() == std::byte{flash_sim::status_write_in_progress});
+    REQUIRE(per_bit.back() == std::byte{0});
+
+    // Waiting moves time forward to when the write completes, and is recorded.
+    auto before = f.elapsed();
+    f.wait_for_write_complete();
+    REQUIRE(f.elapsed() == before + 10us);
+    REQUIRE_FALSE(f.write_in_progress());
+    REQUIRE(f.get_user_operations().back() == flash::user_operation::wait_for_write_complete);
+    f.wait_for_write_complete();
+    REQUIRE(f.elapsed() == before + 10us);
+}
+
+TEST_CASE("flash transfer", "[flash]")
+{
+    std::vector<std::byte> data(100);
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = std::byte(i * 3 + 1);
+
+    // The same commands, once with the helpers and once pin by pin.
+    flash_sim helpers(0x2000);
+    helpers.erase(flash::erase_size::chip);
+    helpers.page_program(0x1010, data);
+    helpers.erase(flash::erase_size::sector, 0x0100);
+    std::vector<std::byte> out(0x20);
+    helpers.read(0x1000, out);
+
+    flash_sim pins(0x2000);
+    command(pins, 0x06);
+    command(pins, 0x60);
+    pins.wait_for_write_complete();
+    page_program(pins, 0x1010, data);
+    pins.wait_for_write_complete();
+    command(pins, 0x06);
+    command(pins, 0x20, 0x0100);
+    pins.wait_for_write_complete();
+    pins.toggle_chip_enable();
+    pins.clock_in_data<8>(0x03);
+    pins.clock_in_data<24>(0x1000);
+    for (int i = 0; i < 0x20; ++i)
+        pins.clock_out_data<8, std::uint8_t>();
+    pins.toggle_chip_enable();
+
+    REQUIRE(helpers.get_data() == pins.get_data());
+    REQUIRE(std::equal(std::begin(helpers.get_user_operations()),
+                       std::end(helpers.get_user_operations()),
+                       std::begin(pins.get_user_operations()),
+                       std::end(pins.get_user_operations())));
+    REQUIRE(std::all_of(std::begin(out), std::begin(out) + 0x10, [](std::byte b) { return b == std::byte{0xff}; }));
+    REQUIRE(std::equal(std::begin(out) + 0x10, std::end(out), std::begin(data)));
+
+    // A fast read clocks its dummy byte in as tx.
+    std::vector<std::byte> dummy(1);
+    std::vector<std::byte> fast(data.size());
+    helpers.transfer(0x0b, 0x1010, dummy, fast);
+    REQUIRE(fast == data);
+    REQUIRE_THROWS_AS(helpers.transfer(0x9f, std::nullopt, {}, {}), std::out_of_range);
+}
+
+TEST_CASE("flash batches", "[flash]")
+{
+    std::vector<std::byte> image(600);
+    for (std::size_t i = 0; i < image.size(); ++i)
+        image[i] = std::byte(i * 5 + 3);
+
+    // A program spanning several pages, and two adjacent programs within a page, which get combined.
+    flash_sim                   batched(0x2000);
+    std::vector<flash::request> batch{flash::request::erase(flash::erase_size::chip),
+                                      flash::request::program(0x0010, image),
+                                      flash::request::program(0x1000, std::span(image).first(50)),
+                                      flash::request::program(0x1032, std::span(image).subspan(50, 50)),
+                                      flash::request::erase(flash::erase_size::sector, 0x1000),
+                                      flash::request::program(0x1100, std::span(image).first(10))};
+    flash::ticket               t = batched.submit(batch);
+    REQUIRE(batched.poll(t));
+    batched.wait(t);
+    REQUIRE_THROWS_AS(batched.wait(t + 1), std::invalid_argument);
+
+    flash_sim one_by_one(0x2000);
+    one_by_one.erase(flash::erase_size::chip);
+    one_by_one.page_program(0x0010, std::span(image).first(0xf0));
+    one_by_one.page_program(0x0100, std::span(image).subspan(0xf0, 0x100));
+    one_by_one.page_program(0x0200, std::span(image).subspan(0x1f0, 600 - 0x1f0));
+    one_by_one.page_program(0x1000, std::span(image).first(100));
+    one_by_one.erase(flash::erase_size::sector, 0x1000);
+    one_by_one.page_program(0x1100, std::span(image).first(10));
+
+    REQUIRE(batched.get_data() == one_by_one.get_data());
+    REQUIRE(std::equal(std::begin(batched.get_user_operations()),
+                       std::end(batched.get_user_operations()),
+                       std::begin(one_by_one.get_user_operations()),
+                       std::end(one_by_one.get_user_operations())));
+}
+
+TEST_CASE("flash dual and quad IO", "[flash]")
+{
+    flash_sim f(0x2000);
+    command(f, 0x06);
+    command(f, 0x60);
+
+    // Quad page program moves the same data as a regular page program with a quarter of the clocks.
+    std::vector<std::byte> page(flash_sim::page_size);
+    for (std::size_t i = 0; i < page.size(); ++i)
+        page[i] = std::byte(i * 13 + 5);
+    for (std::uint32_t address : {0x0000, 0x1f00})
+    {
+        command(f, 0x06);
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(0x32);
+        f.clock_in_data<24>(address);
+        if (address == 0)
+            f.flash::clock_in_bytes(page, 4);
+        else
+            f.clock_in_bytes(page, 4);
+        f.toggle_chip_enable();
+    }
+    const std::vector<std::byte> expected = f.get_data();
+    REQUIRE(std::equal(std::begin(page), std::end(page), std::begin(expected)));
+    REQUIRE(std::equal(std::begin(page), std::end(page), std::begin(expected) + 0x1f00));
+
+    // Reads a number of bytes starting at an address, either bit by bit or a byte at a time.
+    auto read = [&f](std::uint8_t opcode, std::uint32_t address, std::size_t num_bytes, bool per_bit) {
+        std::size_t            num_io = opcode == 0x3b ? 2 : 4;
+        std::vector<std::byte> result(num_bytes);
+        std::vector<std::byte> address_bytes{std::byte(address >> 16), std::byte(address >> 8), std::byte(address)};
+        std::vector<std::byte> dummy_bytes(opcode == 0xeb ? 3 : 1);
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(opcode);
+        if (per_bit)
+        {
+            f.flash::clock_in_bytes(address_bytes, opcode == 0xeb ? 4 : 1);
+            f.flash::clock_in_bytes(dummy_bytes, opcode == 0xeb ? 4 : 1);
+            f.flash::clock_out_bytes(result, num_io);
+        }
+        else
+        {
+            f.clock_in_bytes(address_bytes, opcode == 0xeb ? 4 : 1);
+            f.clock_in_bytes(dummy_bytes, opcode == 0xeb ? 4 : 1);
+            f.clock_out_bytes(result, num_io);
+        }
+        f.toggle_chip_enable();
+        return result;
+    };
+
+    for (std::uint8_t opcode : {0x3b, 0x6b, 0xeb})
+    {
+        // The pins are left however the previous command left them, so start both reads from the same levels.
+        read(opcode, 0x1ff0, 1, false);
+
+        auto per_bit_ops  = f.get_user_operations().size();
+        auto per_bit      = read(opcode, 0x1ff0, 0x40, true);
+        per_bit_ops       = f.get_user_operations().size() - per_bit_ops;
+        auto per_byte_ops = f.get_user_operations().size();
+        auto per_byte     = read(opcode, 0x1ff0, 0x40, false);
+        per_byte_ops      = f.get_user_operations().size() - per_byte_ops;
+
+        REQUIRE(per_bit == per_byte);
+        REQUIRE(per_bit_ops == per_byte_ops);
+        for (std::size_t i = 0; i < per_bit.size(); ++i)
+            REQUIRE(per_bit[i] == expected[(0x1ff0 + i) % expected.size()]);
+    }
+
+    // The chip drives the data pins while outputting data, and there are only four IO pins.
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x6b);
+    f.clock_in_data<32>(0);
+    REQUIRE_THROWS_AS(f.toggle_io(2), std::runtime_error);
+    REQUIRE_THROWS_AS(f.toggle_io(4), std::invalid_argument);
+    REQUIRE(f.get_io(4) == flash::pin_state::low);
+}
+
+TEST_CASE("flash snapshots", "[flash]")
+{
+    flash_sim f(0x10000);
+    command(f, 0x06);
+    command(f, 0x60);
+    std::vector<std::byte> data(16, std::byte{0x5a});
+    page_program(f, 0x1000, data);
+    command(f, 0x06);
+    auto snapshot = f.take_snapshot();
+    auto expected = f.get_data();
+    auto num_ops  = f.get_user_operations().size();
+    auto last_op  = f.get_user_operations().back();
+    auto elapsed  = f.elapsed();
+
+    // Abandoning a command partway through, in a sector the snapshot shares, is undone, including the write enable.
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x02);
+    f.clock_in_data<24>(0x1010);
+    f.clock_in_bytes(data);
+    f.toggle_chip_enable();
+    page_program(f, 0x8000, data);
+    f.toggle_chip_enable();
+    REQUIRE_THROWS_AS(f.take_snapshot(), std::runtime_error);
+    f.restore(snapshot);
+    REQUIRE(f.get_chip_state() == flash_sim::chip_state::deselected);
+    REQUIRE(f.get_data() == expected);
+    REQUIRE(f.get_status() == flash_sim::status_write_enable_latch);
+    REQUIRE(f.get_user_operations().size() == num_ops);
+    REQUIRE(f.get_user_operations().back() == last_op);
+    REQUIRE(f.elapsed() == elapsed);
+
+    // The restored chip carries on exactly like a chip that never left the snapshot.
+    auto forked = f.fork();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x02);
+    f.clock_in_data<24>(0x2000);
+    f.clock_in_bytes(data);
+    f.toggle_chip_enable();
+    forked->toggle_chip_enable();
+    forked->clock_in_data<8>(0x02);
+    forked->clock_in_data<24>(0x2000);
+    forked->clock_in_bytes(data);
+    forked->toggle_chip_enable();
+    REQUIRE(forked->get_data() == f.get_data());
+    REQUIRE(std::equal(forked->get_user_operations().begin(),
+                       forked->get_user_operations().end(),
+                       f.get_user_operations().begin(),
+                       f.get_user_operations().end()));
+
+    // Snapshots of the original can be restored into the fork.
+    forked->restore(snapshot);
+    REQUIRE(forked->get_data() == expected);
+    flash_sim other(0x1000);
+    REQUIRE_THROWS_AS(other.restore(snapshot), std::invalid_argument);
+}
+
+TEST_CASE("flash stats", "[flash]")
+{
+    flash_sim f(0x10000);
+    command(f, 0x06);
+    command(f, 0x20, 0x1000);
+    std::vector<std::byte> data(16, std::byte{0x5a});
+    page_program(f, 0x1000, data);
+    std::vector<std::byte> out(8);
+    f.read(0x1000, out);
+
+    std::ostringstream json;
+    flash_sim::stats   s = f.get_stats();
+    s.write_json(json);
+    if (!flash_sim::stats_enabled())
+    {
+        REQUIRE(s.commands[0x06].count == 0);
+        REQUIRE(s.log_bytes == 0);
+        REQUIRE(json.str() == "{\"commands\":{},\"bytes_programmed\":0,\"bytes_erased\":0,\"log_bytes\":0}");
+        return;
+    }
+
+    REQUIRE(s.commands[0x06].count == 2);
+    REQUIRE(s.commands[0x06].clocks == 16);
+    REQUIRE(s.commands[0x20].count == 1);
+    REQUIRE(s.commands[0x20].clocks == 32);
+    REQUIRE(s.commands[0x02].clocks == 32 + 16 * 8);
+    REQUIRE(s.commands[0x03].clocks == 32 + 8 * 8);
+    REQUIRE(std::accumulate(std::begin(s.commands[0x02].wall_time), std::end(s.commands[0x02].wall_time), 0u) == 1);
+    REQUIRE(s.bytes_programmed == 16);
+    REQUIRE(s.bytes_erased == flash_store::sector_size);
+    REQUIRE(s.log_bytes == f.get_user_operations().storage_bytes());
+    REQUIRE(json.str().find("\"0x20\":{\"count\":1,\"clocks\":32,") != std::string::npos);
+
+    f.reset_stats();
+    REQUIRE(f.get_stats().commands[0x02].count == 0);
+}
+
+TEST_CASE("flash erase verification and diff", "[flash]")
+{
+    flash_sim f(0x2000 + 100);
+    REQUIRE(!f.is_erased(0, 1));
+    REQUIRE(f.first_non_erased(10, 10) == 10);
+    command(f, 0x06);
+    command(f, 0x60);
+    REQUIRE(f.is_erased(0, f.get_data().size()));
+    REQUIRE(!f.first_non_erased(0, f.get_data().size()));
+    REQUIRE_THROWS_AS(f.is_erased(0x2000, 101), std::out_of_range);
+
+    std::vector<std::byte> data(300, std::byte{0x5a});
+    page_program(f, 0x180, std::span(data).first(128));
+    page_program(f, 0x200, std::span(data).first(256));
+    page_program(f, 0x2000 + 50, std::span(data).first(1));
+    REQUIRE(f.first_non_erased(0, 0x1000) == 0x180);
+    REQUIRE(f.is_erased(0x300, 0x1d32));
+
+    // The image matches the chip apart from the first page written and part of the last, partial, page.
+    std::vector<std::byte> image = f.get_data();
+    REQUIRE(f.diff(image).empty());
+    image[0x1ff]       = std::byte{0x00};
+    image[0x2000 + 99] = std::byte{0x00};
+    REQUIRE(f.diff(image) == std::vector<flash_sim::page_range>{{0x100, 0x100}, {0x2000, 100}});
+    image[0x200] = std::byte{0x00};
+    image[0x300] = std::byte{0x00};
+    REQUIRE(f.diff(image) == std::vector<flash_sim::page_range>{{0x100, 0x300}, {0x2000, 100}});
+    REQUIRE_THROWS_AS(f.diff(std::span(image).first(100)), std::invalid_argument);
+
+    // A page program into bytes that aren't erased still stops at the first of them.
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x02);
+    f.clock_in_data<24>(0x170);
+    REQUIRE_THROWS_AS(f.clock_in_bytes(data), std::runtime_error);
+    f.toggle_chip_enable();
+    REQUIRE(f.first_non_erased(0, 0x1000) == 0x170);
+}
+
+TEST_CASE("flash dirty pages and deltas", "[flash]")
+{
+    // A new chip starts out marked clean, and erasing the chip dirties every page, including the partial last one.
+    flash_sim f(0x10000 + 100);
+    REQUIRE(f.dirty_pages().empty());
+    command(f, 0x06);
+    command(f, 0x60);
+    REQUIRE(f.dirty_pages() == std::vector<flash_sim::page_range>{{0, 0x10000 + 100}});
+    f.mark_clean();
+    REQUIRE(f.dirty_pages().empty());
+
+    std::vector<std::byte> data(16, std::byte{0x5a});
+    page_program(f, 0x1f8, data);
+    page_program(f, 0x10000 + 10, data);
+    command(f, 0x06);
+    command(f, 0x20, 0x4010);
+    REQUIRE(f.dirty_pages()
+            == std::vector<flash_sim::page_range>{{0x100, 0x200}, {0x4000, 0x1000}, {0x10000, 100}});
+
+    // Applying the delta to a copy of the chip at the mark brings it up to date, without recording anything.
+    flash_sim other(0x10000 + 100);
+    command(other, 0x06);
+    command(other, 0x60);
+    other.mark_clean();
+    auto num_ops = other.get_user_operations().size();
+    std::stringstream delta;
+    f.export_delta(delta);
+    other.apply_delta(delta);
+    REQUIRE(other.get_data() == f.get_data());
+    REQUIRE(other.get_user_operations().size() == num_ops);
+    REQUIRE(other.dirty_pages() == f.dirty_pages());
+
+    // Restoring a snapshot from since the mark restores its dirty pages, while an older snapshot dirties everything.
+    auto snapshot = f.take_snapshot();
+    page_program(f, 0x8000, data);
+    f.restore(snapshot);
+    REQUIRE(f.dirty_pages().size() == 3);
+    f.mark_clean();
+    page_program(f, 0x8000, data);
+    auto newer = f.take_snapshot();
+    page_program(f, 0x9000, data);
+    f.restore(newer);
+    REQUIRE(f.dirty_pages() == std::vector<flash_sim::page_range>{{0x8000, 0x100}});
+    f.restore(snapshot);
+    REQUIRE(f.dirty_pages() == std::vector<flash_sim::page_range>{{0, 0x10000 + 100}});
+
+    // Deltas that are damaged, or of another chip, are refused before anything is written.
+    std::string bytes    = delta.str();
+    auto        expected = other.get_data();
+    auto        apply    = [&](const std::string& s) {
+        std::istringstream in(s);
+        other.apply_delta(in);
+    };
+    // The first run starts after the magic, the version, the size, and the number of runs, and its address is first.
+    std::string           corrupt   = bytes;
+    constexpr std::size_t first_run = sizeof(flash_delta_format::magic) + 1 + 8 + 8;
+    corrupt[first_run + 7]          = 0x7f;
+    REQUIRE_THROWS_AS(apply("BFDX" + bytes.substr(4)), std::runtime_error);
+    REQUIRE_THROWS_AS(apply(bytes.substr(0, 4) + '\x02' + bytes.substr(5)), std::runtime_error);
+    REQUIRE_THROWS_AS(apply(bytes.substr(0, bytes.size() - 1)), std::runtime_error);
+    REQUIRE_THROWS_AS(apply(corrupt), std::runtime_error);
+    REQUIRE(other.get_data() == expected);
+    flash_sim small(0x1000);
+    std::istringstream in(bytes);
+    REQUIRE_THROWS_AS(small.apply_delta(in), std::invalid_argument);
+    small.toggle_chip_enable();
+    in.seekg(0);
+    REQUIRE_THROWS_AS(small.apply_delta(in), std::runtime_error);
+}
+
+TEST_CASE("flash memory resource", "[flash]")
+{
+    // The log, and the log of any fork, is allocated from the resource the chip was made with.
+    std::pmr::monotonic_buffer_resource arena;
+    flash_sim                           f(0x1000, flash_sim::recording::full, &arena);
+    std::vector<std::byte>              data(256, std::byte{0x5a});
+    command(f, 0x06);
+    command(f, 0x60);
+    page_program(f, 0, data);
+    auto copy = f.fork();
+    REQUIRE(f.get_user_operations().resource() == &arena);
+    REQUIRE(copy->get_user_operations().resource() == &arena);
+    REQUIRE(copy->get_user_operations().size() == f.get_user_operations().size());
+    REQUIRE(copy->get_data() == f.get_data());
+}
+
+TEST_CASE("flash read cache", "[flash]")
+{
+    // A cached read ends up just like performing it, down to the operations recorded and the time it takes.
+    flash_sim cached(0x10000);
+    flash_sim uncached(0x10000);
+    cached.set_read_cache_capacity(4);
+    std::vector<std::byte> data(256);
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = std::byte(i);
+    for (flash_sim* f : {&cached, &uncached})
+    {
+        command(*f, 0x06);
+        command(*f, 0x60);
+        page_program(*f, 0x100, std::span(data).first(0xe0));
+    }
+    std::vector<std::byte> out(64);
+    std::vector<std::byte> fast(64);
+    std::byte              dummy{0xa5};
+    for (int i = 0; i < 3; ++i)
+    {
+        for (flash_sim* f : {&cached, &uncached})
+        {
+            f->read(0x120, out);
+            f->transfer(0x0b, 0x140, std::span(&dummy, 1), fast);
+        }
+    }
+    REQUIRE(std::equal(std::begin(out), std::end(out), std::begin(data) + 0x20));
+    REQUIRE(std::equal(std::begin(fast), std::end(fast), std::begin(data) + 0x40));
+    REQUIRE(cached.get_read_cache_stats().hits == 4);
+    REQUIRE(cached.get_read_cache_stats().misses == 2);
+    REQUIRE(cached.get_read_cache_stats().size == 2);
+    REQUIRE(cached.elapsed() == uncached.elapsed());
+    REQUIRE(std::equal(std::begin(cached.get_user_operations()),
+                       std::end(cached.get_user_operations()),
+                       std::begin(uncached.get_user_operations()),
+                       std::end(uncached.get_user_operations())));
+
+    // Programming a page drops the reads of it, while reads elsewhere stay cached.
+    cached.read(0x2000, out);
+    page_program(cached, 0x1f0, std::span(data).first(16));
+    REQUIRE(cached.get_read_cache_stats().size == 1);
+    cached.transfer(0x0b, 0x180, std::span(&dummy, 1), fast);
+    REQUIRE(std::equal(std::begin(fast), std::end(fast), std::begin(data) + 0x80));
+    REQUIRE(cached.get_read_cache_stats().misses == 4);
+
+    // After a restore, a read is only used if the data it was read from didn't change. Every read here starts with the
+    // pins as they were when it was cached.
+    auto snapshot = cached.take_snapshot();
+    cached.read(0x2000, out);
+    REQUIRE(cached.get_read_cache_stats().hits == 5);
+    page_program(cached, 0x2000, data);
+    cached.read(0x2000, out);
+    cached.restore(snapshot);
+    cached.transfer(0x0b, 0x180, std::span(&dummy, 1), fast);
+    REQUIRE(cached.get_read_cache_stats().hits == 6);
+    cached.read(0x2000, out);
+    REQUIRE(out == std::vector<std::byte>(64, std::byte{0xff}));
+    REQUIRE(cached.get_read_cache_stats().hits == 6);
+
+    // A full cache starts over, so with two reads already cached, five more leave three. Resizing it empties it.
+    REQUIRE(cached.get_read_cache_stats().size == 2);
+    for (std::uint32_t address = 0x3000; address < 0x3500; address += 0x100)
+        cached.read(address, out);
+    REQUIRE(cached.get_read_cache_stats().size == 3);
+    cached.set_read_cache_capacity(0);
+    cached.read(0x3400, out);
+    REQUIRE(cached.get_read_cache_stats().hits == 0);
+    REQUIRE(cached.get_read_cache_stats().size == 0);
+}
+
+TEST_CASE("flash program image", "[flash]")
+{
+    // Programming an image ends up just like programming it a page at a time, however many threads encode the log.
+    std::vector<std::byte> image(0x14000 + 37);
+    for (std::size_t i = 0; i < image.size(); ++i)
+        image[i] = std::byte(i * 13 + i / 256);
+    flash_sim::timing t;
+    t.clock_period = std::chrono::nanoseconds(10);
+    t.page_program = std::chrono::microseconds(800);
+    for (std::size_t num_threads : {1, 4, 0})
+    {
+        flash_sim expected(0x40000);
+        flash_sim programmed(0x40000);
+        // Reading the status register leaves the serial input high, so the first page starts from there.
+        std::byte status{0};
+        for (flash_sim* f : {&expected, &programmed})
+        {
+            f->set_timing(t);
+            f->erase(flash::erase_size::chip);
+            f->mark_clean();
+            f->transfer(0x05, std::nullopt, {}, std::span(&status, 1));
+        }
+        for (std::size_t offset = 0; offset < image.size();)
+        {
+            std::size_t address = 0x1010 + offset;
+            std::size_t count   = std::min(image.size() - offset, flash::page_size - address % flash::page_size);
+            expected.page_program(static_cast<std::uint32_t>(address), std::span(image).subspan(offset, count));
+            offset += count;
+        }
+        programmed.program_image(image, 0x1010, num_threads);
+        REQUIRE(programmed.get_data() == expected.get_data());
+        REQUIRE(programmed.get_user_operations().size() == expected.get_user_operations().size());
+        REQUIRE(std::equal(std::begin(programmed.get_user_operations()),
+                           std::end(programmed.get_user_operations()),
+                           std::begin(expected.get_user_operations()),
+                           std::end(expected.get_user_operations())));
+        REQUIRE(programmed.elapsed() == expected.elapsed());
+        REQUIRE(programmed.get_status() == expected.get_status());
+        REQUIRE(programmed.get_serial_input() == expected.get_serial_input());
+        REQUIRE(programmed.dirty_pages() == expected.dirty_pages());
+        REQUIRE(programmed.get_stats().commands[0x02].clocks == expected.get_stats().commands[0x02].clocks);
+        REQUIRE(programmed.get_stats().commands[0x06].count == expected.get_stats().commands[0x06].count);
+        REQUIRE(programmed.get_stats().bytes_programmed == expected.get_stats().bytes_programmed);
+    }
+
+    // Nothing is changed by an image that can't be programmed.
+    flash_sim f(0x10000, flash_sim::recording::off);
+    f.erase(flash::erase_size::chip);
+    f.program_image(std::span(image).first(0x300), 0x80);
+    REQUIRE(std::equal(std::begin(image), std::begin(image) + 0x300, std::begin(f.get_data()) + 0x80));
+    REQUIRE(f.get_user_operations().empty());
+    f.program_image({}, 0x10000);
+    f.set_timing(t);
+    f.write_enable();
+    f.transfer(0x02, 0x2000, std::span(image).first(1), {});
+    auto data = f.get_data();
+    REQUIRE_THROWS_AS(f.program_image(std::span(image).first(0x10), 0x1000), std::runtime_error);
+    f.wait_for_write_complete();
+    REQUIRE_THROWS_AS(f.program_image(std::span(image).first(0x10), 0x370), std::runtime_error);
+    REQUIRE_THROWS_AS(f.program_image(std::span(image).first(0x10), 0xfff8), std::out_of_range);
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(std::uint8_t{0x05});
+    REQUIRE_THROWS_AS(f.program_image(std::span(image).first(0x10), 0x1000), std::runtime_error);
+    f.toggle_chip_enable();
+    REQUIRE(f.get_data() == data);
+}
+
+TEST_CASE("flash phase table", "[flash]")
+{
+    const auto& phases = phase_table<is25lp128_traits>;
+    REQUIRE(!phases[0x00].known);
+    REQUIRE(phases[0x05].known);
+    REQUIRE(phases[0x05].address_bits == 0);
+    REQUIRE(phases[0xeb].address_bits == 24);
+    REQUIRE(phases[0xeb].address_io == 4);
+    REQUIRE(phases[0xeb].dummy_cycles == 6);
+    REQUIRE(phases[0xeb].data_out_io == 4);
+    REQUIRE(phase_table<small_page_traits>[0x13].address_bits == 32);
+
+    // The chip clocks the address in itself, so part of it can go in bit by bit and the rest as whole bytes.
+    flash_sim                f(4096);
+    std::array<std::byte, 2> data{std::byte{0x5a}, std::byte{0xa5}};
+    command(f, 0x06);
+    command(f, 0x20, 0);
+    page_program(f, 0x102, data);
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x03);
+    f.clock_in_data<4>(0x0);
+    REQUIRE_THROWS_AS(f.toggle_chip_enable(), std::runtime_error);
+    f.clock_in_data<4>(0x0);
+    std::array<std::byte, 2> rest{std::byte{0x01}, std::byte{0x02}};
+    f.clock_in_bytes(rest);
+    REQUIRE(f.clock_out_data<8, std::uint8_t>() == 0x5a);
+    REQUIRE(f.clock_out_data<8, std::uint8_t>() == 0xa5);
+    f.toggle_chip_enable();
+}
+
+TEST_CASE("flash chip traits", "[flash]")
+{
+    basic_flash_sim<small_page_traits> f;
+    REQUIRE(f.get_data().size() == 0x10000);
+    REQUIRE(f.page_size == 16);
+
+    // Every command of this chip takes a 32-bit address, if it takes one at all.
+    auto start = [&f](std::uint8_t opcode, std::uint32_t address) {
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(opcode);
+        f.clock_in_data<32>(address);
+    };
+    auto write_enable = [&f]() {
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(std::uint8_t{0x06});
+        f.toggle_chip_enable();
+    };
+
+    write_enable();
+    start(0x21, 0x1004);
+    f.toggle_chip_enable();
+    REQUIRE(f.get_data()[0x1000] == std::byte{0xff});
+    REQUIRE(f.get_data()[0x0fff] == std::byte{0x00});
+
+    // A page is only 16 bytes, so the 17th byte doesn't fit in the page buffer.
+    write_enable();
+    start(0x12, 0x1010);
+    f.clock_in_bytes(std::vector<std::byte>(16, std::byte{0x5a}));
+    REQUIRE_THROWS_AS(f.clock_in_data<8>(std::uint8_t{0x5a}), std::runtime_error);
+    f.toggle_chip_enable();
+
+    start(0x13, 0x100f);
+    REQUIRE(f.clock_out_data<8, std::uint8_t>() == 0xff);
+    REQUIRE(f.clock_out_data<8, std::uint8_t>() == 0x5a);
+    f.toggle_chip_enable();
+    REQUIRE(f.get_data()[0x1020] == std::byte{0xff});
+
+    // Programming an image records the commands of this chip, which performed on another chip program the same data.
+    auto copy  = f.fork();
+    auto first = f.get_user_operations().size();
+    f.program_image(std::vector<std::byte>(40, std::byte{0xa5}), 0x1024);
+    for (auto it = std::next(std::begin(f.get_user_operations()), static_cast<std::ptrdiff_t>(first));
+         it != std::end(f.get_user_operations());
+         ++it)
+        copy->perform_user_operation(*it);
+    REQUIRE(copy->get_data() == f.get_data());
+    REQUIRE(f.get_data()[0x104b] == std::byte{0xa5});
+
+    // The IS25LP128 opcodes mean nothing to this chip.
+    f.toggle_chip_enable();
+    REQUIRE_THROWS_AS(f.clock_in_data<8>(std::uint8_t{0x20}), std::out_of_range);
+}
+
 } // End namespace bedrock::test.
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace bedrock
+{
+
+/// The commands a simulated chip knows how to perform. The traits of a chip map its opcodes onto these, so chips that
+/// use different opcodes for the same commands, or only support some of them, can share the simulation.
+enum class flash_sim_command
+{
+    /// The opcode isn't supported by the chip.
+    none,
+
+    /// Reads data from the serial-output pin, starting at an address.
+    read,
+
+    /// Reads data from the serial-output pin after eight dummy cycles.
+    fast_read,
+
+    /// Reads data two bits per clock cycle after eight dummy cycles.
+    dual_output_read,
+
+    /// Reads data four bits per clock cycle after eight dummy cycles.
+    quad_output_read,
+
+    /// Clocks in the address and reads data four bits per clock cycle, after six dummy cycles.
+    quad_io_read,
+
+    /// Writes up to a page of data from the serial-input pin, starting at an address.
+    page_program,
+
+    /// Writes up to a page of data four bits per clock cycle.
+    quad_page_program,
+
+    /// Sets the write enable latch.
+    write_enable,
+
+    /// Outputs the status register for as long as the clock is toggled.
+    read_status,
+
+    /// Erases the whole chip.
+    chip_erase,
+
+    /// Erases the sector containing an address.
+    sector_erase,
+
+    /// Erases the 32 KiB block containing an address.
+    block_erase_32k,
+
+    /// Erases the 64 KiB block containing an address.
+    block_erase_64k
+};
+
+/// The geometry and command set of the IS25LP128 found on the SiFive HiFive-1 development board.
+///
+/// Every chip basic_flash_sim simulates is described by a traits type like this one, with the same members. Everything
+/// in it is known at compile time, so none of it costs anything to look up while the chip is running.
+struct is25lp128_traits
+{
+    /// The number of bytes in a page, the most a single page program can write.
+    static constexpr std::size_t page_size = 256;
+
+    /// The number of address bits clocked in after the opcode of every command that takes an address. This must be a
+    /// whole number of bytes, and no more than 32 bits.
+    static constexpr std::size_t address_bits = 24;
+
+    /// The number of bytes a chip has unless it is made with some other size.
+    static constexpr std::size_t default_size = 0xffffffUL;
+
+    /// The number of bytes erased by flash_sim_command::sector_erase.
+    static constexpr std::size_t sector_erase_size = 0x1000;
+
+    /// The number of bytes erased by flash_sim_command::block_erase_32k.
+    static constexpr std::size_t block_erase_32k_size = 0x8000;
+
+    /// The number of bytes erased by flash_sim_command::block_erase_64k.
+    static constexpr std::size_t block_erase_64k_size = 0x10000;
+
+    /// Gets the command the chip performs for an opcode.
+    static constexpr flash_sim_command command(std::uint8_t opcode) noexcept
+    {
+        switch (opcode)
+        {
+        case 0x02: return flash_sim_command::page_program;
+        case 0x03: return flash_sim_command::read;
+        case 0x05: return flash_sim_command::read_status;
+        case 0x06: return flash_sim_command::write_enable;
+        case 0x0b: return flash_sim_command::fast_read;
+        case 0x20: return flash_sim_command::sector_erase;
+        case 0x32: return flash_sim_command::quad_page_program;
+        case 0x3b: return flash_sim_command::dual_output_read;
+        case 0x52: return flash_sim_command::block_erase_32k;
+        case 0x60: return flash_sim_command::chip_erase;
+        case 0x6b: return flash_sim_command::quad_output_read;
+        case 0xd7: return flash_sim_command::sector_erase;
+        case 0xd8: return flash_sim_command::block_erase_64k;
+        case 0xeb: return flash_sim_command::quad_io_read;
+        default: return flash_sim_command::none;
+        }
+    }
+};
+
+/// The phases of a command after its opcode. Every command follows the same grammar: an optional address, then dummy
+/// cycles, then data clocked either in or out for as long as the chip stays selected.
+struct flash_sim_phases
+{
+    /// Whether or not the command is known at all.
+    bool known = false;
+
+    /// The number of address bits, or zero if there is no address.
+    std::uint8_t address_bits = 0;
+
+    /// The number of IO pins the address and dummy cycles are clocked in over, or zero if there is no address.
+    std::uint8_t address_io = 0;
+
+    /// The number of dummy cycles between the address and the data.
+    std::uint8_t dummy_cycles = 0;
+
+    /// The number of IO pins data is clocked in over, or zero if no data is clocked in.
+    std::uint8_t data_in_io = 0;
+
+    /// The number of IO pins data is clocked out over, or zero if no data is clocked out.
+    std::uint8_t data_out_io = 0;
+};
+
+/// Gets the phases of a command on a chip with the given traits.
+template <typename traits>
+constexpr flash_sim_phases command_phases(flash_sim_command command) noexcept
+{
+    constexpr auto address_bits = static_cast<std::uint8_t>(traits::address_bits);
+    switch (command)
+    {
+    case flash_sim_command::none: return {};
+    case flash_sim_command::read: return {true, address_bits, 1, 0, 0, 1};
+    case flash_sim_command::fast_read: return {true, address_bits, 1, 8, 0, 1};
+    case flash_sim_command::dual_output_read: return {true, address_bits, 1, 8, 0, 2};
+    case flash_sim_command::quad_output_read: return {true, address_bits, 1, 8, 0, 4};
+    case flash_sim_command::quad_io_read: return {true, address_bits, 4, 6, 0, 4};
+    case flash_sim_command::page_program: return {true, address_bits, 1, 0, 1, 0};
+    case flash_sim_command::quad_page_program: return {true, address_bits, 1, 0, 4, 0};
+    case flash_sim_command::write_enable: return {true, 0, 0, 0, 0, 0};
+    case flash_sim_command::read_status: return {true, 0, 0, 0, 0, 1};
+    case flash_sim_command::chip_erase: return {true, 0, 0, 0, 0, 0};
+    case flash_sim_command::sector_erase: return {true, address_bits, 1, 0, 0, 0};
+    case flash_sim_command::block_erase_32k: return {true, address_bits, 1, 0, 0, 0};
+    case flash_sim_command::block_erase_64k: return {true, address_bits, 1, 0, 0, 0};
+    }
+    return {};
+}
+
+/// Builds phase_table.
+template <typename traits>
+constexpr std::array<flash_sim_phases, 256> make_phase_table() noexcept
+{
+    std::array<flash_sim_phases, 256> table{};
+    for (std::size_t opcode = 0; opcode < table.size(); ++opcode)
+        table[opcode] = command_phases<traits>(traits::command(static_cast<std::uint8_t>(opcode)));
+    return table;
+}
+
+/// The phases of the command for every opcode of a chip with the given traits, so only a single lookup is needed once
+/// the opcode has been clocked in. Unknown opcodes are not known and have no phases.
+template <typename traits>
+inline constexpr std::array<flash_sim_phases, 256> phase_table = make_phase_table<traits>();
+
+} // End namespace bedrock.
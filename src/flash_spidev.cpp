@@ -0,0 +1,364 @@
+#include "flash_spidev.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/spi/spidev.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace bedrock
+{
+
+namespace
+{
+
+/// The offset of a segment that shifts out zeroes rather than bytes from the queue.
+constexpr std::size_t no_tx = std::numeric_limits<std::size_t>::max();
+
+/// The spidev buffer size used when the spidev module doesn't report its own.
+constexpr std::size_t default_max_message = 4096;
+
+/// The longest a write can take before wait_for_write_complete gives up, the IS25LP128's maximum chip erase time.
+constexpr std::chrono::seconds max_write_time{180};
+
+/// How long wait_for_write_complete sleeps between polls of the status register.
+constexpr std::chrono::microseconds poll_interval{100};
+
+/// Gets the most bytes spidev accepts in a single ioctl, which is a parameter of the spidev module.
+std::size_t max_message_size()
+{
+    std::ifstream in("/sys/module/spidev/parameters/bufsiz");
+    std::size_t   size = 0;
+    if (in >> size && size != 0)
+        return size;
+    return default_max_message;
+}
+
+/// Gets the level of a bit of a byte.
+flash::pin_state bit_level(std::byte value, unsigned bit) noexcept
+{
+    return (value >> bit & std::byte{1}) == std::byte{1} ? flash::pin_state::high : flash::pin_state::low;
+}
+
+} // End anonymous namespace.
+
+/**********************************************************************************************************************\
+* flash_spidev                                                                                                         *
+\**********************************************************************************************************************/
+
+flash_spidev::flash_spidev(const std::string& path, std::uint32_t speed_hz, std::size_t num_io, std::uint8_t mode)
+        : _fd(-1)
+        , _speed_hz(speed_hz)
+        , _num_io(num_io)
+        , _max_message(max_message_size())
+        , _selected(false)
+        , _serial_input(pin_state::low)
+        , _asserted(false)
+        , _serial_output(pin_state::low)
+        , _bits(0)
+        , _num_bits(0)
+        , _received{0}
+        , _ahead(0)
+        , _tx()
+        , _segments()
+        , _error()
+{
+    if (num_io != 1 && num_io != 2 && num_io != 4)
+        throw std::invalid_argument("Can only wire up 1, 2, or 4 IOs.");
+    if (mode > 3)
+        throw std::invalid_argument("SPI mode must be 0 to 3.");
+
+    std::uint32_t spi_mode = mode;
+    if (num_io == 2)
+        spi_mode |= SPI_TX_DUAL | SPI_RX_DUAL;
+    else if (num_io == 4)
+        spi_mode |= SPI_TX_QUAD | SPI_RX_QUAD;
+    std::uint8_t bits_per_word = 8;
+
+    _fd = ::open(path.c_str(), O_RDWR);
+    if (_fd < 0)
+        throw std::system_error(errno, std::generic_category(), "Cannot open spidev device " + path);
+    if (::ioctl(_fd, SPI_IOC_WR_MODE32, &spi_mode) < 0 || ::ioctl(_fd, SPI_IOC_WR_BITS_PER_WORD, &bits_per_word) < 0
+        || ::ioctl(_fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0)
+    {
+        int error = errno;
+        ::close(_fd);
+        throw std::system_error(error, std::generic_category(), "Cannot configure spidev device " + path);
+    }
+}
+
+flash_spidev::~flash_spidev()
+{
+    // Destructors can't report errors, so a failure to deselect the chip is silently dropped here.
+    try
+    {
+        if (_selected)
+            toggle_chip_enable();
+    }
+    catch (const std::exception&)
+    {
+    }
+    ::close(_fd);
+}
+
+flash_spidev::pin_state flash_spidev::get_chip_enable() const noexcept
+{
+    return _selected ? pin_state::low : pin_state::high;
+}
+
+flash_spidev::pin_state flash_spidev::get_serial_input() const noexcept
+{
+    return _serial_input;
+}
+
+flash_spidev::pin_state flash_spidev::get_serial_output() const noexcept
+{
+    // The output of the last clock cycle is only known once its byte has been sent, so send the rest of it now.
+    if (_ahead != 0 || _num_bits == 0 || _error)
+        return _serial_output;
+    try
+    {
+        std::uint8_t num_bits = _num_bits;
+        auto         value    = static_cast<std::uint8_t>(_bits << (8 - num_bits));
+        if (_serial_input == pin_state::high)
+            value |= static_cast<std::uint8_t>(0xff >> num_bits);
+        _bits     = 0;
+        _num_bits = 0;
+        std::byte tx{value};
+        queue(std::span(&tx, 1), &_received, 1, 1);
+        send(false);
+        _ahead         = static_cast<std::uint8_t>(8 - num_bits);
+        _serial_output = bit_level(_received, _ahead);
+    }
+    catch (...)
+    {
+        _error = std::current_exception();
+    }
+    return _serial_output;
+}
+
+flash_spidev::pin_state flash_spidev::get_io(std::size_t io) const noexcept
+{
+    switch (io)
+    {
+    case 0: return get_serial_input();
+    case 1: return get_serial_output();
+    default: return pin_state::low;
+    }
+}
+
+void flash_spidev::toggle_chip_enable()
+{
+    rethrow_error();
+    if (!_selected)
+    {
+        _selected = true;
+        return;
+    }
+
+    // Whatever is left of a byte clocked in pin by pin is dropped, like the chip drops it.
+    queue_bits();
+    _bits     = 0;
+    _num_bits = 0;
+    _ahead    = 0;
+    _selected = false;
+    send(true);
+}
+
+void flash_spidev::toggle_serial_input()
+{
+    rethrow_error();
+    if (_ahead != 0)
+        throw std::runtime_error("Cannot change the serial input after the rest of the byte has been sent.");
+    _serial_input = _serial_input == pin_state::high ? pin_state::low : pin_state::high;
+}
+
+void flash_spidev::toggle_io(std::size_t io)
+{
+    if (io > 3)
+        throw std::invalid_argument("There are only four IOs.");
+    if (io != 0)
+        throw std::runtime_error("Only IO0 can be driven pin by pin, use clock_in_bytes for dual and quad IO.");
+    toggle_serial_input();
+}
+
+void flash_spidev::toggle_clock()
+{
+    rethrow_error();
+    if (!_selected)
+        throw std::runtime_error("Cannot toggle the clock while the chip is deselected.");
+    if (_ahead != 0)
+    {
+        _serial_output = bit_level(_received, --_ahead);
+        return;
+    }
+    queue_bits();
+    _bits = static_cast<std::uint8_t>(_bits << 1 | (_serial_input == pin_state::high ? 1 : 0));
+    ++_num_bits;
+}
+
+void flash_spidev::wait_for_write_complete()
+{
+    rethrow_error();
+    if (_selected)
+        throw std::runtime_error("Cannot wait for a write while the chip is selected.");
+    auto      deadline = std::chrono::steady_clock::now() + max_write_time;
+    std::byte status{0};
+    transfer(0x05, std::nullopt, {}, std::span(&status, 1));
+    while ((status & std::byte{0x01}) != std::byte{0})
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+            throw std::runtime_error("Timed out waiting for a write to complete.");
+        std::this_thread::sleep_for(poll_interval);
+        transfer(0x05, std::nullopt, {}, std::span(&status, 1));
+    }
+}
+
+void flash_spidev::clock_in_bytes(std::span<const std::byte> data, std::size_t num_io)
+{
+    check_bytes(num_io);
+    queue(data, nullptr, data.size(), num_io);
+}
+
+void flash_spidev::clock_out_bytes(std::span<std::byte> data, std::size_t num_io)
+{
+    check_bytes(num_io);
+    queue({}, data.data(), data.size(), num_io);
+    send(false);
+}
+
+void flash_spidev::transfer(std::uint8_t                 opcode,
+                            std::optional<std::uint32_t> address,
+                            std::span<const std::byte>   tx,
+                            std::span<std::byte>         rx)
+{
+    rethrow_error();
+    if (_selected)
+        throw std::runtime_error("Cannot start a command while the chip is selected.");
+    std::byte   header[4]{std::byte{opcode}};
+    std::size_t header_size = 1;
+    if (address)
+    {
+        header[1]   = std::byte(*address >> 16);
+        header[2]   = std::byte(*address >> 8);
+        header[3]   = std::byte(*address);
+        header_size = 4;
+    }
+    queue(std::span(header, header_size), nullptr, header_size, 1);
+    queue(tx, nullptr, tx.size(), 1);
+    queue({}, rx.data(), rx.size(), 1);
+    send(true);
+}
+
+void flash_spidev::check_bytes(std::size_t num_io) const
+{
+    if (num_io != 1 && num_io != 2 && num_io != 4)
+        throw std::invalid_argument("Can only clock data over 1, 2, or 4 IOs.");
+    if (num_io > _num_io)
+        throw std::invalid_argument("Not enough IOs are wired up.");
+    if (!_selected)
+        throw std::runtime_error("Cannot clock data while the chip is deselected.");
+    if (_num_bits % 8 != 0 || _ahead != 0)
+        throw std::runtime_error("Cannot clock whole bytes partway through a byte.");
+}
+
+void flash_spidev::rethrow_error()
+{
+    if (_error)
+        std::rethrow_exception(std::exchange(_error, nullptr));
+}
+
+void flash_spidev::queue(std::span<const std::byte> tx, std::byte* rx, std::size_t length, std::size_t num_io) const
+{
+    queue_bits();
+    if (length == 0)
+        return;
+
+    // Bytes going the same way over the same IOs are merged into the previous segment, so they share a transfer.
+    std::size_t offset = tx.empty() ? no_tx : _tx.size();
+    if (!_segments.empty())
+    {
+        segment& last = _segments.back();
+        if (!rx && !last.rx && offset != no_tx && last.offset != no_tx && last.num_io == num_io)
+        {
+            _tx.insert(std::end(_tx), std::begin(tx), std::end(tx));
+            last.length += length;
+            return;
+        }
+    }
+    _tx.insert(std::end(_tx), std::begin(tx), std::end(tx));
+    _segments.push_back({offset, length, rx, static_cast<std::uint8_t>(num_io)});
+}
+
+void flash_spidev::queue_bits() const
+{
+    if (_num_bits != 8)
+        return;
+    _num_bits = 0;
+    std::byte value{_bits};
+    queue(std::span(&value, 1), nullptr, 1, 1);
+}
+
+void flash_spidev::send(bool deselect) const
+{
+    // Nothing has been sent since the chip was selected, so there is nothing to deselect either.
+    if (_segments.empty() && !(deselect && _asserted))
+        return;
+
+    std::vector<spi_ioc_transfer> transfers;
+    std::size_t                   message_bytes = 0;
+    auto                          flush         = [&](bool last) {
+        // Keeping the chip selected after a message is requested by setting cs_change on its final transfer.
+        if (transfers.empty())
+            transfers.push_back(spi_ioc_transfer{});
+        transfers.back().cs_change = last && deselect ? 0 : 1;
+        int result = ::ioctl(_fd, SPI_IOC_MESSAGE(transfers.size()), transfers.data());
+        transfers.clear();
+        message_bytes = 0;
+        if (result < 0)
+        {
+            _tx.clear();
+            _segments.clear();
+            _asserted = false;
+            throw std::system_error(errno, std::generic_category(), "SPI transfer failed");
+        }
+        _asserted = !(last && deselect);
+    };
+
+    for (const segment& s : _segments)
+    {
+        for (std::size_t done = 0; done < s.length;)
+        {
+            if (message_bytes == _max_message)
+                flush(false);
+            std::size_t      count = std::min(s.length - done, _max_message - message_bytes);
+            spi_ioc_transfer t{};
+            if (s.offset != no_tx)
+                t.tx_buf = reinterpret_cast<std::uintptr_t>(_tx.data() + s.offset + done);
+            if (s.rx)
+                t.rx_buf = reinterpret_cast<std::uintptr_t>(s.rx + done);
+            t.len           = static_cast<std::uint32_t>(count);
+            t.speed_hz      = _speed_hz;
+            t.bits_per_word = 8;
+            t.tx_nbits      = s.num_io;
+            t.rx_nbits      = s.num_io;
+            transfers.push_back(t);
+            message_bytes += count;
+            done += count;
+        }
+    }
+    flush(true);
+    _tx.clear();
+    _segments.clear();
+}
+
+} // End namespace bedrock.
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "flash.hpp"
+
+namespace bedrock
+{
+
+/// A real flash chip attached to a Linux SPI controller, driven through a spidev device such as /dev/spidev0.0.
+///
+/// SPI controllers move whole bytes, so everything clocked in is queued up and sent as late as possible, with as many
+/// queued transfers as fit going out in a single SPI_IOC_MESSAGE ioctl. A command made with transfer, or with
+/// clock_in_bytes alone, goes out in one ioctl when the chip is deselected, and clock_out_bytes sends whatever is
+/// queued along with the bytes it reads. Only transfers larger than the spidev buffer size are split into several
+/// ioctls, with the chip kept selected in between.
+///
+/// The pin-level interface works too, but only over IO0 and IO1, and a byte only goes out once it has been fully
+/// clocked in or its output is needed. Reading the serial-output pin partway through a byte sends the rest of the
+/// byte early, assuming the serial-input pin stays at its current level, so the serial input can't change again until
+/// the byte is done. Bits of a partial byte that are still queued when the chip is deselected are dropped, just as the
+/// chip drops a partially clocked in byte. Errors while sending early, which happens in get_serial_output and so can't
+/// throw, are thrown by the next call that toggles a pin.
+class flash_spidev : public flash
+{
+public:
+    /// Opens and configures a spidev device.
+    ///
+    /// \param path The spidev device, such as /dev/spidev0.0.
+    /// \param speed_hz The SPI clock frequency.
+    /// \param num_io The number of IO pins wired up between the controller and the chip, 1, 2, or 4. Dual and quad
+    /// transfers need the controller to support them too.
+    /// \param mode The SPI mode, 0 to 3. The IS25LP128 supports modes 0 and 3.
+    /// \throws std::invalid_argument if num_io or mode are invalid.
+    /// \throws std::system_error if the device can't be opened or configured.
+    flash_spidev(const std::string& path, std::uint32_t speed_hz, std::size_t num_io = 1, std::uint8_t mode = 0);
+
+    flash_spidev(const flash_spidev&) = delete;
+
+    flash_spidev& operator=(const flash_spidev&) = delete;
+
+    /// Deselects the chip if it is selected, then closes the device. Any error is dropped.
+    virtual ~flash_spidev();
+
+    /// Reads the current state of the chip-enable pin.
+    virtual pin_state get_chip_enable() const noexcept override;
+
+    /// Reads the current state of the serial-input pin.
+    virtual pin_state get_serial_input() const noexcept override;
+
+    /// Reads the level the chip output on the serial-output pin during the last clock cycle, sending the rest of a
+    /// partially clocked in byte if need be.
+    virtual pin_state get_serial_output() const noexcept override;
+
+    /// Reads the current state of IO0 or IO1. IO2 and IO3 can't be driven pin by pin, so they read as pin_state::low.
+    virtual pin_state get_io(std::size_t io) const noexcept override;
+
+    /// Toggles the chip-enable pin. Deselecting the chip sends everything that is still queued.
+    ///
+    /// \throws std::system_error if sending fails.
+    virtual void toggle_chip_enable() override;
+
+    /// Toggles the serial-input pin.
+    ///
+    /// \throws std::runtime_error if the rest of the current byte has already been sent.
+    virtual void toggle_serial_input() override;
+
+    /// Toggles IO0, which is the same as toggling the serial-input pin.
+    ///
+    /// \throws std::invalid_argument if there is no such IO pin.
+    /// \throws std::runtime_error for any IO other than IO0, which can only be driven with clock_in_bytes.
+    virtual void toggle_io(std::size_t io) override;
+
+    /// Clocks in the level of the serial-input pin.
+    ///
+    /// \throws std::runtime_error if the chip is deselected.
+    virtual void toggle_clock() override;
+
+    /// Polls the status register until the write in progress bit is clear, sleeping briefly between polls.
+    ///
+    /// \throws std::runtime_error if the chip is selected, or the write is still in progress after the longest a chip
+    /// erase can take.
+    /// \throws std::system_error if sending fails.
+    virtual void wait_for_write_complete() override;
+
+    /// Queues bytes to be sent over num_io IO pins. Nothing is sent until the chip is deselected or bytes are clocked
+    /// out.
+    ///
+    /// \throws std::invalid_argument if num_io is not 1, 2, or 4, or more than the number of IO pins wired up.
+    /// \throws std::runtime_error if the chip is deselected, or partway through a byte clocked in pin by pin.
+    virtual void clock_in_bytes(std::span<const std::byte> data, std::size_t num_io = 1) override;
+
+    /// Sends everything queued, then reads bytes over num_io IO pins, keeping the chip selected.
+    ///
+    /// \throws std::invalid_argument if num_io is not 1, 2, or 4, or more than the number of IO pins wired up.
+    /// \throws std::runtime_error if the chip is deselected, or partway through a byte clocked in pin by pin.
+    /// \throws std::system_error if sending fails.
+    virtual void clock_out_bytes(std::span<std::byte> data, std::size_t num_io = 1) override;
+
+    /// Performs a complete command in a single ioctl, unless it is larger than the spidev buffer size.
+    ///
+    /// \throws std::runtime_error if the chip is selected.
+    /// \throws std::system_error if sending fails.
+    virtual void transfer(std::uint8_t                 opcode,
+                          std::optional<std::uint32_t> address,
+                          std::span<const std::byte>   tx,
+                          std::span<std::byte>         rx) override;
+
+private:
+    /// A contiguous run of bytes queued to be sent.
+    struct segment
+    {
+        /// Where the bytes to send start in _tx, or the largest std::size_t to shift out zeroes instead.
+        std::size_t offset;
+
+        /// The number of bytes.
+        std::size_t length;
+
+        /// Receives the bytes clocked out at the same time, or nullptr if they aren't needed.
+        std::byte* rx;
+
+        /// The number of IO pins the bytes go over.
+        std::uint8_t num_io;
+    };
+
+    /// Throws if whole bytes can't be moved over num_io IO pins right now.
+    void check_bytes(std::size_t num_io) const;
+
+    /// Throws the error from sending early in get_serial_output, if there was one.
+    void rethrow_error();
+
+    /// Queues bytes to send, to receive, or both.
+    ///
+    /// \param tx The bytes to send, or empty to send nothing in particular.
+    /// \param rx Receives the bytes clocked out, or nullptr.
+    /// \param length The number of bytes.
+    /// \param num_io The number of IO pins the bytes go over.
+    void queue(std::span<const std::byte> tx, std::byte* rx, std::size_t length, std::size_t num_io) const;
+
+    /// Queues the byte clocked in pin by pin, once all eight of its bits have been.
+    void queue_bits() const;
+
+    /// Sends everything that is queued, in as few ioctls as possible.
+    ///
+    /// \param deselect Whether to deselect the chip afterwards, or keep it selected.
+    void send(bool deselect) const;
+
+    /// The open spidev device.
+    int _fd;
+
+    /// The SPI clock frequency.
+    std::uint32_t _speed_hz;
+
+    /// The number of IO pins wired up.
+    std::size_t _num_io;
+
+    /// The most bytes spidev accepts in a single ioctl.
+    std::size_t _max_message;
+
+    /// Whether or not the chip is selected as far as the user is concerned.
+    bool _selected;
+
+    /// The level the user is driving on the serial-input pin.
+    pin_state _serial_input;
+
+    // Everything below changes when get_serial_output sends early, which the interface requires to be const.
+
+    /// Whether or not the controller is holding the chip selected between ioctls.
+    mutable bool _asserted;
+
+    /// The level the chip output on the serial-output pin during the last clock cycle.
+    mutable pin_state _serial_output;
+
+    /// The bits of the current byte clocked in pin by pin so far, in the least significant bits.
+    mutable std::uint8_t _bits;
+
+    /// The number of bits in _bits.
+    mutable std::uint8_t _num_bits;
+
+    /// The byte received when the current byte was sent early.
+    mutable std::byte _received;
+
+    /// The number of clock cycles of the current byte that were sent early but have not been clocked yet.
+    mutable std::uint8_t _ahead;
+
+    /// The bytes queued to be sent.
+    mutable std::vector<std::byte> _tx;
+
+    /// The transfers queued to be sent.
+    mutable std::vector<segment> _segments;
+
+    /// The error thrown when sending early, waiting to be rethrown.
+    mutable std::exception_ptr _error;
+};
+
+} // End namespace bedrock.
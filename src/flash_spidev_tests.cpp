@@ -0,0 +1,19 @@
+#include <catch2/catch.hpp>
+
+#include <stdexcept>
+#include <system_error>
+
+#include "flash_spidev.hpp"
+
+namespace bedrock::test
+{
+
+TEST_CASE("flash_spidev", "[flash_spidev]")
+{
+    // There's no SPI hardware to test against, so only the checks made before talking to the device are covered.
+    REQUIRE_THROWS_AS(flash_spidev("/dev/spidev0.0", 1000000, 3), std::invalid_argument);
+    REQUIRE_THROWS_AS(flash_spidev("/dev/spidev0.0", 1000000, 1, 4), std::invalid_argument);
+    REQUIRE_THROWS_AS(flash_spidev("/nonexistent/spidev", 1000000), std::system_error);
+}
+
+} // End namespace bedrock::test.
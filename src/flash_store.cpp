@@ -0,0 +1,456 @@
+#include "flash_store.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace bedrock
+{
+
+namespace
+{
+
+/// The number of bytes compared at a time. Several words are combined per step, so the loops vectorize.
+constexpr std::size_t block_size = 4 * sizeof(std::uint64_t);
+
+/// Loads a block of bytes as words.
+std::array<std::uint64_t, 4> load_block(const std::byte* bytes) noexcept
+{
+    std::array<std::uint64_t, 4> words;
+    std::memcpy(words.data(), bytes, block_size);
+    return words;
+}
+
+/// Finds the first byte of a buffer that isn't value.
+const std::byte* find_not_value(const std::byte* first, const std::byte* last, std::byte value) noexcept
+{
+    const std::uint64_t pattern = std::to_integer<std::uint64_t>(value) * 0x0101010101010101ULL;
+    for (; static_cast<std::size_t>(last - first) >= block_size; first += block_size)
+    {
+        auto w = load_block(first);
+        if (((w[0] ^ pattern) | (w[1] ^ pattern) | (w[2] ^ pattern) | (w[3] ^ pattern)) != 0)
+            break;
+    }
+    return std::find_if(first, last, [value](std::byte b) { return b != value; });
+}
+
+/// Finds the offset of the first byte at which two buffers of num_bytes bytes differ, or num_bytes if they don't.
+std::size_t find_mismatch(const std::byte* a, const std::byte* b, std::size_t num_bytes) noexcept
+{
+    std::size_t offset = 0;
+    for (; num_bytes - offset >= block_size; offset += block_size)
+    {
+        auto x = load_block(a + offset);
+        auto y = load_block(b + offset);
+        if (((x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2]) | (x[3] ^ y[3])) != 0)
+            break;
+    }
+    return static_cast<std::size_t>(std::mismatch(a + offset, a + num_bytes, b + offset).first - a);
+}
+
+} // End anonymous namespace.
+
+/**********************************************************************************************************************\
+* flash_store::file_mapping                                                                                            *
+\**********************************************************************************************************************/
+
+struct flash_store::file_mapping
+{
+    /// Maps the whole of the given file.
+    file_mapping(const std::string& path, mapping mode)
+            : mode(mode)
+    {
+        int fd = ::open(path.c_str(), mode == mapping::shared ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "Cannot open flash image " + path);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0)
+        {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "Cannot stat flash image " + path);
+        }
+        length = static_cast<std::size_t>(st.st_size);
+        if (length == 0)
+        {
+            ::close(fd);
+            throw std::invalid_argument("Cannot map empty flash image " + path);
+        }
+
+        void* result = ::mmap(nullptr,
+                              length,
+                              PROT_READ | PROT_WRITE,
+                              mode == mapping::shared ? MAP_SHARED : MAP_PRIVATE,
+                              fd,
+                              0);
+        int error = errno;
+        ::close(fd);
+        if (result == MAP_FAILED)
+            throw std::system_error(error, std::generic_category(), "Cannot map flash image " + path);
+        address = static_cast<std::byte*>(result);
+    }
+
+    file_mapping(const file_mapping&) = delete;
+
+    file_mapping& operator=(const file_mapping&) = delete;
+
+    ~file_mapping() { ::munmap(address, length); }
+
+    /// How the file is mapped.
+    mapping mode;
+
+    /// The start of the mapped file.
+    std::byte* address;
+
+    /// The number of bytes mapped.
+    std::size_t length;
+};
+
+/**********************************************************************************************************************\
+* flash_store::snapshot                                                                                                *
+\**********************************************************************************************************************/
+
+std::size_t flash_store::snapshot::size() const noexcept
+{
+    return _size;
+}
+
+/**********************************************************************************************************************\
+* flash_store                                                                                                          *
+\**********************************************************************************************************************/
+
+flash_store::flash_store(std::size_t num_bytes, std::byte fill)
+        : _size(num_bytes)
+        , _sectors((num_bytes + sector_size - 1) / sector_size)
+        , _version(0)
+        , _generation(0)
+        , _fill(fill)
+        , _mapping()
+{
+    for (sector& s : _sectors)
+    {
+        s.data       = nullptr;
+        s.filled     = true;
+        s.fill       = fill;
+        s.generation = _generation;
+    }
+}
+
+flash_store::flash_store(const snapshot& s)
+        : flash_store(s._size)
+{
+    for (std::size_t i = 0; i < _sectors.size(); ++i)
+    {
+        sector& to = _sectors[i];
+        to.owned   = s._sectors[i].data;
+        to.data    = to.owned.get();
+        to.filled  = !to.owned;
+        to.fill    = s._sectors[i].fill;
+    }
+}
+
+flash_store flash_store::map_file(const std::string& path, mapping mode)
+{
+    auto        file = std::make_unique<file_mapping>(path, mode);
+    flash_store store(file->length);
+    for (std::size_t i = 0; i < store._sectors.size(); ++i)
+    {
+        store._sectors[i].data   = file->address + i * sector_size;
+        store._sectors[i].filled = false;
+    }
+    store._mapping = std::move(file);
+    return store;
+}
+
+flash_store::flash_store(flash_store&& other) noexcept = default;
+
+flash_store::~flash_store()
+{
+    // Destructors can't report errors, so a failed sync is silently dropped here. Call sync explicitly to find out.
+    try
+    {
+        sync();
+    }
+    catch (const std::system_error&)
+    {
+    }
+}
+
+bool flash_store::mapped() const noexcept
+{
+    return _mapping != nullptr;
+}
+
+void flash_store::sync()
+{
+    if (!_mapping || _mapping->mode != mapping::shared)
+        return;
+    for (std::size_t i = 0; i < _sectors.size(); ++i)
+        if (!current(_sectors[i]) || _sectors[i].filled)
+            materialize(i);
+    if (::msync(_mapping->address, _mapping->length, MS_SYNC) != 0)
+        throw std::system_error(errno, std::generic_category(), "Cannot sync flash image");
+}
+
+std::size_t flash_store::size() const noexcept
+{
+    return _size;
+}
+
+std::size_t flash_store::num_sectors() const noexcept
+{
+    return _sectors.size();
+}
+
+std::size_t flash_store::num_materialized_sectors() const noexcept
+{
+    return std::count_if(
+        std::begin(_sectors), std::end(_sectors), [this](const sector& s) { return current(s) && !s.filled; });
+}
+
+bool flash_store::sector_dirty(std::size_t index) const
+{
+    const sector& s = _sectors.at(index);
+    return current(s) && !s.filled;
+}
+
+std::uint64_t flash_store::version() const noexcept
+{
+    return _version;
+}
+
+std::byte flash_store::read(std::size_t address) const
+{
+    check_range(address, 1);
+    const sector& s = _sectors[address / sector_size];
+    if (!current(s))
+        return _fill;
+    return s.filled ? s.fill : s.data[address % sector_size];
+}
+
+void flash_store::read(std::size_t address, std::span<std::byte> out) const
+{
+    check_range(address, out.size());
+    while (!out.empty())
+    {
+        const sector& s      = _sectors[address / sector_size];
+        std::size_t   offset = address % sector_size;
+        std::size_t   count  = std::min(out.size(), sector_size - offset);
+        if (!current(s))
+            std::fill_n(out.data(), count, _fill);
+        else if (s.filled)
+            std::fill_n(out.data(), count, s.fill);
+        else
+            std::memcpy(out.data(), s.data + offset, count);
+        address += count;
+        out = out.subspan(count);
+    }
+}
+
+std::size_t flash_store::find_not(std::size_t address, std::size_t num_bytes, std::byte value) const
+{
+    check_range(address, num_bytes);
+    for (std::size_t end = address + num_bytes; address != end;)
+    {
+        const sector& s      = _sectors[address / sector_size];
+        std::size_t   offset = address % sector_size;
+        std::size_t   count  = std::min(end - address, sector_size - offset);
+        if (!current(s) || s.filled)
+        {
+            if ((current(s) ? s.fill : _fill) != value)
+                return address;
+        }
+        else
+        {
+            const std::byte* first = s.data + offset;
+            const std::byte* found = find_not_value(first, first + count, value);
+            if (found != first + count)
+                return address + static_cast<std::size_t>(found - first);
+        }
+        address += count;
+    }
+    return address;
+}
+
+std::size_t flash_store::mismatch(std::size_t address, std::span<const std::byte> data) const
+{
+    check_range(address, data.size());
+    while (!data.empty())
+    {
+        const sector& s      = _sectors[address / sector_size];
+        std::size_t   offset = address % sector_size;
+        std::size_t   count  = std::min(data.size(), sector_size - offset);
+        std::size_t   found  = 0;
+        if (!current(s) || s.filled)
+        {
+            const std::byte* first = data.data();
+            found = static_cast<std::size_t>(find_not_value(first, first + count, current(s) ? s.fill : _fill) - first);
+        }
+        else
+            found = find_mismatch(s.data + offset, data.data(), count);
+        if (found != count)
+            return address + found;
+        address += count;
+        data = data.subspan(count);
+    }
+    return address;
+}
+
+void flash_store::write(std::size_t address, std::span<const std::byte> data)
+{
+    check_range(address, data.size());
+    while (!data.empty())
+    {
+        std::size_t offset = address % sector_size;
+        std::size_t count  = std::min(data.size(), sector_size - offset);
+        std::memcpy(materialize(address / sector_size) + offset, data.data(), count);
+        address += count;
+        data = data.subspan(count);
+    }
+    ++_version;
+}
+
+void flash_store::fill(std::byte value) noexcept
+{
+    ++_generation;
+    _fill = value;
+    ++_version;
+}
+
+void flash_store::fill_sectors(std::size_t first, std::size_t count, std::byte value)
+{
+    if (first >= _sectors.size())
+        throw std::out_of_range("Sector is beyond the end of the flash store.");
+    count = std::min(count, _sectors.size() - first);
+    for (sector& s : std::span(_sectors).subspan(first, count))
+    {
+        s.filled     = true;
+        s.fill       = value;
+        s.generation = _generation;
+    }
+    ++_version;
+}
+
+void flash_store::flatten(std::vector<std::byte>& out) const
+{
+    out.resize(_size);
+    read(0, out);
+}
+
+flash_store::snapshot flash_store::take_snapshot()
+{
+    snapshot result;
+    result._size = _size;
+    result._sectors.resize(_sectors.size());
+    for (std::size_t i = 0; i < _sectors.size(); ++i)
+    {
+        sector&           from = _sectors[i];
+        snapshot::sector& to   = result._sectors[i];
+        if (!current(from) || from.filled)
+        {
+            to.fill = current(from) ? from.fill : _fill;
+            continue;
+        }
+        if (!from.owned)
+        {
+            // The sector refers to the image file, which the store keeps writing to, so the snapshot needs a copy.
+            to.data = std::make_shared_for_overwrite<std::byte[]>(sector_size);
+            std::memcpy(to.data.get(), from.data, sector_bytes(i));
+            if (_mapping->mode == mapping::shared)
+                continue;
+            from.owned = to.data;
+            from.data  = from.owned.get();
+        }
+        to.data = from.owned;
+    }
+    return result;
+}
+
+void flash_store::restore(const snapshot& s)
+{
+    if (s._size != _size)
+        throw std::invalid_argument("Snapshot is not the same size as the flash store.");
+    bool write_through = _mapping && _mapping->mode == mapping::shared;
+    for (std::size_t i = 0; i < _sectors.size(); ++i)
+    {
+        sector&                 to   = _sectors[i];
+        const snapshot::sector& from = s._sectors[i];
+        to.generation                = _generation;
+        if (!from.data)
+        {
+            to.filled = true;
+            to.fill   = from.fill;
+        }
+        else if (write_through)
+        {
+            std::memcpy(to.data, from.data.get(), sector_bytes(i));
+            to.filled = false;
+        }
+        else if (to.filled || to.owned != from.data)
+        {
+            to.owned  = from.data;
+            to.data   = to.owned.get();
+            to.filled = false;
+        }
+    }
+    ++_version;
+}
+
+bool flash_store::current(const sector& s) const noexcept
+{
+    return s.generation == _generation;
+}
+
+std::byte* flash_store::materialize(std::size_t index)
+{
+    sector& s = _sectors[index];
+    if (!current(s))
+    {
+        s.filled     = true;
+        s.fill       = _fill;
+        s.generation = _generation;
+    }
+
+    // Storage shared with a snapshot must not change, so the sector gets storage of its own before it is written.
+    bool shared = s.owned && s.owned.use_count() > 1;
+    if (s.filled)
+    {
+        if (!s.data || shared)
+        {
+            s.owned = std::make_shared_for_overwrite<std::byte[]>(sector_size);
+            s.data  = s.owned.get();
+        }
+        std::fill_n(s.data, sector_bytes(index), s.fill);
+        s.filled = false;
+    }
+    else if (shared)
+    {
+        auto copy = std::make_shared_for_overwrite<std::byte[]>(sector_size);
+        std::memcpy(copy.get(), s.data, sector_bytes(index));
+        s.owned = std::move(copy);
+        s.data  = s.owned.get();
+    }
+    return s.data;
+}
+
+std::size_t flash_store::sector_bytes(std::size_t index) const noexcept
+{
+    return std::min(sector_size, _size - index * sector_size);
+}
+
+void flash_store::check_range(std::size_t address, std::size_t num_bytes) const
+{
+    if (address > _size || num_bytes > _size - address)
+        throw std::out_of_range("Address range is beyond the end of the flash store.");
+}
+
+} // End namespace bedrock.
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace bedrock
+{
+
+/// Sparse, sector-granular storage for the bytes of a flash chip.
+///
+/// Every sector is either filled, meaning every byte has the same value as it does for a freshly made or freshly erased
+/// sector, or dirty, meaning it holds written data. A filled sector is stored as just its fill value. Storage for a
+/// sector is only allocated the first time it is written, so a large chip that is mostly untouched costs very little
+/// memory, and filling a range of sectors only costs time proportional to the number of sectors.
+///
+/// Filling the whole store, as a chip erase does, takes constant time: it starts a new fill generation, and every
+/// sector last touched in an older generation reads as the new fill value. The storage of such stale sectors is kept
+/// and reused the next time they are written.
+///
+/// A store can also be backed by a memory-mapped image file, in which case every sector refers directly to the mapped
+/// file and nothing is copied up front.
+///
+/// The contents of a store can be captured in a snapshot and restored later, or used to make new stores. Snapshots
+/// share the storage of written sectors copy-on-write, so taking or restoring one only costs time proportional to the
+/// number of sectors, and a sector is only copied when it is next written.
+class flash_store
+{
+public:
+    /// The contents of a store at some point in time, as taken by take_snapshot.
+    ///
+    /// A snapshot never changes, so it can be restored into or used to make any number of stores, including from
+    /// several threads at the same time.
+    class snapshot
+    {
+    public:
+        /// The number of bytes in the store the snapshot was taken from.
+        std::size_t size() const noexcept;
+
+    private:
+        friend class flash_store;
+
+        /// A single sector of the snapshot.
+        struct sector
+        {
+            /// The bytes of the sector, shared with any store using them, or nullptr if the sector is filled.
+            std::shared_ptr<std::byte[]> data;
+
+            /// The value of every byte of the sector when data is nullptr.
+            std::byte fill;
+        };
+
+        /// The number of bytes in the store.
+        std::size_t _size = 0;
+
+        /// Every sector of the store.
+        std::vector<sector> _sectors;
+    };
+
+    /// The number of bytes in a sector, the granularity at which storage is allocated.
+    static constexpr std::size_t sector_size = 4096;
+
+    /// How a store maps an image file.
+    enum class mapping
+    {
+        /// Changes are private to the store and never reach the file. Pages of the file are shared with anything else
+        /// mapping it until they are written.
+        copy_on_write,
+
+        /// Changes are written through to the file, so the file holds the final state of the chip without any separate
+        /// serialization step.
+        shared
+    };
+
+    /// Makes a new store in which every byte has the given value.
+    ///
+    /// \param num_bytes The number of bytes in the store.
+    /// \param fill The initial value of every byte.
+    explicit flash_store(std::size_t num_bytes, std::byte fill = std::byte{0x00});
+
+    /// Makes a new store with the contents of a snapshot. The storage of written sectors is shared with the snapshot
+    /// until the store writes to them.
+    explicit flash_store(const snapshot& s);
+
+    /// Makes a new store backed by a memory-mapped image file. The store has the same size as the file.
+    ///
+    /// \param path The image file to map.
+    /// \param mode How the file is mapped.
+    /// \throws std::system_error if the file can't be opened or mapped.
+    /// \throws std::invalid_argument if the file is empty.
+    static flash_store map_file(const std::string& path, mapping mode);
+
+    flash_store(flash_store&& other) noexcept;
+
+    /// Assigning over a store would implicitly drop any mapping without syncing it first, so it isn't allowed.
+    flash_store& operator=(flash_store&& other) = delete;
+
+    /// Syncs a shared mapping before unmapping it.
+    ~flash_store();
+
+    /// Whether or not the store is backed by a memory-mapped image file.
+    bool mapped() const noexcept;
+
+    /// For a store with a shared mapping, makes sure the file reflects the contents of the store and flushes it to
+    /// disk. Sectors that were filled but not written since are written out to the file first. Does nothing for any
+    /// other store.
+    ///
+    /// \throws std::system_error if the file couldn't be flushed.
+    void sync();
+
+    /// The number of bytes in the store.
+    std::size_t size() const noexcept;
+
+    /// The number of sectors in the store. The last sector may be partial if the size is not a multiple of the sector
+    /// size.
+    std::size_t num_sectors() const noexcept;
+
+    /// The number of dirty sectors, i.e. sectors that hold written data rather than a single fill value.
+    std::size_t num_materialized_sectors() const noexcept;
+
+    /// Whether or not the sector with the given index is dirty, i.e. holds written data rather than a fill value.
+    ///
+    /// \throws std::out_of_range if there is no such sector.
+    bool sector_dirty(std::size_t index) const;
+
+    /// A counter that changes every time the contents of the store are modified.
+    std::uint64_t version() const noexcept;
+
+    /// Reads a single byte.
+    ///
+    /// \throws std::out_of_range if the address is beyond the end of the store.
+    std::byte read(std::size_t address) const;
+
+    /// Reads a range of bytes starting at the given address.
+    ///
+    /// \throws std::out_of_range if the range extends beyond the end of the store.
+    void read(std::size_t address, std::span<std::byte> out) const;
+
+    /// Finds the first byte of a range that doesn't have the given value. Filled sectors are checked in constant time,
+    /// and written sectors a word at a time.
+    ///
+    /// \returns The address of the byte, or address + num_bytes if every byte of the range has the value.
+    /// \throws std::out_of_range if the range extends beyond the end of the store.
+    std::size_t find_not(std::size_t address, std::size_t num_bytes, std::byte value) const;
+
+    /// Finds the first byte of a range starting at the given address that differs from the corresponding byte of data.
+    /// Filled sectors are compared against their fill value, and written sectors a word at a time.
+    ///
+    /// \returns The address of the byte, or address + data.size() if the whole range matches.
+    /// \throws std::out_of_range if the range extends beyond the end of the store.
+    std::size_t mismatch(std::size_t address, std::span<const std::byte> data) const;
+
+    /// Writes a range of bytes starting at the given address, allocating storage for any sector that needs it.
+    ///
+    /// \throws std::out_of_range if the range extends beyond the end of the store. Nothing is written in that case.
+    void write(std::size_t address, std::span<const std::byte> data);
+
+    /// Sets every byte of the store to the given value in constant time.
+    void fill(std::byte value) noexcept;
+
+    /// Sets every byte of a range of whole sectors to the given value. The storage of the sectors is kept so it can be
+    /// reused the next time the sectors are written.
+    ///
+    /// \param first The index of the first sector to fill.
+    /// \param count The number of sectors to fill. The range is clipped to the end of the store.
+    /// \throws std::out_of_range if first is not the index of a sector.
+    void fill_sectors(std::size_t first, std::size_t count, std::byte value);
+
+    /// Copies the whole store into a contiguous vector.
+    void flatten(std::vector<std::byte>& out) const;
+
+    /// Captures the current contents of the store.
+    ///
+    /// Written sectors are shared with the snapshot rather than copied. The exception is a store backed by an image
+    /// file: its written sectors are copied into the snapshot, and with a copy-on-write mapping the store then keeps
+    /// using the copies, so later snapshots and restores of those sectors cost nothing more.
+    snapshot take_snapshot();
+
+    /// Sets the contents of the store back to those of a snapshot, which may have been taken from any store of the
+    /// same size.
+    ///
+    /// A sector still sharing its storage with the snapshot is left alone, every other sector is pointed at the
+    /// snapshot's storage, so nothing is copied. With a shared mapping the sectors must stay in the image file, so they
+    /// are copied back into it instead.
+    ///
+    /// \throws std::invalid_argument if the snapshot has a different size than the store.
+    void restore(const snapshot& s);
+
+private:
+    /// A memory-mapped image file.
+    struct file_mapping;
+
+    /// A single sector of the store.
+    struct sector
+    {
+        /// The bytes of the sector, either in owned or in the mapped image file. This is nullptr if the sector has
+        /// never had any storage.
+        std::byte* data;
+
+        /// Storage allocated for the sector, if it isn't mapped. This may be shared with snapshots, in which case it is
+        /// never written to and the sector gets storage of its own before it is next written.
+        std::shared_ptr<std::byte[]> owned;
+
+        /// Whether every byte of the sector has the value fill, in which case the contents of data are meaningless.
+        bool filled;
+
+        /// The value of every byte of the sector when filled is set.
+        std::byte fill;
+
+        /// The fill generation in which the sector was last written. If this isn't the store's current generation,
+        /// then neither data, filled, nor fill are meaningful and every byte of the sector has the store's fill value.
+        std::uint64_t generation;
+    };
+
+    /// Whether or not the sector was written in the current fill generation.
+    bool current(const sector& s) const noexcept;
+
+    /// Brings a sector into the current fill generation and makes sure it has storage holding its bytes, so it can be
+    /// written.
+    std::byte* materialize(std::size_t index);
+
+    /// The number of bytes in the sector with the given index, less than sector_size for a partial last sector.
+    std::size_t sector_bytes(std::size_t index) const noexcept;
+
+    /// Throws std::out_of_range if the given range extends beyond the end of the store.
+    void check_range(std::size_t address, std::size_t num_bytes) const;
+
+    /// The number of bytes in the store.
+    std::size_t _size;
+
+    /// Every sector of the store.
+    std::vector<sector> _sectors;
+
+    /// Changes every time the contents of the store are modified.
+    std::uint64_t _version;
+
+    /// The current fill generation.
+    std::uint64_t _generation;
+
+    /// The value of every byte of a sector that was not written in the current fill generation.
+    std::byte _fill;
+
+    /// The image file backing the store, or nullptr if the store isn't mapped.
+    std::unique_ptr<file_mapping> _mapping;
+};
+
+} // End namespace bedrock.
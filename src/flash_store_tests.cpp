@@ -0,0 +1,203 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "flash_store.hpp"
+
+namespace bedrock::test
+{
+
+TEST_CASE("flash_store", "[flash_store]")
+{
+    // A size that isn't a multiple of the sector size, like the default flash_sim size.
+    flash_store store(3 * flash_store::sector_size - 1);
+    REQUIRE(store.num_sectors() == 3);
+    REQUIRE(store.num_materialized_sectors() == 0);
+    REQUIRE(store.read(0) == std::byte{0x00});
+
+    // A write straddling a sector boundary only materializes the two sectors it touches.
+    std::vector<std::byte> data(16, std::byte{0xab});
+    auto                   version = store.version();
+    store.write(flash_store::sector_size - 8, data);
+    REQUIRE(store.version() != version);
+    REQUIRE(store.num_materialized_sectors() == 2);
+
+    std::vector<std::byte> flat;
+    store.flatten(flat);
+    REQUIRE(flat.size() == store.size());
+    REQUIRE(std::count(std::begin(flat), std::end(flat), std::byte{0xab}) == 16);
+    REQUIRE(flat[flash_store::sector_size - 9] == std::byte{0x00});
+    REQUIRE(flat[flash_store::sector_size + 8] == std::byte{0x00});
+
+    std::vector<std::byte> out(16);
+    store.read(flash_store::sector_size - 8, out);
+    REQUIRE(out == data);
+
+    store.fill(std::byte{0xff});
+    REQUIRE(store.num_materialized_sectors() == 0);
+    REQUIRE(store.read(flash_store::sector_size) == std::byte{0xff});
+
+    // Out of range accesses throw without writing anything.
+    REQUIRE_THROWS_AS(store.read(store.size()), std::out_of_range);
+    REQUIRE_THROWS_AS(store.write(store.size() - 8, data), std::out_of_range);
+    REQUIRE(store.num_materialized_sectors() == 0);
+}
+
+TEST_CASE("flash_store fill generations", "[flash_store]")
+{
+    flash_store            store(4 * flash_store::sector_size);
+    std::vector<std::byte> data(8, std::byte{0x12});
+    store.write(100, data);
+    store.write(flash_store::sector_size * 2, data);
+
+    // Filling doesn't touch any sector, but every sector reads back as the new value.
+    store.fill(std::byte{0xff});
+    REQUIRE(store.num_materialized_sectors() == 0);
+    REQUIRE(store.read(100) == std::byte{0xff});
+
+    // Writing a stale sector reuses its storage, and the rest of the sector reads as the fill value.
+    store.write(104, data);
+    REQUIRE(store.num_materialized_sectors() == 1);
+    REQUIRE(store.read(100) == std::byte{0xff});
+    REQUIRE(store.read(104) == std::byte{0x12});
+
+    std::vector<std::byte> flat;
+    store.flatten(flat);
+    REQUIRE(std::count(std::begin(flat), std::end(flat), std::byte{0x12}) == 8);
+    REQUIRE(std::count(std::begin(flat), std::end(flat), std::byte{0xff}) == static_cast<long>(flat.size() - 8));
+}
+
+TEST_CASE("flash_store find_not and mismatch", "[flash_store]")
+{
+    flash_store store(3 * flash_store::sector_size, std::byte{0xff});
+    REQUIRE(store.find_not(0, store.size(), std::byte{0xff}) == store.size());
+    REQUIRE(store.find_not(0, 1, std::byte{0x00}) == 0);
+
+    // The byte is past the first block compared a word at a time, and in a sector that isn't the first.
+    std::vector<std::byte> data(100, std::byte{0xff});
+    data[70] = std::byte{0x12};
+    store.write(flash_store::sector_size + 10, data);
+    REQUIRE(store.find_not(0, store.size(), std::byte{0xff}) == flash_store::sector_size + 80);
+    REQUIRE(store.find_not(flash_store::sector_size + 81, 100, std::byte{0xff}) == flash_store::sector_size + 181);
+    REQUIRE_THROWS_AS(store.find_not(1, store.size(), std::byte{0xff}), std::out_of_range);
+
+    std::vector<std::byte> image(store.size(), std::byte{0xff});
+    REQUIRE(store.mismatch(0, image) == flash_store::sector_size + 80);
+    image[flash_store::sector_size + 80] = std::byte{0x12};
+    REQUIRE(store.mismatch(0, image) == store.size());
+    image[5] = std::byte{0x00};
+    REQUIRE(store.mismatch(0, image) == 5);
+    REQUIRE(store.mismatch(6, std::span(image).subspan(6)) == store.size());
+}
+
+TEST_CASE("flash_store snapshots", "[flash_store]")
+{
+    flash_store            store(4 * flash_store::sector_size);
+    std::vector<std::byte> data(16, std::byte{0xab});
+    store.fill(std::byte{0xff});
+    store.write(0, data);
+    store.fill_sectors(2, 1, std::byte{0x55});
+    auto snapshot = store.take_snapshot();
+    REQUIRE(snapshot.size() == store.size());
+
+    std::vector<std::byte> expected;
+    store.flatten(expected);
+
+    // Writing after a snapshot leaves the snapshot alone, even for the sector it shares with the store.
+    std::vector<std::byte> other(16, std::byte{0x12});
+    store.write(8, other);
+    store.write(3 * flash_store::sector_size, other);
+    store.fill(std::byte{0x00});
+    auto version = store.version();
+    store.restore(snapshot);
+    REQUIRE(store.version() != version);
+
+    std::vector<std::byte> flat;
+    store.flatten(flat);
+    REQUIRE(flat == expected);
+    REQUIRE(store.num_materialized_sectors() == 1);
+
+    // A store made from the snapshot, and a second restore, see the same contents.
+    flash_store copy(snapshot);
+    copy.write(0, other);
+    store.restore(snapshot);
+    store.flatten(flat);
+    REQUIRE(flat == expected);
+    REQUIRE(copy.read(0) == std::byte{0x12});
+    REQUIRE(copy.read(20) == std::byte{0xff});
+    REQUIRE(copy.read(2 * flash_store::sector_size) == std::byte{0x55});
+
+    flash_store smaller(flash_store::sector_size);
+    REQUIRE_THROWS_AS(smaller.restore(snapshot), std::invalid_argument);
+}
+
+TEST_CASE("flash_store mapped files", "[flash_store]")
+{
+    auto path = std::filesystem::temp_directory_path() / "bedrock_flash_store_test.bin";
+    {
+        std::ofstream image(path, std::ios::binary);
+        for (int i = 0; i < 2 * static_cast<int>(flash_store::sector_size) + 10; ++i)
+            image.put(static_cast<char>(i));
+    }
+    auto file_contents = [&path] {
+        std::ifstream     image(path, std::ios::binary);
+        std::vector<char> contents{std::istreambuf_iterator<char>(image), std::istreambuf_iterator<char>()};
+        return contents;
+    };
+    std::vector<std::byte> data(4, std::byte{0xee});
+
+    SECTION("copy_on_write")
+    {
+        {
+            auto store = flash_store::map_file(path.string(), flash_store::mapping::copy_on_write);
+            REQUIRE(store.mapped());
+            REQUIRE(store.size() == 2 * flash_store::sector_size + 10);
+            REQUIRE(store.read(5) == std::byte{5});
+            store.write(0, data);
+            REQUIRE(store.read(0) == std::byte{0xee});
+        }
+        REQUIRE(file_contents()[0] == 0);
+    }
+
+    SECTION("copy_on_write snapshots")
+    {
+        // The written sector is copied out of the mapping once, and restoring it afterwards copies nothing.
+        auto store    = flash_store::map_file(path.string(), flash_store::mapping::copy_on_write);
+        auto snapshot = store.take_snapshot();
+        store.write(0, data);
+        store.restore(snapshot);
+        REQUIRE(store.read(0) == std::byte{0});
+        REQUIRE(store.read(flash_store::sector_size + 5) == std::byte{5});
+    }
+
+    SECTION("shared")
+    {
+        {
+            auto store = flash_store::map_file(path.string(), flash_store::mapping::shared);
+            store.fill(std::byte{0xff});
+            store.write(flash_store::sector_size, data);
+
+            // Restoring a shared mapping writes the snapshot back into the file.
+            auto snapshot = store.take_snapshot();
+            store.write(0, data);
+            store.restore(snapshot);
+            REQUIRE(store.read(0) == std::byte{0xff});
+        }
+
+        // Both the write and the fill of every sector that wasn't written since end up in the file.
+        auto contents = file_contents();
+        REQUIRE(contents.size() == 2 * flash_store::sector_size + 10);
+        REQUIRE(std::count(std::begin(contents), std::end(contents), static_cast<char>(0xee)) == 4);
+        REQUIRE(std::count(std::begin(contents), std::end(contents), static_cast<char>(0xff))
+                == static_cast<long>(contents.size() - 4));
+    }
+
+    std::filesystem::remove(path);
+    REQUIRE_THROWS_AS(flash_store::map_file(path.string(), flash_store::mapping::shared), std::system_error);
+}
+
+} // End namespace bedrock::test.
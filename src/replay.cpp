@@ -0,0 +1,268 @@
+#include "replay.hpp"
+
+#include <algorithm>
+#include <array>
+
+#include "flash_sim_traits.hpp"
+#include "trace.hpp"
+
+namespace bedrock
+{
+
+namespace
+{
+
+/// Gets which IO pin an operation toggles, or a value past the last IO pin if it doesn't toggle one.
+std::size_t toggled_io(flash::user_operation op) noexcept
+{
+    switch (op)
+    {
+    case flash::user_operation::toggle_serial_input: return 0;
+    case flash::user_operation::toggle_io1: return 1;
+    case flash::user_operation::toggle_io2: return 2;
+    case flash::user_operation::toggle_io3: return 3;
+    default: return 4;
+    }
+}
+
+} // End anonymous namespace.
+
+/**********************************************************************************************************************\
+* replayer                                                                                                             *
+\**********************************************************************************************************************/
+
+replayer::replayer(flash& f)
+        : _flash(f)
+        , _ops()
+        , _selects(false)
+        , _selected(false)
+        , _levels(0)
+        , _bytes()
+        , _read()
+        , _stats()
+{
+}
+
+void replayer::replay(const user_operation_log& ops)
+{
+    // Decoding the log in chunks is much faster than visiting its operations one at a time.
+    std::array<flash::user_operation, 4096> chunk;
+    auto                                    last = ops.end();
+    for (auto it = ops.begin(); it != last;)
+        append(std::span(chunk).first(it.read(chunk, last)));
+    replay_command();
+}
+
+void replayer::replay(std::string_view ops)
+{
+    try
+    {
+        for (char c : ops)
+            push_back(_flash.char_to_user_operation(c));
+    }
+    catch (const std::invalid_argument&)
+    {
+        replay_command();
+        throw;
+    }
+    replay_command();
+}
+
+void replayer::replay(std::istream& trace)
+{
+    trace_reader       reader(trace);
+    user_operation_log frame;
+    while (reader.read_frame(frame))
+        replay(frame);
+}
+
+const replayer::stats& replayer::get_stats() const noexcept
+{
+    return _stats;
+}
+
+void replayer::append(std::span<const flash::user_operation> ops)
+{
+    // Only chip enable toggles can start a new command, so everything between them is collected all at once.
+    while (!ops.empty())
+    {
+        auto toggle = std::find(std::begin(ops), std::end(ops), flash::user_operation::toggle_chip_enable);
+        _ops.insert(std::end(_ops), std::begin(ops), toggle);
+        if (toggle == std::end(ops))
+            break;
+        push_back(*toggle);
+        ops = ops.subspan(static_cast<std::size_t>(toggle - std::begin(ops)) + 1);
+    }
+}
+
+void replayer::push_back(flash::user_operation op)
+{
+    bool toggles_chip_enable = op == flash::user_operation::toggle_chip_enable;
+    if (toggles_chip_enable && !_selected)
+    {
+        replay_command();
+        _selects = true;
+    }
+    _ops.push_back(op);
+    if (toggles_chip_enable)
+        _selected = !_selected;
+}
+
+void replayer::replay_command()
+{
+    if (_ops.empty())
+        return;
+    _stats.num_operations += _ops.size();
+
+    // The operations are dropped even if one of them throws, so a failed command isn't replayed again.
+    try
+    {
+        apply_command();
+    }
+    catch (...)
+    {
+        _ops.clear();
+        _selects = false;
+        throw;
+    }
+    _ops.clear();
+    _selects = false;
+}
+
+void replayer::apply_command()
+{
+    // Anything that isn't a whole command, like waiting before the first command, just gets performed as is.
+    if (!_selects)
+    {
+        perform_from(0);
+        return;
+    }
+
+    // The chip is deselected, so it isn't driving any of the IO pins and they all read as the user set them.
+    _levels = 0;
+    for (std::size_t io = 0; io < 4; ++io)
+        if (_flash.get_io(io) == flash::pin_state::high)
+            _levels |= 1u << io;
+    if (transfer_read())
+        return;
+    _flash.toggle_chip_enable();
+    std::size_t index = 1;
+
+    if (decode_bytes(index, 1, 1) != 1)
+        return perform_from(index);
+    _flash.clock_in_bytes(_bytes, 1);
+    // Commands are decoded following the same phases as the IS25LP128 that flash_sim simulates.
+    const flash_sim_phases& layout = phase_table<is25lp128_traits>[std::to_integer<std::size_t>(_bytes[0])];
+    if (!layout.known)
+        return perform_from(index);
+    ++_stats.num_commands;
+
+    if (layout.address_io != 0)
+    {
+        std::size_t num_bytes = (layout.address_bits + layout.dummy_cycles * layout.address_io) / 8;
+        bool        complete  = decode_bytes(index, layout.address_io, num_bytes) == num_bytes;
+        _flash.clock_in_bytes(_bytes, layout.address_io);
+        if (!complete)
+            return perform_from(index);
+    }
+
+    if (layout.data_in_io != 0)
+    {
+        decode_bytes(index, layout.data_in_io, _ops.size());
+        _flash.clock_in_bytes(_bytes, layout.data_in_io);
+    }
+    else if (layout.data_out_io != 0)
+    {
+        // Clocking data out leaves the pins alone, so it is just a run of clock toggles.
+        std::size_t num_clocks = 0;
+        while (index + num_clocks < _ops.size() && _ops[index + num_clocks] == flash::user_operation::toggle_clock)
+            ++num_clocks;
+        std::size_t clocks_per_byte = 8 / layout.data_out_io;
+        _bytes.resize(num_clocks / clocks_per_byte);
+        _flash.clock_out_bytes(_bytes, layout.data_out_io);
+        index += _bytes.size() * clocks_per_byte;
+    }
+
+    // Deselecting the chip, and whatever follows while it is deselected, is performed as is.
+    perform_from(index);
+}
+
+bool replayer::transfer_read()
+{
+    // Nothing is applied while decoding, so giving up just means going back to the levels from before.
+    unsigned    levels = _levels;
+    std::size_t index  = 1;
+    auto        fail   = [&] {
+        _levels = levels;
+        return false;
+    };
+    if (decode_bytes(index, 1, 1) != 1)
+        return fail();
+    std::uint8_t            opcode = std::to_integer<std::uint8_t>(_bytes[0]);
+    const flash_sim_phases& layout = phase_table<is25lp128_traits>[opcode];
+    if (!layout.known || layout.address_bits != 24 || layout.address_io != 1 || layout.data_in_io != 0
+        || layout.data_out_io != 1 || layout.dummy_cycles % 8 != 0)
+        return fail();
+    std::size_t num_bytes = 3 + layout.dummy_cycles / 8;
+    if (decode_bytes(index, 1, num_bytes) != num_bytes)
+        return fail();
+
+    // The read has to clock out whole bytes, then deselect the chip.
+    std::size_t num_clocks = 0;
+    while (index + num_clocks < _ops.size() && _ops[index + num_clocks] == flash::user_operation::toggle_clock)
+        ++num_clocks;
+    index += num_clocks;
+    if (num_clocks == 0 || num_clocks % 8 != 0 || index == _ops.size()
+        || _ops[index] != flash::user_operation::toggle_chip_enable)
+        return fail();
+
+    std::uint32_t address = std::to_integer<std::uint32_t>(_bytes[0]) << 16
+                          | std::to_integer<std::uint32_t>(_bytes[1]) << 8 | std::to_integer<std::uint32_t>(_bytes[2]);
+    _read.resize(num_clocks / 8);
+    _flash.transfer(opcode, address, std::span(_bytes).subspan(3), _read);
+    ++_stats.num_commands;
+    perform_from(index + 1);
+    return true;
+}
+
+std::size_t replayer::decode_bytes(std::size_t& index, std::size_t num_io, std::size_t max_bytes)
+{
+    _bytes.clear();
+    const unsigned mask = (1u << num_io) - 1;
+    while (_bytes.size() != max_bytes)
+    {
+        // Every cycle toggles some of the IO pins, each at most once and from the highest IO down, then the clock.
+        unsigned    levels = _levels;
+        std::size_t i      = index;
+        unsigned    value  = 0;
+        for (std::size_t cycle = 0; cycle < 8 / num_io; ++cycle)
+        {
+            std::size_t previous_io = num_io;
+            for (; i < _ops.size() && _ops[i] != flash::user_operation::toggle_clock; ++i)
+            {
+                std::size_t io = toggled_io(_ops[i]);
+                if (io >= previous_io)
+                    return _bytes.size();
+                levels ^= 1u << io;
+                previous_io = io;
+            }
+            if (i == _ops.size())
+                return _bytes.size();
+            ++i;
+            value = (value << num_io) | (levels & mask);
+        }
+        _bytes.push_back(std::byte(value));
+        _levels = levels;
+        index   = i;
+    }
+    return _bytes.size();
+}
+
+void replayer::perform_from(std::size_t index)
+{
+    _stats.num_single_operations += _ops.size() - index;
+    for (std::size_t i = index; i < _ops.size(); ++i)
+        _flash.perform_user_operation(_ops[i]);
+}
+
+} // End namespace bedrock.
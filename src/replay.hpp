@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "flash.hpp"
+#include "user_operation_log.hpp"
+
+namespace bedrock
+{
+
+/// Replays recorded user operations onto a flash chip a whole command at a time.
+///
+/// The operations are split into commands, starting at every toggle of the chip-enable pin that selects the chip, just
+/// like the frames of a trace. Each command is decoded into its opcode, address, dummy cycles, and data, and every part
+/// is handed to the chip with flash::clock_in_bytes or flash::clock_out_bytes, so a chip that moves whole bytes at
+/// once, such as flash_sim, replays them without going through every operation. The chip ends up exactly as if every
+/// operation was performed one at a time, including the user operations flash_sim records.
+///
+/// Only operations that look exactly like what flash::clock_in_data_io and flash::clock_out_data_io produce are
+/// decoded. From the first operation that doesn't, such as a partial byte, an unknown opcode, or pins toggled in an
+/// unusual order, the rest of the command is performed one operation at a time, so any error is raised exactly where
+/// it would have been otherwise.
+class replayer
+{
+public:
+    /// How the operations replayed so far were applied.
+    struct stats
+    {
+        /// The number of operations replayed.
+        std::size_t num_operations = 0;
+
+        /// The number of commands that were decoded, at least up to their opcode and layout.
+        std::size_t num_commands = 0;
+
+        /// The number of operations that were performed one at a time rather than as part of a decoded command.
+        std::size_t num_single_operations = 0;
+    };
+
+    /// Makes a new replayer. The chip must be deselected.
+    ///
+    /// \param f The chip to replay onto. It must outlive the replayer.
+    explicit replayer(flash& f);
+
+    /// Replays every operation of a log.
+    void replay(const user_operation_log& ops);
+
+    /// Replays operations serialized with flash::user_operation_to_char.
+    ///
+    /// \throws std::invalid_argument if a character isn't a serialized operation. Every operation before it has been
+    /// replayed by then.
+    void replay(std::string_view ops);
+
+    /// Replays every frame of a trace, as written by trace_writer.
+    ///
+    /// \throws std::runtime_error if the trace is corrupt. Every frame before the corrupt one has been replayed by
+    /// then.
+    void replay(std::istream& trace);
+
+    /// Gets how the operations replayed so far were applied.
+    const stats& get_stats() const noexcept;
+
+private:
+    /// Adds operations to the commands being collected, replaying every command that is complete.
+    void append(std::span<const flash::user_operation> ops);
+
+    /// Adds an operation to the command being collected, replaying the previous command first if this one starts a new
+    /// command.
+    void push_back(flash::user_operation op);
+
+    /// Replays the command that has been collected, then drops it.
+    void replay_command();
+
+    /// Applies the command that has been collected to the chip, decoding as much of it as possible.
+    void apply_command();
+
+    /// Applies the command that has been collected with flash::transfer, if it is a read clocked entirely over a single
+    /// IO pin, so that a chip with a read cache can answer it without clocking anything.
+    ///
+    /// \returns Whether or not the command was applied.
+    bool transfer_read();
+
+    /// Decodes whole bytes clocked in over num_io IO pins from the collected operations, starting at index.
+    ///
+    /// \param index The index of the first operation to decode. Moves past every byte decoded.
+    /// \param num_io The number of IO pins carrying bits every clock cycle.
+    /// \param max_bytes The most bytes to decode.
+    /// \returns The number of bytes decoded into _bytes.
+    std::size_t decode_bytes(std::size_t& index, std::size_t num_io, std::size_t max_bytes);
+
+    /// Performs the collected operations from index onwards one at a time.
+    void perform_from(std::size_t index);
+
+    /// The chip being replayed onto.
+    flash& _flash;
+
+    /// The operations of the command being collected.
+    std::vector<flash::user_operation> _ops;
+
+    /// Whether or not the command being collected starts by selecting the chip.
+    bool _selects;
+
+    /// Whether or not the chip is selected after every operation collected so far.
+    bool _selected;
+
+    /// The levels of the IO pins as set by the user, as of the operations decoded so far, with IO0 in the least
+    /// significant bit.
+    unsigned _levels;
+
+    /// Decoded bytes waiting to be clocked in.
+    std::vector<std::byte> _bytes;
+
+    /// The bytes read by transfer_read.
+    std::vector<std::byte> _read;
+
+    /// How the operations replayed so far were applied.
+    stats _stats;
+};
+
+} // End namespace bedrock.
@@ -0,0 +1,139 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "flash_sim.hpp"
+#include "replay.hpp"
+#include "trace.hpp"
+
+namespace bedrock::test
+{
+
+TEST_CASE("replay", "[replay]")
+{
+    // Records a session with every kind of command, including a page program that ends part of the way into a byte.
+    flash_sim recorded(0x4000);
+    auto      simple = [&recorded](std::uint8_t opcode) {
+        recorded.toggle_chip_enable();
+        recorded.clock_in_data<8>(opcode);
+        recorded.toggle_chip_enable();
+    };
+    simple(0x06);
+    simple(0x60);
+    std::vector<std::byte> page(flash_sim::page_size);
+    for (std::size_t i = 0; i < page.size(); ++i)
+        page[i] = std::byte(i * 7);
+    for (std::uint32_t address : {0x1000, 0x2000, 0x3000})
+    {
+        simple(0x06);
+        recorded.toggle_chip_enable();
+        recorded.clock_in_data<8>(address == 0x2000 ? 0x32 : 0x02);
+        recorded.clock_in_data<24>(address);
+        auto data = std::span(page).first(address == 0x3000 ? 100 : page.size());
+        recorded.clock_in_bytes(data, address == 0x2000 ? 4 : 1);
+        if (address == 0x3000)
+            recorded.clock_in_data<3>(5);
+        recorded.toggle_chip_enable();
+        recorded.wait_for_write_complete();
+    }
+    std::vector<std::byte> out(0x100);
+    for (std::uint8_t opcode : {0x03, 0x0b, 0x6b, 0xeb})
+    {
+        recorded.toggle_chip_enable();
+        recorded.clock_in_data<8>(opcode);
+        std::vector<std::byte> address{std::byte{0x00}, std::byte{0x10}, std::byte{0x80}};
+        recorded.clock_in_bytes(address, opcode == 0xeb ? 4 : 1);
+        if (opcode != 0x03)
+            recorded.clock_in_bytes(std::vector<std::byte>(opcode == 0xeb ? 3 : 1), opcode == 0xeb ? 4 : 1);
+        recorded.clock_out_bytes(out, opcode == 0x6b || opcode == 0xeb ? 4 : 1);
+        recorded.toggle_chip_enable();
+    }
+    simple(0x06);
+    recorded.toggle_chip_enable();
+    recorded.clock_in_data<8>(0x20);
+    recorded.clock_in_data<24>(0x1000);
+    recorded.toggle_chip_enable();
+    const user_operation_log& ops = recorded.get_user_operations();
+
+    // The replayed chip ends up identical, down to the operations it recorded.
+    auto same = [&recorded](const flash_sim& replayed) {
+        REQUIRE(replayed.get_data() == recorded.get_data());
+        REQUIRE(std::equal(std::begin(replayed.get_user_operations()),
+                           std::end(replayed.get_user_operations()),
+                           std::begin(recorded.get_user_operations()),
+                           std::end(recorded.get_user_operations())));
+    };
+
+    SECTION("log")
+    {
+        flash_sim replayed(0x4000);
+        replayer  r(replayed);
+        r.replay(ops);
+        same(replayed);
+        REQUIRE(r.get_stats().num_operations == ops.size());
+        REQUIRE(r.get_stats().num_commands == 14);
+
+        // Only the end of every command and the partial byte are performed one at a time.
+        REQUIRE(r.get_stats().num_single_operations < 100);
+    }
+
+    SECTION("characters")
+    {
+        std::string chars;
+        for (flash::user_operation op : ops)
+            chars.push_back(recorded.user_operation_to_char(op));
+        flash_sim replayed(0x4000);
+        replayer  r(replayed);
+        r.replay(chars);
+        same(replayed);
+        REQUIRE_THROWS_AS(r.replay(std::string_view("ecx")), std::invalid_argument);
+    }
+
+    SECTION("trace")
+    {
+        std::stringstream stream;
+        {
+            trace_writer writer(stream);
+            writer.write(ops);
+        }
+        flash_sim replayed(0x4000);
+        replayer  r(replayed);
+        r.replay(stream);
+        same(replayed);
+    }
+
+    SECTION("read cache")
+    {
+        // Single IO reads are replayed with transfer, so reads repeated on every run are answered from the cache.
+        flash_sim boot(0x4000);
+        boot.read(0x1080, out);
+        boot.transfer(0x0b, 0x2000, std::vector<std::byte>(1), out);
+        flash_sim replayed(0x4000);
+        replayer  r(replayed);
+        replayed.set_read_cache_capacity(16);
+        for (int i = 0; i < 3; ++i)
+            r.replay(boot.get_user_operations());
+        REQUIRE(replayed.get_read_cache_stats().hits == 4);
+        REQUIRE(replayed.get_read_cache_stats().misses == 2);
+        REQUIRE(r.get_stats().num_commands == 6);
+        REQUIRE(replayed.get_user_operations().size() == 3 * boot.get_user_operations().size());
+    }
+
+    SECTION("errors")
+    {
+        // Errors are raised by the operation that causes them, just as without the replayer.
+        user_operation_log bad;
+        bad.push_back(flash::user_operation::toggle_chip_enable);
+        for (int i = 0; i < 8; ++i)
+            bad.push_back(flash::user_operation::toggle_clock);
+        flash_sim replayed(0x4000);
+        replayer  r(replayed);
+        REQUIRE_THROWS_AS(r.replay(bad), std::out_of_range);
+        REQUIRE(replayed.get_user_operations().size() == bad.size());
+    }
+}
+
+} // End namespace bedrock::test.
@@ -0,0 +1,249 @@
+#include "trace.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace bedrock
+{
+
+namespace
+{
+
+/// Appends a value to a buffer as a LEB128 varint.
+void write_varint(std::string& out, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/// Reads a LEB128 varint from the front of a buffer, removing it from the buffer.
+///
+/// \returns false if the buffer ends before the varint does, or the varint doesn't fit in 64 bits.
+bool read_varint(std::string_view& in, std::uint64_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64 && !in.empty(); shift += 7)
+    {
+        auto byte = static_cast<std::uint8_t>(in.front());
+        in.remove_prefix(1);
+        value |= std::uint64_t{byte & 0x7fu} << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+/// Reads a LEB128 varint from a stream.
+///
+/// \returns false if the stream ends before the varint does, or the varint doesn't fit in 64 bits.
+bool read_varint(std::istream& in, std::uint64_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        int byte = in.get();
+        if (byte == std::istream::traits_type::eof())
+            return false;
+        value |= std::uint64_t{static_cast<std::uint8_t>(byte) & 0x7fu} << shift;
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+/// The most bytes of a frame read at once. A frame header can claim any size, so reading a frame a chunk at a time
+/// means a truncated frame fails before much more is allocated than the stream actually holds.
+constexpr std::size_t read_chunk_bytes = 0x100000;
+
+} // End anonymous namespace.
+
+/**********************************************************************************************************************\
+* trace_writer                                                                                                         *
+\**********************************************************************************************************************/
+
+trace_writer::trace_writer(std::ostream& out)
+        : _out(out)
+        , _frame()
+        , _selected(false)
+        , _num_frames(0)
+{
+    _out.write(trace_format::magic, sizeof(trace_format::magic));
+    _out.put(static_cast<char>(trace_format::version));
+}
+
+trace_writer::~trace_writer()
+{
+    // Destructors can't report errors, so a stream that throws on failure has its error silently dropped here.
+    try
+    {
+        finish();
+    }
+    catch (const std::ios_base::failure&)
+    {
+    }
+}
+
+void trace_writer::push_back(flash::user_operation op)
+{
+    // Selecting the chip starts the next command, and so the next frame.
+    bool toggles_chip_enable = op == flash::user_operation::toggle_chip_enable;
+    if (toggles_chip_enable && !_selected && !_frame.empty())
+        finish();
+    _frame.push_back(op);
+    if (toggles_chip_enable)
+        _selected = !_selected;
+}
+
+void trace_writer::write(const user_operation_log& log)
+{
+    for (flash::user_operation op : log)
+        push_back(op);
+}
+
+void trace_writer::finish()
+{
+    if (_frame.empty())
+        return;
+
+    std::string payload;
+    std::size_t symbol_bytes = (_frame._num_symbols + 3) / 4;
+    write_varint(payload, _frame._num_symbols);
+    write_varint(payload, _frame._runs.size());
+    for (std::size_t i = 0; i < symbol_bytes;)
+    {
+        // Folding runs can leave stale bytes past the last symbol, which aren't part of the frame.
+        std::span<const std::uint8_t> chunk = _frame._symbols.contiguous(i);
+        std::size_t                   count = std::min(chunk.size(), symbol_bytes - i);
+        payload.append(reinterpret_cast<const char*>(chunk.data()), count);
+        i += count;
+    }
+
+    // Run symbols are stored as deltas, since they are in order and usually close together.
+    std::size_t previous = 0;
+    for (std::size_t i = 0; i < _frame._runs.size(); ++i)
+    {
+        const user_operation_log::run& r = _frame._runs[i];
+        write_varint(payload, r.symbol - previous);
+        write_varint(payload, r.length);
+        previous = r.symbol;
+    }
+
+    std::string header;
+    write_varint(header, _frame.size());
+    write_varint(header, payload.size());
+    _out.write(header.data(), static_cast<std::streamsize>(header.size()));
+    _out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+    _frame.clear();
+    ++_num_frames;
+}
+
+std::size_t trace_writer::num_frames() const noexcept
+{
+    return _num_frames;
+}
+
+/**********************************************************************************************************************\
+* trace_reader                                                                                                         *
+\**********************************************************************************************************************/
+
+trace_reader::trace_reader(std::istream& in)
+        : _in(in)
+{
+    char header[sizeof(trace_format::magic) + 1];
+    if (!_in.read(header, sizeof(header)) || !std::equal(std::begin(trace_format::magic),
+                                                         std::end(trace_format::magic),
+                                                         std::begin(header)))
+        throw std::runtime_error("Stream is not a trace.");
+    if (static_cast<std::uint8_t>(header[sizeof(trace_format::magic)]) != trace_format::version)
+        throw std::runtime_error("Unsupported trace version.");
+}
+
+bool trace_reader::read_frame(user_operation_log& frame)
+{
+    frame.clear();
+    std::size_t num_ops   = 0;
+    std::size_t num_bytes = 0;
+    if (!read_frame_header(num_ops, num_bytes))
+        return false;
+
+    std::string buffer;
+    while (buffer.size() != num_bytes)
+    {
+        std::size_t offset = buffer.size();
+        std::size_t count  = std::min(num_bytes - offset, read_chunk_bytes);
+        buffer.resize(offset + count);
+        if (!_in.read(buffer.data() + offset, static_cast<std::streamsize>(count)))
+            throw std::runtime_error("Truncated trace frame.");
+    }
+
+    std::string_view payload(buffer);
+    std::uint64_t    num_symbols = 0;
+    std::uint64_t    num_runs    = 0;
+    if (!read_varint(payload, num_symbols) || !read_varint(payload, num_runs) || num_symbols > payload.size() * 4)
+        throw std::runtime_error("Corrupt trace frame.");
+
+    std::size_t symbol_bytes = (num_symbols + 3) / 4;
+    frame._symbols.assign(std::span(reinterpret_cast<const std::uint8_t*>(payload.data()), symbol_bytes));
+    frame._num_symbols = num_symbols;
+    payload.remove_prefix(symbol_bytes);
+
+    // Every run takes at least two bytes, which bounds how many there can be before allocating anything for them.
+    if (num_runs > payload.size() / 2)
+        throw std::runtime_error("Corrupt trace frame.");
+    std::uint64_t symbol = 0;
+    for (std::uint64_t i = 0; i < num_runs; ++i)
+    {
+        std::uint64_t delta  = 0;
+        std::uint64_t length = 0;
+        if (!read_varint(payload, delta) || !read_varint(payload, length))
+            throw std::runtime_error("Corrupt trace frame.");
+        symbol += delta;
+        frame._runs.push_back({symbol, length});
+    }
+
+    if (!payload.empty() || !frame.rebuild() || frame.size() != num_ops)
+    {
+        frame.clear();
+        throw std::runtime_error("Corrupt trace frame.");
+    }
+    return true;
+}
+
+std::size_t trace_reader::skip_frame()
+{
+    std::size_t num_ops   = 0;
+    std::size_t num_bytes = 0;
+    if (!read_frame_header(num_ops, num_bytes))
+        return 0;
+    _in.ignore(static_cast<std::streamsize>(num_bytes));
+    if (static_cast<std::size_t>(_in.gcount()) != num_bytes)
+        throw std::runtime_error("Truncated trace frame.");
+    return num_ops;
+}
+
+bool trace_reader::read_frame_header(std::size_t& num_ops, std::size_t& num_bytes)
+{
+    if (_in.peek() == std::istream::traits_type::eof())
+        return false;
+
+    std::uint64_t ops   = 0;
+    std::uint64_t bytes = 0;
+    if (!read_varint(_in, ops) || !read_varint(_in, bytes))
+        throw std::runtime_error("Truncated trace frame.");
+
+    // Every operation takes at most two symbols, and every run stands in for many operations, so an encoding never
+    // takes more than two bytes per operation beyond the counts at its start.
+    if (bytes > 32 && (bytes - 32) / 2 > ops)
+        throw std::runtime_error("Corrupt trace frame.");
+    num_ops   = ops;
+    num_bytes = bytes;
+    return true;
+}
+
+} // End namespace bedrock.
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+#include "flash.hpp"
+#include "user_operation_log.hpp"
+
+namespace bedrock
+{
+
+/// The binary trace file format for user operations.
+///
+/// A trace is a short header followed by a series of frames. Every frame starts at a toggle of the chip-enable pin that
+/// selects the chip, so it holds one whole command plus anything done while the chip is deselected afterwards. Only
+/// the first frame may start with anything else. Each frame is prefixed by its number of operations and its size in
+/// bytes, so a reader can skip over frames without decoding them.
+///
+/// The operations of a frame are encoded just as user_operation_log stores them: 2-bit symbols with long runs of clock
+/// toggles folded into a table of runs. Sizes and counts are written as LEB128 varints.
+struct trace_format
+{
+    /// The bytes every trace starts with.
+    static constexpr char magic[4] = {'B', 'F', 'T', 'R'};
+
+    /// The version of the trace format written by trace_writer.
+    static constexpr std::uint8_t version = 1;
+};
+
+/// Writes user operations to a stream as a trace, one frame per command.
+///
+/// Operations are buffered until the frame they belong to is complete, so the last frame only reaches the stream when
+/// finish is called or the writer is destroyed.
+class trace_writer
+{
+public:
+    /// Starts a trace by writing its header to the stream.
+    ///
+    /// \param out The stream to write to. It must outlive the writer.
+    explicit trace_writer(std::ostream& out);
+
+    trace_writer(const trace_writer&) = delete;
+
+    trace_writer& operator=(const trace_writer&) = delete;
+
+    /// Writes out the last frame, if finish hasn't been called already.
+    ~trace_writer();
+
+    /// Appends an operation to the trace.
+    void push_back(flash::user_operation op);
+
+    /// Appends every operation of a log to the trace.
+    void write(const user_operation_log& log);
+
+    /// Writes out the frame in progress, even if it isn't complete. Any further operations start a new frame.
+    void finish();
+
+    /// The number of frames written to the stream so far.
+    std::size_t num_frames() const noexcept;
+
+private:
+    /// The stream being written to.
+    std::ostream& _out;
+
+    /// The operations of the frame in progress.
+    user_operation_log _frame;
+
+    /// Whether or not the chip is selected at the end of the frame in progress.
+    bool _selected;
+
+    /// The number of frames written to the stream so far.
+    std::size_t _num_frames;
+};
+
+/// Reads the frames of a trace from a stream.
+class trace_reader
+{
+public:
+    /// Starts reading a trace by reading and checking its header.
+    ///
+    /// \param in The stream to read from. It must outlive the reader.
+    /// \throws std::runtime_error if the stream doesn't start with a supported trace header.
+    explicit trace_reader(std::istream& in);
+
+    /// Reads the next frame.
+    ///
+    /// \param frame Receives the operations of the frame, replacing anything it held before.
+    /// \returns false, leaving frame empty, if there are no more frames.
+    /// \throws std::runtime_error if the frame is truncated or corrupt.
+    bool read_frame(user_operation_log& frame);
+
+    /// Skips over the next frame without decoding it.
+    ///
+    /// \returns The number of operations in the skipped frame, or zero if there are no more frames.
+    /// \throws std::runtime_error if the frame is truncated.
+    std::size_t skip_frame();
+
+private:
+    /// Reads the header of the next frame.
+    ///
+    /// \returns false if there are no more frames.
+    bool read_frame_header(std::size_t& num_ops, std::size_t& num_bytes);
+
+    /// The stream being read from.
+    std::istream& _in;
+};
+
+} // End namespace bedrock.
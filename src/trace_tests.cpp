@@ -0,0 +1,117 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "flash_sim.hpp"
+#include "trace.hpp"
+
+namespace bedrock::test
+{
+
+TEST_CASE("trace", "[trace]")
+{
+    // A write enable, a chip erase, two pages of programming, and a read, through both the single and quad paths.
+    flash_sim f(0x2000);
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x06);
+    f.toggle_chip_enable();
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x60);
+    f.toggle_chip_enable();
+    f.wait_for_write_complete();
+    std::vector<std::byte> page(flash_sim::page_size);
+    for (std::size_t i = 0; i < page.size(); ++i)
+        page[i] = std::byte(i);
+    for (std::uint8_t opcode : {0x02, 0x32})
+    {
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(0x06);
+        f.toggle_chip_enable();
+        f.toggle_chip_enable();
+        f.clock_in_data<8>(opcode);
+        f.clock_in_data<24>(opcode == 0x02 ? 0x0000 : 0x1000);
+        f.clock_in_bytes(page, opcode == 0x02 ? 1 : 4);
+        f.toggle_chip_enable();
+    }
+    std::vector<std::byte> out(0x1000);
+    f.toggle_chip_enable();
+    f.clock_in_data<8>(0x03);
+    f.clock_in_data<24>(0);
+    f.clock_out_bytes(out);
+    f.toggle_chip_enable();
+    const user_operation_log& ops = f.get_user_operations();
+
+    std::stringstream stream;
+    {
+        trace_writer writer(stream);
+        writer.write(ops);
+        writer.finish();
+        REQUIRE(writer.num_frames() == 7);
+    }
+
+    // The trace is much smaller than one character per operation.
+    REQUIRE(stream.str().size() * 10 < ops.size());
+
+    SECTION("read")
+    {
+        trace_reader                       reader(stream);
+        user_operation_log                 frame;
+        std::vector<flash::user_operation> decoded;
+        std::size_t                        num_frames = 0;
+        while (reader.read_frame(frame))
+        {
+            REQUIRE(*frame.begin() == flash::user_operation::toggle_chip_enable);
+            decoded.insert(std::end(decoded), std::begin(frame), std::end(frame));
+            ++num_frames;
+        }
+        REQUIRE(num_frames == 7);
+        REQUIRE(frame.empty());
+        REQUIRE(std::equal(std::begin(decoded), std::end(decoded), std::begin(ops), std::end(ops)));
+
+        // A frame read from a trace can be appended to like any other log.
+        frame.push_back(flash::user_operation::toggle_clock);
+        REQUIRE(frame.back() == flash::user_operation::toggle_clock);
+    }
+
+    SECTION("skip")
+    {
+        // Skipping frames accounts for every operation.
+        trace_reader reader(stream);
+        std::size_t  num_ops = 0;
+        while (std::size_t n = reader.skip_frame())
+            num_ops += n;
+        REQUIRE(num_ops == ops.size());
+    }
+
+    SECTION("corrupt")
+    {
+        std::string truncated = stream.str();
+        truncated.pop_back();
+        std::stringstream  truncated_stream(truncated);
+        trace_reader       reader(truncated_stream);
+        user_operation_log frame;
+        for (int i = 0; i < 6; ++i)
+            REQUIRE(reader.read_frame(frame));
+        REQUIRE_THROWS_AS(reader.read_frame(frame), std::runtime_error);
+
+        // A frame header can't claim more bytes than its operations could take, nor make the reader allocate more than
+        // the stream holds.
+        std::string header    = stream.str().substr(0, sizeof(trace_format::magic) + 1);
+        std::string too_big   = "\x0a\x80\x80\x80\x80\x80\x20";
+        std::string too_short = "\x80\x80\x80\x80\x80\x20\x80\x80\x80\x80\x80\x10";
+        for (const std::string& frame_header : {too_big, too_short})
+        {
+            std::stringstream huge(header + frame_header + "\x01\x00");
+            trace_reader      huge_reader(huge);
+            REQUIRE_THROWS_AS(huge_reader.read_frame(frame), std::runtime_error);
+        }
+
+        std::stringstream not_a_trace("BFTX");
+        REQUIRE_THROWS_AS(trace_reader(not_a_trace), std::runtime_error);
+    }
+}
+
+} // End namespace bedrock::test.
@@ -0,0 +1,439 @@
+#include "user_operation_log.hpp"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace bedrock
+{
+
+namespace
+{
+
+/// The symbols of the operations that clock a byte in over the serial input, starting from a given level.
+struct clock_in_encoding
+{
+    /// The symbols, packed with the first symbol in the least significant bits.
+    std::uint32_t symbols = 0;
+
+    /// The number of symbols, which is also the number of operations.
+    std::uint8_t count = 0;
+
+    /// The number of clocks before the first toggle of the serial input.
+    std::uint8_t leading_clocks = 0;
+
+    /// The number of clocks after the last toggle of the serial input.
+    std::uint8_t tail_clocks = 0;
+
+    /// Whether or not the serial input is high after the last bit.
+    bool level = false;
+};
+
+/// Builds clock_in_encodings.
+constexpr std::array<std::array<clock_in_encoding, 2>, 256> make_clock_in_encodings() noexcept
+{
+    constexpr auto serial_input = static_cast<std::uint32_t>(flash::user_operation::toggle_serial_input);
+    constexpr auto clock        = static_cast<std::uint32_t>(flash::user_operation::toggle_clock);
+    std::array<std::array<clock_in_encoding, 2>, 256> encodings{};
+    for (unsigned value = 0; value < 256; ++value)
+    {
+        for (unsigned start = 0; start < 2; ++start)
+        {
+            clock_in_encoding& e       = encodings[value][start];
+            unsigned           level   = start;
+            bool               toggled = false;
+            for (int bit = 7; bit >= 0; --bit)
+            {
+                if ((value >> bit & 1) != level)
+                {
+                    e.symbols |= serial_input << 2 * e.count++;
+                    level         = !level;
+                    toggled       = true;
+                    e.tail_clocks = 0;
+                }
+                e.symbols |= clock << 2 * e.count++;
+                ++e.tail_clocks;
+                if (!toggled)
+                    ++e.leading_clocks;
+            }
+            e.level = level != 0;
+        }
+    }
+    return encodings;
+}
+
+/// The encoding of every byte clocked in from either level of the serial input, indexed by byte, then level.
+constexpr std::array<std::array<clock_in_encoding, 2>, 256> clock_in_encodings = make_clock_in_encodings();
+
+} // End anonymous namespace.
+
+/**********************************************************************************************************************\
+* user_operation_log                                                                                                   *
+\**********************************************************************************************************************/
+
+user_operation_log::user_operation_log(std::pmr::memory_resource* resource) noexcept
+        : _symbols(resource)
+        , _num_symbols(0)
+        , _runs(resource)
+        , _size(0)
+        , _tail_clocks(0)
+        , _back(flash::user_operation::toggle_chip_enable)
+{
+}
+
+std::pmr::memory_resource* user_operation_log::resource() const noexcept
+{
+    return _symbols.resource();
+}
+
+user_operation_log::const_iterator user_operation_log::begin() const noexcept
+{
+    return const_iterator(this, 0, 0);
+}
+
+user_operation_log::const_iterator user_operation_log::end() const noexcept
+{
+    return const_iterator(this, _num_symbols, _runs.size());
+}
+
+bool user_operation_log::empty() const noexcept
+{
+    return _size == 0;
+}
+
+std::size_t user_operation_log::size() const noexcept
+{
+    return _size;
+}
+
+std::size_t user_operation_log::storage_bytes() const noexcept
+{
+    return (_num_symbols + 3) / 4 + _runs.size() * sizeof(run);
+}
+
+flash::user_operation user_operation_log::back() const
+{
+    if (empty())
+        throw std::out_of_range("Cannot get the last operation of an empty log.");
+    return _back;
+}
+
+void user_operation_log::push_back(flash::user_operation op)
+{
+    ++_size;
+    _back = op;
+    if (op != flash::user_operation::toggle_clock)
+    {
+        push_symbol(op);
+        _tail_clocks = 0;
+        return;
+    }
+
+    // The last symbol already stands in for a run, so just extend the run.
+    if (!_runs.empty() && _runs.back().symbol == _num_symbols - 1)
+    {
+        ++_runs.back().length;
+        return;
+    }
+
+    // Once enough clocks have accumulated at the end of the log, fold them into a single symbol.
+    push_symbol(op);
+    if (++_tail_clocks == min_run_length)
+    {
+        _num_symbols -= min_run_length - 1;
+        _runs.push_back({_num_symbols - 1, min_run_length});
+        _tail_clocks = 0;
+    }
+}
+
+void user_operation_log::push_clock_in(std::byte value, bool& level)
+{
+    // Clocks at the start of the byte may have to extend or fold into a run at the end of the log, in which case the
+    // operations are appended one at a time. Otherwise the symbols are packed as is, since no byte has enough clocks
+    // after a toggle to fold into a run of its own.
+    const clock_in_encoding& e           = clock_in_encodings[std::to_integer<std::size_t>(value)][level];
+    bool                     ends_in_run = !_runs.empty() && _runs.back().symbol == _num_symbols - 1;
+    if (ends_in_run || _tail_clocks + e.leading_clocks >= min_run_length)
+    {
+        auto bits = std::to_integer<unsigned>(value);
+        for (int bit = 7; bit >= 0; --bit)
+        {
+            if ((bits >> bit & 1) != static_cast<unsigned>(level))
+            {
+                push_back(flash::user_operation::toggle_serial_input);
+                level = !level;
+            }
+            push_back(flash::user_operation::toggle_clock);
+        }
+        return;
+    }
+    push_raw_symbols(e.symbols, e.count);
+    _size += e.count;
+    _tail_clocks = e.count == 8 ? _tail_clocks + 8 : e.tail_clocks;
+    _back        = flash::user_operation::toggle_clock;
+    level        = e.level;
+}
+
+void user_operation_log::append(const user_operation_log& other)
+{
+    if (other.empty())
+        return;
+
+    // Clocks at the start of the other log may have to join the clocks at the end of this one. That only happens
+    // when both are clocks, so everything else copies the encoding as is.
+    bool ends_in_run    = !_runs.empty() && _runs.back().symbol == _num_symbols - 1;
+    bool ends_in_clocks = _tail_clocks != 0 || ends_in_run;
+    if (ends_in_clocks && other.raw_symbol(0) == static_cast<unsigned>(flash::user_operation::toggle_clock))
+    {
+        for (flash::user_operation op : other)
+            push_back(op);
+        return;
+    }
+
+    // The symbols are copied a byte at a time, shifted to line up with the end of this log. Anything past the last
+    // symbol of either log is stale, so only the symbols that are in use are kept.
+    std::size_t offset = _num_symbols;
+    unsigned    shift  = offset % 4 * 2;
+    _symbols.resize((offset + 3) / 4);
+    if (shift != 0)
+        _symbols.back() &= static_cast<std::uint8_t>((1u << shift) - 1);
+    for (std::size_t i = 0, num_bytes = (other._num_symbols + 3) / 4; i < num_bytes;)
+    {
+        std::span<const std::uint8_t> bytes = other._symbols.contiguous(i);
+        bytes                               = bytes.first(std::min(bytes.size(), num_bytes - i));
+        if (shift == 0)
+            _symbols.append(bytes);
+        else
+        {
+            for (std::uint8_t byte : bytes)
+            {
+                _symbols.back() |= static_cast<std::uint8_t>(byte << shift);
+                _symbols.push_back(static_cast<std::uint8_t>(byte >> (8 - shift)));
+            }
+        }
+        i += bytes.size();
+    }
+    _num_symbols += other._num_symbols;
+    _symbols.resize((_num_symbols + 3) / 4);
+    for (std::size_t i = 0; i < other._runs.size(); ++i)
+        _runs.push_back({other._runs[i].symbol + offset, other._runs[i].length});
+    _size += other._size;
+    _tail_clocks = other._tail_clocks;
+    _back        = other._back;
+}
+
+void user_operation_log::clear() noexcept
+{
+    _symbols.clear();
+    _runs.clear();
+    _num_symbols = 0;
+    _size        = 0;
+    _tail_clocks = 0;
+}
+
+user_operation_log::cursor user_operation_log::mark() const noexcept
+{
+    cursor c;
+    c._size            = _size;
+    c._num_symbols     = _num_symbols;
+    c._num_runs        = _runs.size();
+    c._last_run_length = _runs.empty() ? 0 : _runs.back().length;
+    c._tail_clocks     = _tail_clocks;
+    c._back            = _back;
+    return c;
+}
+
+void user_operation_log::truncate(const cursor& c)
+{
+    if (c._size > _size || c._num_runs > _runs.size())
+        throw std::invalid_argument("Cannot truncate a log to a cursor past its end.");
+
+    // Everything before the clocks at the tail is left alone by later appends, but the tail may since have been folded
+    // into a run and had its symbols overwritten, so those are written out again.
+    _runs.resize(c._num_runs);
+    if (!_runs.empty())
+        _runs.back().length = c._last_run_length;
+    _num_symbols = c._num_symbols - c._tail_clocks;
+    for (std::size_t i = 0; i < c._tail_clocks; ++i)
+        push_raw_symbol(static_cast<unsigned>(flash::user_operation::toggle_clock));
+    _symbols.resize((_num_symbols + 3) / 4);
+    _size        = c._size;
+    _tail_clocks = c._tail_clocks;
+    _back        = c._back;
+}
+
+flash::user_operation user_operation_log::symbol(std::size_t index) const noexcept
+{
+    unsigned value = raw_symbol(index);
+    if (value == escape_symbol)
+        value += raw_symbol(index + 1);
+    return static_cast<flash::user_operation>(value);
+}
+
+void user_operation_log::push_symbol(flash::user_operation op)
+{
+    auto value = static_cast<unsigned>(op);
+    if (value < escape_symbol)
+        push_raw_symbol(value);
+    else
+    {
+        push_raw_symbol(escape_symbol);
+        push_raw_symbol(value - escape_symbol);
+    }
+}
+
+void user_operation_log::push_raw_symbol(unsigned value)
+{
+    std::size_t byte_index = _num_symbols / 4;
+    unsigned    shift      = _num_symbols % 4 * 2;
+    if (byte_index == _symbols.size())
+        _symbols.push_back(0);
+
+    // Symbols may have been dropped when folding a run, so clear out any stale bits first.
+    _symbols[byte_index] = static_cast<std::uint8_t>((_symbols[byte_index] & ~(0x3 << shift)) | (value << shift));
+    ++_num_symbols;
+}
+
+void user_operation_log::push_raw_symbols(std::uint32_t values, std::size_t count)
+{
+    // As with push_raw_symbol, stale bits past the last symbol are cleared out of the partly filled last byte.
+    std::size_t   byte_index = _num_symbols / 4;
+    unsigned      shift      = _num_symbols % 4 * 2;
+    std::uint64_t bits       = std::uint64_t{values} << shift;
+    for (std::size_t i = 0, num_bytes = (shift + 2 * count + 7) / 8; i < num_bytes; ++i, ++byte_index)
+    {
+        auto byte = static_cast<std::uint8_t>(bits >> 8 * i);
+        if (byte_index == _symbols.size())
+            _symbols.push_back(byte);
+        else if (i == 0)
+            _symbols[byte_index] = static_cast<std::uint8_t>((_symbols[byte_index] & ((1u << shift) - 1)) | byte);
+        else
+            _symbols[byte_index] = byte;
+    }
+    _num_symbols += count;
+}
+
+unsigned user_operation_log::raw_symbol(std::size_t index) const noexcept
+{
+    return (_symbols[index / 4] >> (index % 4 * 2)) & 0x3;
+}
+
+bool user_operation_log::rebuild() noexcept
+{
+    _size        = 0;
+    _tail_clocks = 0;
+    if (_symbols.size() != (_num_symbols + 3) / 4)
+        return false;
+
+    std::size_t run = 0;
+    for (std::size_t index = 0; index < _num_symbols;)
+    {
+        if (raw_symbol(index) == escape_symbol && index + 1 == _num_symbols)
+            return false;
+        flash::user_operation op = symbol(index);
+        if (run < _runs.size() && _runs[run].symbol == index)
+        {
+            if (op != flash::user_operation::toggle_clock || _runs[run].length == 0)
+                return false;
+            _size += _runs[run++].length;
+            _tail_clocks = 0;
+        }
+        else
+        {
+            ++_size;
+            _tail_clocks = op == flash::user_operation::toggle_clock ? _tail_clocks + 1 : 0;
+        }
+        _back = op;
+        index += raw_symbol(index) == escape_symbol ? 2 : 1;
+    }
+
+    // Every run must have been visited, which also means they were in order.
+    return run == _runs.size();
+}
+
+/**********************************************************************************************************************\
+* user_operation_log::const_iterator                                                                                   *
+\**********************************************************************************************************************/
+
+user_operation_log::const_iterator::const_iterator(const user_operation_log* log,
+                                                   std::size_t               symbol,
+                                                   std::size_t               run) noexcept
+        : _log(log)
+        , _symbol(symbol)
+        , _run(run)
+        , _repeat(0)
+{
+}
+
+user_operation_log::const_iterator::reference user_operation_log::const_iterator::operator*() const noexcept
+{
+    return _log->symbol(_symbol);
+}
+
+user_operation_log::const_iterator& user_operation_log::const_iterator::operator++() noexcept
+{
+    if (_run < _log->_runs.size() && _log->_runs[_run].symbol == _symbol)
+    {
+        if (++_repeat < _log->_runs[_run].length)
+            return *this;
+        ++_run;
+        _repeat = 0;
+    }
+    _symbol += _log->raw_symbol(_symbol) == escape_symbol ? 2 : 1;
+    return *this;
+}
+
+user_operation_log::const_iterator user_operation_log::const_iterator::operator++(int) noexcept
+{
+    const_iterator previous = *this;
+    ++*this;
+    return previous;
+}
+
+std::size_t user_operation_log::const_iterator::read(std::span<value_type> out, const const_iterator& last) noexcept
+{
+    std::size_t count = 0;
+    while (count != out.size() && *this != last)
+    {
+        // The rest of a run is copied all at once, stopping early if last is part of the same run.
+        if (_run < _log->_runs.size() && _log->_runs[_run].symbol == _symbol)
+        {
+            std::size_t remaining = _log->_runs[_run].length - _repeat;
+            if (last._symbol == _symbol)
+                remaining = last._repeat - _repeat;
+            std::size_t n = std::min(remaining, out.size() - count);
+            std::fill_n(out.data() + count, n, flash::user_operation::toggle_clock);
+            count += n;
+            _repeat += n;
+            if (_repeat == _log->_runs[_run].length)
+            {
+                ++_run;
+                _repeat = 0;
+                ++_symbol;
+            }
+            continue;
+        }
+
+        // Everything up to the next run or last is plain symbols, which can be decoded without checking for either.
+        std::size_t stop = last._symbol;
+        if (_run < _log->_runs.size())
+            stop = std::min(stop, _log->_runs[_run].symbol);
+        while (_symbol < stop && count != out.size())
+        {
+            unsigned value = _log->raw_symbol(_symbol);
+            if (value == escape_symbol)
+            {
+                out[count++] = _log->symbol(_symbol);
+                _symbol += 2;
+            }
+            else
+            {
+                out[count++] = static_cast<flash::user_operation>(value);
+                ++_symbol;
+            }
+        }
+    }
+    return count;
+}
+
+} // End namespace bedrock.
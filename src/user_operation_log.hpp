@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory_resource>
+#include <span>
+
+#include "chunked_vector.hpp"
+#include "flash.hpp"
+
+namespace bedrock
+{
+
+/// A compact log of user operations, which is only ever appended to or truncated back to an earlier point.
+///
+/// Operations are stored as 2-bit symbols, four to a byte. Chip enable, serial input, and clock toggles each take a
+/// single symbol. The rarer operations, waiting for a write and toggling IO1 to IO3, take an escape symbol followed by
+/// a second symbol. Long runs of flash::user_operation::toggle_clock are further folded into a single symbol plus an
+/// entry in a side table of runs, so clocking out a page of 0x00 or 0xff bytes costs a few bytes of log rather than one
+/// entry per clock.
+///
+/// The symbols and runs are stored in chunks that are never relocated, so a log that grows to billions of operations
+/// never stalls to copy itself into a larger buffer. The chunks come from a std::pmr::memory_resource, so a log can be
+/// backed by an arena of its own.
+class user_operation_log
+{
+public:
+    using value_type = flash::user_operation;
+
+    /// Iterates over the operations in the log in the order in which they were performed.
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type        = flash::user_operation;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const value_type*;
+        using reference         = value_type;
+
+        const_iterator() = default;
+
+        /// Gets the operation the iterator currently refers to.
+        reference operator*() const noexcept;
+
+        /// Advances to the next operation.
+        const_iterator& operator++() noexcept;
+
+        /// Advances to the next operation.
+        const_iterator operator++(int) noexcept;
+
+        /// Copies operations into out, starting with the one the iterator refers to, and advances past them. This is
+        /// much faster than visiting the operations one at a time.
+        ///
+        /// \param out Receives the operations.
+        /// \param last The iterator to stop at.
+        /// \returns The number of operations copied, less than out.size() only when last is reached.
+        std::size_t read(std::span<value_type> out, const const_iterator& last) noexcept;
+
+        friend bool operator==(const const_iterator& lhs, const const_iterator& rhs) noexcept
+        {
+            return lhs._symbol == rhs._symbol && lhs._repeat == rhs._repeat;
+        }
+
+        friend bool operator!=(const const_iterator& lhs, const const_iterator& rhs) noexcept { return !(lhs == rhs); }
+
+    private:
+        friend class user_operation_log;
+
+        const_iterator(const user_operation_log* log, std::size_t symbol, std::size_t run) noexcept;
+
+        /// The log being iterated over.
+        const user_operation_log* _log = nullptr;
+
+        /// The index of the current symbol.
+        std::size_t _symbol = 0;
+
+        /// The index of the first run that does not precede the current symbol.
+        std::size_t _run = 0;
+
+        /// How many operations of the current run have already been visited.
+        std::size_t _repeat = 0;
+    };
+
+    using iterator = const_iterator;
+
+    /// A point in the log that it can later be truncated back to, as taken by mark.
+    class cursor
+    {
+    private:
+        friend class user_operation_log;
+
+        /// The number of operations in the log.
+        std::size_t _size = 0;
+
+        /// The number of symbols in the log.
+        std::size_t _num_symbols = 0;
+
+        /// The number of runs in the log.
+        std::size_t _num_runs = 0;
+
+        /// The length of the last run, which may still have been growing.
+        std::size_t _last_run_length = 0;
+
+        /// The number of clock symbols at the end of the log that had not been folded into a run yet.
+        std::size_t _tail_clocks = 0;
+
+        /// The most recently appended operation.
+        flash::user_operation _back = flash::user_operation::toggle_chip_enable;
+    };
+
+    /// Makes an empty log whose storage comes from the given memory resource, which must outlive the log. As with the
+    /// std::pmr containers, a copy of a log uses the default memory resource, while assigning keeps the resource of the
+    /// target.
+    explicit user_operation_log(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) noexcept;
+
+    /// Gets the memory resource the storage of the log comes from.
+    std::pmr::memory_resource* resource() const noexcept;
+
+    /// Gets an iterator to the first operation in the log.
+    const_iterator begin() const noexcept;
+
+    /// Gets an iterator past the last operation in the log.
+    const_iterator end() const noexcept;
+
+    /// Whether or not the log contains any operations.
+    bool empty() const noexcept;
+
+    /// The number of operations in the log.
+    std::size_t size() const noexcept;
+
+    /// The number of bytes of storage used by the encoded log.
+    std::size_t storage_bytes() const noexcept;
+
+    /// Gets the most recently appended operation.
+    ///
+    /// \throws std::out_of_range if the log is empty.
+    flash::user_operation back() const;
+
+    /// Appends an operation to the end of the log.
+    void push_back(flash::user_operation op);
+
+    /// Appends the operations that clock a byte in over the serial input, as flash::clock_in_bytes does over a single
+    /// IO: for every bit, most significant first, the serial input is toggled if it differs from the bit, then the
+    /// clock is toggled. This packs the symbols for the whole byte at once rather than appending them one at a time.
+    ///
+    /// \param value The byte to clock in.
+    /// \param level Whether or not the serial input is high before the first bit. Updated to after the last bit.
+    void push_clock_in(std::byte value, bool& level);
+
+    /// Appends every operation of another log to the end of this one. Unless both clocks at the end of this log and
+    /// clocks at the start of the other need folding into a run together, this takes time proportional to the size of
+    /// the other log's encoding rather than its number of operations.
+    void append(const user_operation_log& other);
+
+    /// Removes every operation from the log. The storage is kept for reuse.
+    void clear() noexcept;
+
+    /// Gets a cursor for the current end of the log.
+    cursor mark() const noexcept;
+
+    /// Removes every operation appended since a cursor was taken with mark, in constant time. The cursor must have
+    /// come from this log, or from a log this one was copied from, with nothing before the cursor removed since.
+    ///
+    /// \throws std::invalid_argument if the log is already shorter than the cursor.
+    void truncate(const cursor& c);
+
+private:
+    friend class trace_writer;
+    friend class trace_reader;
+
+    /// A run of consecutive flash::user_operation::toggle_clock operations folded into a single symbol.
+    struct run
+    {
+        /// The index of the symbol that stands in for the whole run.
+        std::size_t symbol;
+
+        /// The number of operations in the run.
+        std::size_t length;
+    };
+
+    /// Runs of clock toggles shorter than this are stored symbol by symbol, since a run table entry costs as much as
+    /// this many symbols.
+    static constexpr std::size_t min_run_length = sizeof(run) * 4;
+
+    /// The symbol that introduces a two-symbol operation.
+    static constexpr unsigned escape_symbol = 3;
+
+    /// Decodes the operation starting at the symbol with the given index.
+    flash::user_operation symbol(std::size_t index) const noexcept;
+
+    /// Appends the one or two symbols of an operation, without considering runs.
+    void push_symbol(flash::user_operation op);
+
+    /// Appends a single raw symbol.
+    void push_raw_symbol(unsigned value);
+
+    /// Appends up to 16 raw symbols at once, packed with the first symbol in the least significant bits.
+    void push_raw_symbols(std::uint32_t values, std::size_t count);
+
+    /// Gets the raw symbol with the given index.
+    unsigned raw_symbol(std::size_t index) const noexcept;
+
+    /// Recomputes everything but the symbols and the runs from the symbols and the runs, as after they were read from
+    /// a trace.
+    ///
+    /// \returns false if the symbols and the runs aren't a valid encoding of a log.
+    bool rebuild() noexcept;
+
+    /// The 2-bit symbols, packed four to a byte with the first symbol in the least significant bits.
+    chunked_vector<std::uint8_t> _symbols;
+
+    /// The number of valid symbols in _symbols.
+    std::size_t _num_symbols = 0;
+
+    /// The runs, ordered by symbol index.
+    chunked_vector<run> _runs;
+
+    /// The number of operations in the log.
+    std::size_t _size = 0;
+
+    /// The number of clock symbols at the end of the log that have not been folded into a run yet.
+    std::size_t _tail_clocks = 0;
+
+    /// The most recently appended operation. Escaped operations can't be decoded backwards, so this is kept separately.
+    flash::user_operation _back = flash::user_operation::toggle_chip_enable;
+};
+
+} // End namespace bedrock.
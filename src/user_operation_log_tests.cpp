@@ -0,0 +1,187 @@
+#include <catch2/catch.hpp>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+#include "user_operation_log.hpp"
+
+namespace bedrock::test
+{
+
+TEST_CASE("user_operation_log", "[user_operation_log]")
+{
+    using op = flash::user_operation;
+    user_operation_log log;
+    REQUIRE(log.empty());
+    REQUIRE(log.begin() == log.end());
+    REQUIRE_THROWS_AS(log.back(), std::out_of_range);
+
+    // A mix of short and long clock runs, so both the packed symbols and the run table are exercised.
+    std::vector<op>                    expected;
+    std::mt19937                       rng(1234);
+    std::uniform_int_distribution<int> pick(0, 6);
+    std::uniform_int_distribution<int> run_length(1, 300);
+    for (int i = 0; i < 1000; ++i)
+    {
+        op next = static_cast<op>(pick(rng));
+        int n   = next == op::toggle_clock ? run_length(rng) : 1;
+        for (int j = 0; j < n; ++j)
+        {
+            expected.push_back(next);
+            log.push_back(next);
+            REQUIRE(log.back() == next);
+        }
+    }
+
+    REQUIRE(log.size() == expected.size());
+    REQUIRE(std::vector<op>(log.begin(), log.end()) == expected);
+    REQUIRE(log.storage_bytes() < expected.size() / 4);
+
+    // Reading in chunks, starting and stopping partway into runs, sees the same operations.
+    auto            first = std::next(log.begin(), 1000);
+    auto            last  = std::next(log.begin(), expected.size() - 1000);
+    std::vector<op> chunked;
+    for (std::array<op, 37> chunk; first != last;)
+        chunked.insert(std::end(chunked), std::begin(chunk), std::begin(chunk) + first.read(chunk, last));
+    REQUIRE(chunked == std::vector<op>(std::begin(expected) + 1000, std::end(expected) - 1000));
+
+    log.clear();
+    REQUIRE(log.empty());
+    REQUIRE(log.begin() == log.end());
+}
+
+TEST_CASE("user_operation_log clock runs", "[user_operation_log]")
+{
+    using op = flash::user_operation;
+    user_operation_log log;
+    log.push_back(op::toggle_chip_enable);
+    for (int i = 0; i < 1 << 20; ++i)
+        log.push_back(op::toggle_clock);
+    log.push_back(op::toggle_chip_enable);
+
+    REQUIRE(log.size() == (1 << 20) + 2);
+    REQUIRE(log.storage_bytes() < 64);
+    REQUIRE(std::count(log.begin(), log.end(), op::toggle_clock) == 1 << 20);
+    REQUIRE(log.back() == op::toggle_chip_enable);
+}
+
+TEST_CASE("user_operation_log push_clock_in", "[user_operation_log]")
+{
+    // Packing a byte at a time ends up the same as pushing every toggle, including runs of clocks across bytes.
+    using op = flash::user_operation;
+    user_operation_log log;
+    std::vector<op>    expected;
+    bool               level = false;
+    for (int repeat = 0; repeat < 3; ++repeat)
+    {
+        for (int value = 0; value < 256; ++value)
+        {
+            for (int n = 0; n < (value % 16 == 0 ? 20 : 1); ++n)
+            {
+                bool before = level;
+                log.push_clock_in(std::byte(value), level);
+                for (int bit = 7; bit >= 0; --bit)
+                {
+                    if (((value >> bit & 1) != 0) != before)
+                    {
+                        expected.push_back(op::toggle_serial_input);
+                        before = !before;
+                    }
+                    expected.push_back(op::toggle_clock);
+                }
+                REQUIRE(level == before);
+            }
+        }
+        log.push_back(op::wait_for_write_complete);
+        expected.push_back(op::wait_for_write_complete);
+    }
+    REQUIRE(log.size() == expected.size());
+    REQUIRE(std::vector<op>(log.begin(), log.end()) == expected);
+}
+
+TEST_CASE("user_operation_log append", "[user_operation_log]")
+{
+    // Appending a log ends up the same as pushing its operations one at a time, whichever way the two logs meet.
+    using op    = flash::user_operation;
+    auto pieces = std::vector<std::vector<op>>{
+        {op::toggle_chip_enable, op::toggle_io2, op::toggle_clock},
+        std::vector<op>(100, op::toggle_clock),
+        {op::toggle_serial_input, op::wait_for_write_complete},
+        std::vector<op>(5, op::toggle_clock),
+        std::vector<op>(70, op::toggle_clock),
+        {op::toggle_chip_enable},
+    };
+
+    // A piece spanning more than one chunk of symbols.
+    std::vector<op> large;
+    for (int i = 0; i < 40000; ++i)
+        large.push_back(i % 3 == 0 ? op::toggle_serial_input : op::toggle_clock);
+    pieces.insert(std::begin(pieces) + 1, large);
+    user_operation_log log;
+    std::vector<op>    expected;
+    for (const std::vector<op>& piece : pieces)
+    {
+        user_operation_log other;
+        for (op o : piece)
+            other.push_back(o);
+        auto cursor = log.mark();
+        log.append(other);
+        expected.insert(std::end(expected), std::begin(piece), std::end(piece));
+        REQUIRE(std::vector<op>(log.begin(), log.end()) == expected);
+        REQUIRE(log.back() == expected.back());
+        log.truncate(cursor);
+        log.append(other);
+    }
+    log.push_back(op::toggle_clock);
+    expected.push_back(op::toggle_clock);
+    REQUIRE(log.size() == expected.size());
+    REQUIRE(std::vector<op>(log.begin(), log.end()) == expected);
+}
+
+TEST_CASE("user_operation_log truncate", "[user_operation_log]")
+{
+    // Truncating leaves the log exactly as if the later operations had never been appended, even when the cursor was
+    // taken partway into a run of clocks that has since been folded or extended.
+    using op = flash::user_operation;
+    std::mt19937                       rng(5678);
+    std::uniform_int_distribution<int> pick(0, 6);
+    std::uniform_int_distribution<int> run_length(1, 100);
+    auto                               append = [&](user_operation_log& log, std::vector<op>& ops, int count) {
+        for (int i = 0; i < count; ++i)
+        {
+            op  next = static_cast<op>(pick(rng));
+            int n    = next == op::toggle_clock ? run_length(rng) : 1;
+            ops.insert(std::end(ops), n, next);
+            for (int j = 0; j < n; ++j)
+                log.push_back(next);
+        }
+    };
+
+    user_operation_log log;
+    std::vector<op>    expected;
+    for (int i = 0; i < 50; ++i)
+    {
+        append(log, expected, 20);
+        user_operation_log::cursor c = log.mark();
+        std::vector<op>            later;
+        append(log, later, 20);
+        log.truncate(c);
+        REQUIRE(log.size() == expected.size());
+        REQUIRE(std::vector<op>(log.begin(), log.end()) == expected);
+        if (!expected.empty())
+            REQUIRE(log.back() == expected.back());
+    }
+
+    user_operation_log fresh;
+    for (op o : expected)
+        fresh.push_back(o);
+    REQUIRE(log.storage_bytes() == fresh.storage_bytes());
+
+    user_operation_log::cursor end = log.mark();
+    log.clear();
+    REQUIRE_THROWS_AS(log.truncate(end), std::invalid_argument);
+}
+
+} // End namespace bedrock::test.